@@ -0,0 +1,1622 @@
+/*
+ Fast hash engines - Non-cryptographic and tree hash algorithms for the digest
+ checksum tools, written in C++ for Windows platform:
+ XXH3-128 - xxHash 3, 128 bits output (xxh128sum compatible).
+ CRC32C   - Castagnoli CRC (iSCSI), SSE4.2 crc32 instruction with PCLMUL folding.
+ BLAKE3   - BLAKE3 tree hash (b3sum compatible), SSE2 4-way chunks and multi-threading.
+ Records  - many short messages at once, 4 per SSE2 register (MD5 and BLAKE3).
+ https://github.com/fshb/digest-checksum-tools/
+ Copyright (c) 2019 Sun Hongbo (Felix)
+
+ Permission is hereby granted, free of charge, to any person obtaining a copy
+ of this Software and associated documentation files (the "Software"), to deal
+ in the Software without restriction, including without limitation the rights
+ to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ copies of the Software, and to permit persons to whom the Software is
+ furnished to do so, subject to the following conditions:
+
+ The above copyright notice and this permission notice shall be included in
+ all copies or substantial portions of the Software.
+
+ THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ THE SOFTWARE.
+*/
+#pragma once
+
+#include <windows.h>
+#include <string.h>
+#include <stdint.h>
+#include <new>
+#include <map>
+#include <vector>
+#include "workpool.h"
+
+#if defined(_M_X64) || defined(_M_IX86) || defined(__x86_64__) || defined(__i386__)
+#define FASTHASH_X86
+#include <emmintrin.h>
+#include <nmmintrin.h>
+#include <wmmintrin.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#else
+#include <cpuid.h>
+#endif
+#endif
+
+#if defined(_M_X64) || defined(__x86_64__)
+#define FASTHASH_X64
+#endif
+
+//interface shared by every digest engine: feed data with update(), then finish() once.
+class digest_hasher
+{
+public:
+	virtual ~digest_hasher() {}
+
+	//hash states are allocated on the NUMA node of the thread creating them, see
+	//work_pool::local_heap(); the heap is kept in front of the object for the delete
+	static void* operator new(size_t len)
+	{
+		const size_t prefix = 16; //keeps the alignment of the heap
+		HANDLE heap = work_pool::local_heap();
+		BYTE* p = (BYTE*)HeapAlloc(heap, 0, len + prefix);
+		if (p == NULL)
+			throw std::bad_alloc();
+		*(HANDLE*)p = heap;
+		return p + prefix;
+	}
+
+	static void operator delete(void* object)
+	{
+		const size_t prefix = 16;
+		if (object == NULL)
+			return;
+		BYTE* p = (BYTE*)object - prefix;
+		HeapFree(*(HANDLE*)p, 0, p);
+	}
+
+	virtual void update(const BYTE* data, size_t len) = 0;
+	virtual DWORD finish(BYTE* digest) = 0; //returns the digest length in bytes
+};
+
+namespace fasthash
+{
+	struct cpu_features
+	{
+		bool sse42;
+		bool pclmul;
+
+		cpu_features() : sse42(false), pclmul(false)
+		{
+#ifdef FASTHASH_X86
+#ifdef _MSC_VER
+			int r[4] = { 0 };
+			__cpuid(r, 1);
+			unsigned int ecx = (unsigned int)r[2];
+#else
+			unsigned int eax = 0, ebx = 0, ecx = 0, edx = 0;
+			__get_cpuid(1, &eax, &ebx, &ecx, &edx);
+#endif
+			sse42 = (ecx >> 20 & 1) != 0;
+			pclmul = (ecx >> 1 & 1) != 0;
+#endif
+		}
+
+		static const cpu_features& get()
+		{
+			static cpu_features features;
+			return features;
+		}
+	};
+
+	inline uint32_t read32(const BYTE* p) { uint32_t v; memcpy(&v, p, sizeof(v)); return v; }
+	inline uint64_t read64(const BYTE* p) { uint64_t v; memcpy(&v, p, sizeof(v)); return v; }
+	inline void write32(BYTE* p, uint32_t v) { memcpy(p, &v, sizeof(v)); }
+
+	inline void write64_be(BYTE* p, uint64_t v)
+	{
+		for (int i = 7; i >= 0; i--, v >>= 8)
+			p[i] = (BYTE)(v & 0xFF);
+	}
+
+	inline uint32_t swap32(uint32_t v)
+	{
+		return (v >> 24) | ((v >> 8) & 0xFF00) | ((v << 8) & 0xFF0000) | (v << 24);
+	}
+
+	inline uint64_t swap64(uint64_t v)
+	{
+		return ((uint64_t)swap32((uint32_t)v) << 32) | swap32((uint32_t)(v >> 32));
+	}
+
+	inline uint64_t rotl64(uint64_t v, int n) { return (v << n) | (v >> (64 - n)); }
+	inline uint32_t rotl32(uint32_t v, int n) { return (v << n) | (v >> (32 - n)); }
+	inline uint32_t rotr32(uint32_t v, int n) { return (v >> n) | (v << (32 - n)); }
+
+	//full 64x64 -> 128 bits product, returns the low half
+	inline uint64_t mul128(uint64_t a, uint64_t b, uint64_t* hi)
+	{
+#if defined(_MSC_VER) && defined(_M_X64)
+		return _umul128(a, b, hi);
+#elif defined(__SIZEOF_INT128__)
+		unsigned __int128 p = (unsigned __int128)a * b;
+		*hi = (uint64_t)(p >> 64);
+		return (uint64_t)p;
+#else
+		uint64_t lo_lo = (a & 0xFFFFFFFF) * (b & 0xFFFFFFFF);
+		uint64_t hi_lo = (a >> 32) * (b & 0xFFFFFFFF);
+		uint64_t lo_hi = (a & 0xFFFFFFFF) * (b >> 32);
+		uint64_t hi_hi = (a >> 32) * (b >> 32);
+		uint64_t cross = (lo_lo >> 32) + (hi_lo & 0xFFFFFFFF) + lo_hi;
+		*hi = (hi_lo >> 32) + (cross >> 32) + hi_hi;
+		return (cross << 32) | (lo_lo & 0xFFFFFFFF);
+#endif
+	}
+
+	inline uint64_t mul128_fold64(uint64_t a, uint64_t b)
+	{
+		uint64_t hi;
+		uint64_t lo = mul128(a, b, &hi);
+		return lo ^ hi;
+	}
+}
+
+//XXH3 with 128 bits output and the default secret, seed 0.
+//digest is printed in the canonical (big endian) form, same as xxh128sum.
+//Simd false keeps to the portable scalar code, for --provider=reference.
+template<bool Simd>
+class xxh3_128_engine : public digest_hasher
+{
+private:
+	enum : size_t
+	{
+		STRIPE_LEN = 64,
+		SECRET_CONSUME_RATE = 8,
+		ACC_NB = 8,
+		SECRET_SIZE = 192,
+		SECRET_SIZE_MIN = 136,
+		SECRET_MERGEACCS_START = 11,
+		SECRET_LASTACC_START = 7,
+		MID_SIZE_MAX = 240,
+		BUFFER_SIZE = 256,
+		BUFFER_STRIPES = BUFFER_SIZE / STRIPE_LEN,
+		STRIPES_PER_BLOCK = (SECRET_SIZE - STRIPE_LEN) / SECRET_CONSUME_RATE
+	};
+
+	static const uint32_t PRIME32_1 = 0x9E3779B1U;
+	static const uint32_t PRIME32_2 = 0x85EBCA77U;
+	static const uint32_t PRIME32_3 = 0xC2B2AE3DU;
+	static const uint64_t PRIME64_1 = 0x9E3779B185EBCA87ULL;
+	static const uint64_t PRIME64_2 = 0xC2B2AE3D27D4EB4FULL;
+	static const uint64_t PRIME64_3 = 0x165667B19E3779F9ULL;
+	static const uint64_t PRIME64_4 = 0x85EBCA77C2B2AE63ULL;
+	static const uint64_t PRIME64_5 = 0x27D4EB2F165667C5ULL;
+
+	uint64_t _acc[ACC_NB];
+	BYTE _buffer[BUFFER_SIZE];
+	size_t _buffered;
+	size_t _stripes_acc;
+	uint64_t _total_len;
+
+private:
+	static const BYTE* secret()
+	{
+		static const BYTE default_secret[SECRET_SIZE] = {
+			0xb8, 0xfe, 0x6c, 0x39, 0x23, 0xa4, 0x4b, 0xbe, 0x7c, 0x01, 0x81, 0x2c, 0xf7, 0x21, 0xad, 0x1c,
+			0xde, 0xd4, 0x6d, 0xe9, 0x83, 0x90, 0x97, 0xdb, 0x72, 0x40, 0xa4, 0xa4, 0xb7, 0xb3, 0x67, 0x1f,
+			0xcb, 0x79, 0xe6, 0x4e, 0xcc, 0xc0, 0xe5, 0x78, 0x82, 0x5a, 0xd0, 0x7d, 0xcc, 0xff, 0x72, 0x21,
+			0xb8, 0x08, 0x46, 0x74, 0xf7, 0x43, 0x24, 0x8e, 0xe0, 0x35, 0x90, 0xe6, 0x81, 0x3a, 0x26, 0x4c,
+			0x3c, 0x28, 0x52, 0xbb, 0x91, 0xc3, 0x00, 0xcb, 0x88, 0xd0, 0x65, 0x8b, 0x1b, 0x53, 0x2e, 0xa3,
+			0x71, 0x64, 0x48, 0x97, 0xa2, 0x0d, 0xf9, 0x4e, 0x38, 0x19, 0xef, 0x46, 0xa9, 0xde, 0xac, 0xd8,
+			0xa8, 0xfa, 0x76, 0x3f, 0xe3, 0x9c, 0x34, 0x3f, 0xf9, 0xdc, 0xbb, 0xc7, 0xc7, 0x0b, 0x4f, 0x1d,
+			0x8a, 0x51, 0xe0, 0x4b, 0xcd, 0xb4, 0x59, 0x31, 0xc8, 0x9f, 0x7e, 0xc9, 0xd9, 0x78, 0x73, 0x64,
+			0xea, 0xc5, 0xac, 0x83, 0x34, 0xd3, 0xeb, 0xc3, 0xc5, 0x81, 0xa0, 0xff, 0xfa, 0x13, 0x63, 0xeb,
+			0x17, 0x0d, 0xdd, 0x51, 0xb7, 0xf0, 0xda, 0x49, 0xd3, 0x16, 0x55, 0x26, 0x29, 0xd4, 0x68, 0x9e,
+			0x2b, 0x16, 0xbe, 0x58, 0x7d, 0x47, 0xa1, 0xfc, 0x8f, 0xf8, 0xb8, 0xd1, 0x7a, 0xd0, 0x31, 0xce,
+			0x45, 0xcb, 0x3a, 0x8f, 0x95, 0x16, 0x04, 0x28, 0xaf, 0xd7, 0xfb, 0xca, 0xbb, 0x4b, 0x40, 0x7e };
+		return default_secret;
+	}
+
+	static uint64_t xxh64_avalanche(uint64_t h)
+	{
+		h ^= h >> 33;
+		h *= PRIME64_2;
+		h ^= h >> 29;
+		h *= PRIME64_3;
+		h ^= h >> 32;
+		return h;
+	}
+
+	static uint64_t avalanche(uint64_t h)
+	{
+		h ^= h >> 37;
+		h *= 0x165667919E3779F9ULL;
+		h ^= h >> 32;
+		return h;
+	}
+
+	static void accumulate_512(uint64_t* acc, const BYTE* input, const BYTE* key)
+	{
+#ifdef FASTHASH_X86
+		if (Simd)
+		{
+			for (size_t i = 0; i < STRIPE_LEN / 16; i++)
+			{
+				__m128i data_vec = _mm_loadu_si128((const __m128i*)(input + 16 * i));
+				__m128i key_vec = _mm_loadu_si128((const __m128i*)(key + 16 * i));
+				__m128i data_key = _mm_xor_si128(data_vec, key_vec);
+				__m128i data_key_lo = _mm_shuffle_epi32(data_key, _MM_SHUFFLE(0, 3, 0, 1));
+				__m128i product = _mm_mul_epu32(data_key, data_key_lo);
+				__m128i data_swap = _mm_shuffle_epi32(data_vec, _MM_SHUFFLE(1, 0, 3, 2));
+				__m128i sum = _mm_add_epi64(_mm_loadu_si128((const __m128i*)(acc + 2 * i)), data_swap);
+				_mm_storeu_si128((__m128i*)(acc + 2 * i), _mm_add_epi64(product, sum));
+			}
+			return;
+		}
+#endif
+		for (size_t i = 0; i < ACC_NB; i++)
+		{
+			uint64_t data_val = fasthash::read64(input + 8 * i);
+			uint64_t data_key = data_val ^ fasthash::read64(key + 8 * i);
+			acc[i ^ 1] += data_val;
+			acc[i] += (data_key & 0xFFFFFFFF) * (data_key >> 32);
+		}
+	}
+
+	static void scramble(uint64_t* acc, const BYTE* key)
+	{
+#ifdef FASTHASH_X86
+		if (Simd)
+		{
+			const __m128i prime32 = _mm_set1_epi32((int)PRIME32_1);
+			for (size_t i = 0; i < STRIPE_LEN / 16; i++)
+			{
+				__m128i acc_vec = _mm_loadu_si128((const __m128i*)(acc + 2 * i));
+				__m128i data_vec = _mm_xor_si128(acc_vec, _mm_srli_epi64(acc_vec, 47));
+				__m128i key_vec = _mm_loadu_si128((const __m128i*)(key + 16 * i));
+				__m128i data_key = _mm_xor_si128(data_vec, key_vec);
+				__m128i data_key_hi = _mm_shuffle_epi32(data_key, _MM_SHUFFLE(0, 3, 0, 1));
+				__m128i prod_lo = _mm_mul_epu32(data_key, prime32);
+				__m128i prod_hi = _mm_mul_epu32(data_key_hi, prime32);
+				_mm_storeu_si128((__m128i*)(acc + 2 * i), _mm_add_epi64(prod_lo, _mm_slli_epi64(prod_hi, 32)));
+			}
+			return;
+		}
+#endif
+		for (size_t i = 0; i < ACC_NB; i++)
+		{
+			uint64_t v = acc[i] ^ (acc[i] >> 47);
+			v ^= fasthash::read64(key + 8 * i);
+			acc[i] = v * PRIME32_1;
+		}
+	}
+
+	static void accumulate(uint64_t* acc, const BYTE* input, const BYTE* key, size_t nb_stripes)
+	{
+		for (size_t i = 0; i < nb_stripes; i++)
+			accumulate_512(acc, input + i * STRIPE_LEN, key + i * SECRET_CONSUME_RATE);
+	}
+
+	static void consume_stripes(uint64_t* acc, size_t& stripes_acc, const BYTE* input, size_t nb_stripes)
+	{
+		const BYTE* key = secret();
+		if (STRIPES_PER_BLOCK - stripes_acc <= nb_stripes)
+		{
+			size_t stripes_to_end = STRIPES_PER_BLOCK - stripes_acc;
+			size_t stripes_after_end = nb_stripes - stripes_to_end;
+			accumulate(acc, input, key + stripes_acc * SECRET_CONSUME_RATE, stripes_to_end);
+			scramble(acc, key + SECRET_SIZE - STRIPE_LEN);
+			accumulate(acc, input + stripes_to_end * STRIPE_LEN, key, stripes_after_end);
+			stripes_acc = stripes_after_end;
+		}
+		else
+		{
+			accumulate(acc, input, key + stripes_acc * SECRET_CONSUME_RATE, nb_stripes);
+			stripes_acc += nb_stripes;
+		}
+	}
+
+	static uint64_t merge_accs(const uint64_t* acc, const BYTE* key, uint64_t start)
+	{
+		uint64_t result = start;
+		for (size_t i = 0; i < 4; i++)
+			result += fasthash::mul128_fold64(acc[2 * i] ^ fasthash::read64(key + 16 * i),
+				acc[2 * i + 1] ^ fasthash::read64(key + 16 * i + 8));
+		return avalanche(result);
+	}
+
+	static uint64_t mix16(const BYTE* input, const BYTE* key)
+	{
+		return fasthash::mul128_fold64(fasthash::read64(input) ^ fasthash::read64(key),
+			fasthash::read64(input + 8) ^ fasthash::read64(key + 8));
+	}
+
+	static void mix32(uint64_t& lo, uint64_t& hi, const BYTE* input1, const BYTE* input2, const BYTE* key)
+	{
+		lo += mix16(input1, key);
+		lo ^= fasthash::read64(input2) + fasthash::read64(input2 + 8);
+		hi += mix16(input2, key + 16);
+		hi ^= fasthash::read64(input1) + fasthash::read64(input1 + 8);
+	}
+
+	//one shot hash for inputs up to MID_SIZE_MAX bytes
+	static void hash_short(const BYTE* input, size_t len, uint64_t& lo, uint64_t& hi)
+	{
+		const BYTE* key = secret();
+		if (len == 0)
+		{
+			lo = xxh64_avalanche(fasthash::read64(key + 64) ^ fasthash::read64(key + 72));
+			hi = xxh64_avalanche(fasthash::read64(key + 80) ^ fasthash::read64(key + 88));
+		}
+		else if (len <= 3)
+		{
+			uint32_t c1 = input[0], c2 = input[len >> 1], c3 = input[len - 1];
+			uint32_t combined_lo = (c1 << 16) | (c2 << 24) | c3 | ((uint32_t)len << 8);
+			uint32_t combined_hi = fasthash::rotl32(fasthash::swap32(combined_lo), 13);
+			uint64_t flip_lo = (uint64_t)(fasthash::read32(key) ^ fasthash::read32(key + 4));
+			uint64_t flip_hi = (uint64_t)(fasthash::read32(key + 8) ^ fasthash::read32(key + 12));
+			lo = xxh64_avalanche(combined_lo ^ flip_lo);
+			hi = xxh64_avalanche(combined_hi ^ flip_hi);
+		}
+		else if (len <= 8)
+		{
+			uint32_t input_lo = fasthash::read32(input);
+			uint32_t input_hi = fasthash::read32(input + len - 4);
+			uint64_t input64 = input_lo + ((uint64_t)input_hi << 32);
+			uint64_t flip = fasthash::read64(key + 16) ^ fasthash::read64(key + 24);
+			uint64_t keyed = input64 ^ flip;
+			uint64_t m_hi;
+			uint64_t m_lo = fasthash::mul128(keyed, PRIME64_1 + ((uint64_t)len << 2), &m_hi);
+			m_hi += m_lo << 1;
+			m_lo ^= m_hi >> 3;
+			m_lo ^= m_lo >> 35;
+			m_lo *= 0x9FB21C651E98DF25ULL;
+			m_lo ^= m_lo >> 28;
+			lo = m_lo;
+			hi = avalanche(m_hi);
+		}
+		else if (len <= 16)
+		{
+			uint64_t flip_lo = fasthash::read64(key + 32) ^ fasthash::read64(key + 40);
+			uint64_t flip_hi = fasthash::read64(key + 48) ^ fasthash::read64(key + 56);
+			uint64_t input_lo = fasthash::read64(input);
+			uint64_t input_hi = fasthash::read64(input + len - 8);
+			uint64_t m_hi;
+			uint64_t m_lo = fasthash::mul128(input_lo ^ input_hi ^ flip_lo, PRIME64_1, &m_hi);
+			m_lo += (uint64_t)(len - 1) << 54;
+			input_hi ^= flip_hi;
+			m_hi += input_hi + (uint64_t)(uint32_t)input_hi * (PRIME32_2 - 1);
+			m_lo ^= fasthash::swap64(m_hi);
+			uint64_t r_hi;
+			uint64_t r_lo = fasthash::mul128(m_lo, PRIME64_2, &r_hi);
+			r_hi += m_hi * PRIME64_2;
+			lo = avalanche(r_lo);
+			hi = avalanche(r_hi);
+		}
+		else
+		{
+			uint64_t acc_lo = (uint64_t)len * PRIME64_1;
+			uint64_t acc_hi = 0;
+			if (len <= 128)
+			{
+				if (len > 32)
+				{
+					if (len > 64)
+					{
+						if (len > 96)
+							mix32(acc_lo, acc_hi, input + 48, input + len - 64, key + 96);
+						mix32(acc_lo, acc_hi, input + 32, input + len - 48, key + 64);
+					}
+					mix32(acc_lo, acc_hi, input + 16, input + len - 32, key + 32);
+				}
+				mix32(acc_lo, acc_hi, input, input + len - 16, key);
+			}
+			else
+			{
+				size_t nb_rounds = len / 32;
+				size_t i;
+				for (i = 0; i < 4; i++)
+					mix32(acc_lo, acc_hi, input + 32 * i, input + 32 * i + 16, key + 32 * i);
+				acc_lo = avalanche(acc_lo);
+				acc_hi = avalanche(acc_hi);
+				for (i = 4; i < nb_rounds; i++)
+					mix32(acc_lo, acc_hi, input + 32 * i, input + 32 * i + 16, key + 3 + 32 * (i - 4));
+				mix32(acc_lo, acc_hi, input + len - 16, input + len - 32, key + SECRET_SIZE_MIN - 17 - 16);
+			}
+			lo = avalanche(acc_lo + acc_hi);
+			hi = 0 - avalanche(acc_lo * PRIME64_1 + acc_hi * PRIME64_4 + (uint64_t)len * PRIME64_2);
+		}
+	}
+
+public:
+	xxh3_128_engine() : _buffered(0), _stripes_acc(0), _total_len(0)
+	{
+		_acc[0] = PRIME32_3; _acc[1] = PRIME64_1; _acc[2] = PRIME64_2; _acc[3] = PRIME64_3;
+		_acc[4] = PRIME64_4; _acc[5] = PRIME32_2; _acc[6] = PRIME64_5; _acc[7] = PRIME32_1;
+	}
+
+	void update(const BYTE* data, size_t len)
+	{
+		_total_len += len;
+		if (_buffered + len <= BUFFER_SIZE)
+		{
+			memcpy(_buffer + _buffered, data, len);
+			_buffered += len;
+			return;
+		}
+
+		if (_buffered > 0)
+		{
+			size_t fill = BUFFER_SIZE - _buffered;
+			memcpy(_buffer + _buffered, data, fill);
+			data += fill;
+			len -= fill;
+			consume_stripes(_acc, _stripes_acc, _buffer, BUFFER_STRIPES);
+			_buffered = 0;
+		}
+
+		if (len > BUFFER_SIZE)
+		{
+			do {
+				consume_stripes(_acc, _stripes_acc, data, BUFFER_STRIPES);
+				data += BUFFER_SIZE;
+				len -= BUFFER_SIZE;
+			} while (len > BUFFER_SIZE);
+			//keep the last stripe for the final round
+			memcpy(_buffer + BUFFER_SIZE - STRIPE_LEN, data - STRIPE_LEN, STRIPE_LEN);
+		}
+
+		memcpy(_buffer, data, len);
+		_buffered = len;
+	}
+
+	DWORD finish(BYTE* digest)
+	{
+		uint64_t lo, hi;
+		if (_total_len <= MID_SIZE_MAX)
+			hash_short(_buffer, (size_t)_total_len, lo, hi);
+		else
+		{
+			const BYTE* key = secret();
+			uint64_t acc[ACC_NB];
+			memcpy(acc, _acc, sizeof(acc));
+			if (_buffered >= STRIPE_LEN)
+			{
+				size_t stripes_acc = _stripes_acc;
+				consume_stripes(acc, stripes_acc, _buffer, (_buffered - 1) / STRIPE_LEN);
+				accumulate_512(acc, _buffer + _buffered - STRIPE_LEN, key + SECRET_SIZE - STRIPE_LEN - SECRET_LASTACC_START);
+			}
+			else
+			{
+				BYTE last_stripe[STRIPE_LEN];
+				size_t catchup = STRIPE_LEN - _buffered;
+				memcpy(last_stripe, _buffer + BUFFER_SIZE - catchup, catchup);
+				memcpy(last_stripe + catchup, _buffer, _buffered);
+				accumulate_512(acc, last_stripe, key + SECRET_SIZE - STRIPE_LEN - SECRET_LASTACC_START);
+			}
+			lo = merge_accs(acc, key + SECRET_MERGEACCS_START, _total_len * PRIME64_1);
+			hi = merge_accs(acc, key + SECRET_SIZE - sizeof(acc) - SECRET_MERGEACCS_START, ~(_total_len * PRIME64_2));
+		}
+		fasthash::write64_be(digest, hi);
+		fasthash::write64_be(digest + 8, lo);
+		return 16;
+	}
+};
+
+typedef xxh3_128_engine<true> xxh3_128_hasher;
+typedef xxh3_128_engine<false> xxh3_128_scalar;
+
+//CRC-32C (Castagnoli), reflected polynomial 0x82F63B78.
+//uses the SSE4.2 crc32 instruction on three interleaved streams and merges them
+//with a carry-less multiply when PCLMULQDQ is available, a lookup table otherwise.
+//Simd false always uses the table, for --provider=reference.
+template<bool Simd>
+class crc32c_engine : public digest_hasher
+{
+private:
+	enum : size_t { STREAM_LEN = 2048 };
+	static const uint32_t POLY = 0x82F63B78U;
+
+	uint32_t _crc;
+
+private:
+	static const uint32_t* table()
+	{
+		static struct crc_table_t
+		{
+			uint32_t t[256];
+			crc_table_t()
+			{
+				for (uint32_t i = 0; i < 256; i++)
+				{
+					uint32_t c = i;
+					for (int k = 0; k < 8; k++)
+						c = (c & 1) ? (c >> 1) ^ POLY : c >> 1;
+					t[i] = c;
+				}
+			}
+		} crc_table;
+		return crc_table.t;
+	}
+
+	static uint32_t extend_sw(uint32_t crc, const BYTE* data, size_t len)
+	{
+		const uint32_t* t = table();
+		while (len--)
+			crc = t[(crc ^ *data++) & 0xFF] ^ (crc >> 8);
+		return crc;
+	}
+
+#ifdef FASTHASH_X86
+	//x^n mod P in reflected bit order
+	static uint32_t xpow_mod(size_t n)
+	{
+		uint32_t v = 0x80000000U; //x^0
+		while (n--)
+			v = (v & 1) ? (v >> 1) ^ POLY : v >> 1;
+		return v;
+	}
+
+	static uint32_t extend_hw(uint32_t crc, const BYTE* data, size_t len)
+	{
+		while (len > 0 && ((uintptr_t)data & 7) != 0)
+		{
+			crc = _mm_crc32_u8(crc, *data++);
+			len--;
+		}
+#ifdef FASTHASH_X64
+		if (fasthash::cpu_features::get().pclmul && len >= 3 * STREAM_LEN)
+		{
+			//(crc * x^(8n)) mod P == crc32(0, clmul(crc, x^(8n-33) mod P))
+			static const uint32_t k1 = xpow_mod(8 * STREAM_LEN - 33);
+			static const uint32_t k2 = xpow_mod(16 * STREAM_LEN - 33);
+			const __m128i vk1 = _mm_cvtsi32_si128((int)k1);
+			const __m128i vk2 = _mm_cvtsi32_si128((int)k2);
+
+			do {
+				uint64_t c0 = crc, c1 = 0, c2 = 0;
+				for (size_t i = 0; i < STREAM_LEN; i += 8)
+				{
+					c0 = _mm_crc32_u64(c0, fasthash::read64(data + i));
+					c1 = _mm_crc32_u64(c1, fasthash::read64(data + STREAM_LEN + i));
+					c2 = _mm_crc32_u64(c2, fasthash::read64(data + 2 * STREAM_LEN + i));
+				}
+				__m128i s0 = _mm_clmulepi64_si128(_mm_cvtsi32_si128((int)(uint32_t)c0), vk2, 0x00);
+				__m128i s1 = _mm_clmulepi64_si128(_mm_cvtsi32_si128((int)(uint32_t)c1), vk1, 0x00);
+				uint64_t folded = (uint64_t)_mm_cvtsi128_si64(_mm_xor_si128(s0, s1));
+				crc = (uint32_t)_mm_crc32_u64(0, folded) ^ (uint32_t)c2;
+
+				data += 3 * STREAM_LEN;
+				len -= 3 * STREAM_LEN;
+			} while (len >= 3 * STREAM_LEN);
+		}
+		while (len >= 8)
+		{
+			crc = (uint32_t)_mm_crc32_u64(crc, fasthash::read64(data));
+			data += 8;
+			len -= 8;
+		}
+#else
+		while (len >= 4)
+		{
+			crc = _mm_crc32_u32(crc, fasthash::read32(data));
+			data += 4;
+			len -= 4;
+		}
+#endif
+		while (len > 0)
+		{
+			crc = _mm_crc32_u8(crc, *data++);
+			len--;
+		}
+		return crc;
+	}
+#endif
+
+public:
+	crc32c_engine() : _crc(0xFFFFFFFFU) {}
+
+	void update(const BYTE* data, size_t len)
+	{
+#ifdef FASTHASH_X86
+		if (Simd && fasthash::cpu_features::get().sse42)
+		{
+			_crc = extend_hw(_crc, data, len);
+			return;
+		}
+#endif
+		_crc = extend_sw(_crc, data, len);
+	}
+
+	DWORD finish(BYTE* digest)
+	{
+		uint32_t crc = ~_crc;
+		digest[0] = (BYTE)(crc >> 24);
+		digest[1] = (BYTE)(crc >> 16);
+		digest[2] = (BYTE)(crc >> 8);
+		digest[3] = (BYTE)crc;
+		return 4;
+	}
+};
+
+typedef crc32c_engine<true> crc32c_hasher;
+typedef crc32c_engine<false> crc32c_scalar;
+
+//BLAKE3 hash mode, 256 bits output.
+//whole chunks are compressed 4 at a time with SSE2; large aligned subtrees of a single
+//update() are split over the work pool when one is given.
+//Simd false compresses one chunk at a time, for --provider=reference.
+template<bool Simd>
+class blake3_engine : public digest_hasher
+{
+private:
+	enum : size_t
+	{
+		BLOCK_LEN = 64,
+		CHUNK_LEN = 1024,
+		OUT_LEN = 32,
+		MAX_DEPTH = 54,
+		SIMD_DEGREE = 4,
+		PARALLEL_PART_MIN = 64 * 1024, //smallest subtree worth a thread
+		PARALLEL_PARTS_MAX = 64
+	};
+
+	enum : BYTE
+	{
+		CHUNK_START = 1 << 0,
+		CHUNK_END = 1 << 1,
+		PARENT = 1 << 2,
+		ROOT = 1 << 3
+	};
+
+	struct chunk_state
+	{
+		uint32_t cv[8];
+		uint64_t chunk_counter;
+		BYTE buf[BLOCK_LEN];
+		BYTE buf_len;
+		BYTE blocks_compressed;
+		BYTE flags;
+
+		void init(const uint32_t key[8], BYTE f)
+		{
+			memcpy(cv, key, sizeof(cv));
+			chunk_counter = 0;
+			memset(buf, 0, sizeof(buf));
+			buf_len = 0;
+			blocks_compressed = 0;
+			flags = f;
+		}
+
+		size_t len() const { return BLOCK_LEN * (size_t)blocks_compressed + buf_len; }
+		BYTE start_flag() const { return blocks_compressed == 0 ? (BYTE)CHUNK_START : (BYTE)0; }
+
+		size_t fill_buf(const BYTE* input, size_t input_len)
+		{
+			size_t take = BLOCK_LEN - buf_len;
+			if (take > input_len)
+				take = input_len;
+			memcpy(buf + buf_len, input, take);
+			buf_len += (BYTE)take;
+			return take;
+		}
+
+		void update(const BYTE* input, size_t input_len)
+		{
+			if (buf_len > 0)
+			{
+				size_t take = fill_buf(input, input_len);
+				input += take;
+				input_len -= take;
+				if (input_len > 0)
+				{
+					compress_in_place(cv, buf, BLOCK_LEN, chunk_counter, flags | start_flag());
+					blocks_compressed++;
+					buf_len = 0;
+					memset(buf, 0, sizeof(buf));
+				}
+			}
+			while (input_len > BLOCK_LEN)
+			{
+				compress_in_place(cv, input, BLOCK_LEN, chunk_counter, flags | start_flag());
+				blocks_compressed++;
+				input += BLOCK_LEN;
+				input_len -= BLOCK_LEN;
+			}
+			fill_buf(input, input_len);
+		}
+	};
+
+	struct output_t
+	{
+		uint32_t input_cv[8];
+		BYTE block[BLOCK_LEN];
+		BYTE block_len;
+		uint64_t counter;
+		BYTE flags;
+
+		void chaining_value(BYTE out[OUT_LEN]) const
+		{
+			uint32_t cv[8];
+			memcpy(cv, input_cv, sizeof(cv));
+			compress_in_place(cv, block, block_len, counter, flags);
+			store_cv(out, cv);
+		}
+
+		void root_bytes(BYTE out[OUT_LEN]) const
+		{
+			uint32_t cv[8];
+			memcpy(cv, input_cv, sizeof(cv));
+			compress_in_place(cv, block, block_len, 0, flags | ROOT);
+			store_cv(out, cv);
+		}
+	};
+
+	uint32_t _key[8];
+	chunk_state _chunk;
+	BYTE _cv_stack_len;
+	BYTE _cv_stack[(MAX_DEPTH + 1) * OUT_LEN];
+	work_pool* _pool;
+
+private:
+	static const uint32_t* iv()
+	{
+		static const uint32_t IV[8] = {
+			0x6A09E667U, 0xBB67AE85U, 0x3C6EF372U, 0xA54FF53AU,
+			0x510E527FU, 0x9B05688CU, 0x1F83D9ABU, 0x5BE0CD19U };
+		return IV;
+	}
+
+	static const BYTE(*schedule())[16]
+	{
+		static const BYTE MSG_SCHEDULE[7][16] = {
+			{ 0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15 },
+			{ 2, 6, 3, 10, 7, 0, 4, 13, 1, 11, 12, 5, 9, 14, 15, 8 },
+			{ 3, 4, 10, 12, 13, 2, 7, 14, 6, 5, 9, 0, 11, 15, 8, 1 },
+			{ 10, 7, 12, 9, 14, 3, 13, 15, 4, 0, 11, 2, 5, 8, 1, 6 },
+			{ 12, 13, 9, 11, 15, 10, 14, 8, 7, 2, 5, 3, 0, 1, 6, 4 },
+			{ 9, 14, 11, 5, 8, 12, 15, 1, 13, 3, 0, 10, 2, 6, 4, 7 },
+			{ 11, 15, 5, 0, 1, 9, 8, 6, 14, 10, 2, 12, 3, 4, 7, 13 } };
+		return MSG_SCHEDULE;
+	}
+
+	static void store_cv(BYTE out[OUT_LEN], const uint32_t cv[8])
+	{
+		for (size_t i = 0; i < 8; i++)
+			fasthash::write32(out + 4 * i, cv[i]);
+	}
+
+	static void load_cv(uint32_t cv[8], const BYTE in[OUT_LEN])
+	{
+		for (size_t i = 0; i < 8; i++)
+			cv[i] = fasthash::read32(in + 4 * i);
+	}
+
+	static void g(uint32_t* s, size_t a, size_t b, size_t c, size_t d, uint32_t x, uint32_t y)
+	{
+		s[a] = s[a] + s[b] + x;
+		s[d] = fasthash::rotr32(s[d] ^ s[a], 16);
+		s[c] = s[c] + s[d];
+		s[b] = fasthash::rotr32(s[b] ^ s[c], 12);
+		s[a] = s[a] + s[b] + y;
+		s[d] = fasthash::rotr32(s[d] ^ s[a], 8);
+		s[c] = s[c] + s[d];
+		s[b] = fasthash::rotr32(s[b] ^ s[c], 7);
+	}
+
+	static void compress_in_place(uint32_t cv[8], const BYTE block[BLOCK_LEN], BYTE block_len, uint64_t counter, BYTE flags)
+	{
+		uint32_t m[16];
+		for (size_t i = 0; i < 16; i++)
+			m[i] = fasthash::read32(block + 4 * i);
+
+		const uint32_t* IV = iv();
+		uint32_t s[16] = {
+			cv[0], cv[1], cv[2], cv[3], cv[4], cv[5], cv[6], cv[7],
+			IV[0], IV[1], IV[2], IV[3],
+			(uint32_t)counter, (uint32_t)(counter >> 32), (uint32_t)block_len, (uint32_t)flags };
+
+		for (size_t r = 0; r < 7; r++)
+		{
+			const BYTE* sc = schedule()[r];
+			g(s, 0, 4, 8, 12, m[sc[0]], m[sc[1]]);
+			g(s, 1, 5, 9, 13, m[sc[2]], m[sc[3]]);
+			g(s, 2, 6, 10, 14, m[sc[4]], m[sc[5]]);
+			g(s, 3, 7, 11, 15, m[sc[6]], m[sc[7]]);
+			g(s, 0, 5, 10, 15, m[sc[8]], m[sc[9]]);
+			g(s, 1, 6, 11, 12, m[sc[10]], m[sc[11]]);
+			g(s, 2, 7, 8, 13, m[sc[12]], m[sc[13]]);
+			g(s, 3, 4, 9, 14, m[sc[14]], m[sc[15]]);
+		}
+
+		for (size_t i = 0; i < 8; i++)
+			cv[i] = s[i] ^ s[i + 8];
+	}
+
+	static void hash_one(const BYTE* input, size_t blocks, const uint32_t key[8], uint64_t counter,
+		BYTE flags, BYTE flags_start, BYTE flags_end, BYTE out[OUT_LEN])
+	{
+		uint32_t cv[8];
+		memcpy(cv, key, sizeof(cv));
+		BYTE block_flags = flags | flags_start;
+		while (blocks > 0)
+		{
+			if (blocks == 1)
+				block_flags |= flags_end;
+			compress_in_place(cv, input, BLOCK_LEN, counter, block_flags);
+			input += BLOCK_LEN;
+			blocks--;
+			block_flags = flags;
+		}
+		store_cv(out, cv);
+	}
+
+#ifdef FASTHASH_X86
+	static __m128i rotr16(__m128i x) { return _mm_or_si128(_mm_srli_epi32(x, 16), _mm_slli_epi32(x, 16)); }
+	static __m128i rotr12(__m128i x) { return _mm_or_si128(_mm_srli_epi32(x, 12), _mm_slli_epi32(x, 20)); }
+	static __m128i rotr8(__m128i x) { return _mm_or_si128(_mm_srli_epi32(x, 8), _mm_slli_epi32(x, 24)); }
+	static __m128i rotr7(__m128i x) { return _mm_or_si128(_mm_srli_epi32(x, 7), _mm_slli_epi32(x, 25)); }
+
+	static void g4(__m128i* v, size_t a, size_t b, size_t c, size_t d, __m128i x, __m128i y)
+	{
+		v[a] = _mm_add_epi32(_mm_add_epi32(v[a], v[b]), x);
+		v[d] = rotr16(_mm_xor_si128(v[d], v[a]));
+		v[c] = _mm_add_epi32(v[c], v[d]);
+		v[b] = rotr12(_mm_xor_si128(v[b], v[c]));
+		v[a] = _mm_add_epi32(_mm_add_epi32(v[a], v[b]), y);
+		v[d] = rotr8(_mm_xor_si128(v[d], v[a]));
+		v[c] = _mm_add_epi32(v[c], v[d]);
+		v[b] = rotr7(_mm_xor_si128(v[b], v[c]));
+	}
+
+	static void transpose4(__m128i* v)
+	{
+		__m128i ab_01 = _mm_unpacklo_epi32(v[0], v[1]);
+		__m128i ab_23 = _mm_unpackhi_epi32(v[0], v[1]);
+		__m128i cd_01 = _mm_unpacklo_epi32(v[2], v[3]);
+		__m128i cd_23 = _mm_unpackhi_epi32(v[2], v[3]);
+		v[0] = _mm_unpacklo_epi64(ab_01, cd_01);
+		v[1] = _mm_unpackhi_epi64(ab_01, cd_01);
+		v[2] = _mm_unpacklo_epi64(ab_23, cd_23);
+		v[3] = _mm_unpackhi_epi64(ab_23, cd_23);
+	}
+
+	//one block of 4 inputs, h holds the 4 chaining values in 32-bit lanes
+	static void compress4(__m128i h[8], const __m128i m[16], __m128i counter_lo, __m128i counter_hi,
+		__m128i block_len, __m128i flags)
+	{
+		const uint32_t* IV = iv();
+		__m128i v[16] = {
+			h[0], h[1], h[2], h[3], h[4], h[5], h[6], h[7],
+			_mm_set1_epi32((int)IV[0]), _mm_set1_epi32((int)IV[1]), _mm_set1_epi32((int)IV[2]), _mm_set1_epi32((int)IV[3]),
+			counter_lo, counter_hi, block_len, flags };
+
+		for (size_t r = 0; r < 7; r++)
+		{
+			const BYTE* sc = schedule()[r];
+			g4(v, 0, 4, 8, 12, m[sc[0]], m[sc[1]]);
+			g4(v, 1, 5, 9, 13, m[sc[2]], m[sc[3]]);
+			g4(v, 2, 6, 10, 14, m[sc[4]], m[sc[5]]);
+			g4(v, 3, 7, 11, 15, m[sc[6]], m[sc[7]]);
+			g4(v, 0, 5, 10, 15, m[sc[8]], m[sc[9]]);
+			g4(v, 1, 6, 11, 12, m[sc[10]], m[sc[11]]);
+			g4(v, 2, 7, 8, 13, m[sc[12]], m[sc[13]]);
+			g4(v, 3, 4, 9, 14, m[sc[14]], m[sc[15]]);
+		}
+
+		for (size_t i = 0; i < 8; i++)
+			h[i] = _mm_xor_si128(v[i], v[i + 8]);
+	}
+
+	static void load4(__m128i m[16], const BYTE* const* blocks)
+	{
+		for (size_t q = 0; q < 4; q++)
+		{
+			for (size_t j = 0; j < 4; j++)
+				m[4 * q + j] = _mm_loadu_si128((const __m128i*)(blocks[j] + 16 * q));
+			transpose4(m + 4 * q);
+		}
+	}
+
+	static void store4(BYTE* out, __m128i h[8])
+	{
+		transpose4(h);
+		transpose4(h + 4);
+		for (size_t j = 0; j < 4; j++)
+		{
+			_mm_storeu_si128((__m128i*)(out + j * OUT_LEN), h[j]);
+			_mm_storeu_si128((__m128i*)(out + j * OUT_LEN + 16), h[4 + j]);
+		}
+	}
+
+	//4 inputs of the same length in lockstep, one input per 32-bit lane
+	static void hash4(const BYTE* const* inputs, size_t blocks, const uint32_t key[8], uint64_t counter,
+		bool increment_counter, BYTE flags, BYTE flags_start, BYTE flags_end, BYTE* out)
+	{
+		__m128i h[8];
+		for (size_t i = 0; i < 8; i++)
+			h[i] = _mm_set1_epi32((int)key[i]);
+
+		uint64_t c[4];
+		for (size_t j = 0; j < 4; j++)
+			c[j] = counter + (increment_counter ? j : 0);
+		const __m128i counter_lo = _mm_set_epi32((int)(uint32_t)c[3], (int)(uint32_t)c[2], (int)(uint32_t)c[1], (int)(uint32_t)c[0]);
+		const __m128i counter_hi = _mm_set_epi32((int)(uint32_t)(c[3] >> 32), (int)(uint32_t)(c[2] >> 32),
+			(int)(uint32_t)(c[1] >> 32), (int)(uint32_t)(c[0] >> 32));
+
+		BYTE block_flags = flags | flags_start;
+		for (size_t b = 0; b < blocks; b++)
+		{
+			if (b + 1 == blocks)
+				block_flags |= flags_end;
+
+			const BYTE* block[4];
+			for (size_t j = 0; j < 4; j++)
+				block[j] = inputs[j] + b * BLOCK_LEN;
+			__m128i m[16];
+			load4(m, block);
+			compress4(h, m, counter_lo, counter_hi, _mm_set1_epi32((int)BLOCK_LEN), _mm_set1_epi32((int)block_flags));
+			block_flags = flags;
+		}
+
+		store4(out, h);
+	}
+#endif
+
+	static void hash_many(const BYTE* const* inputs, size_t num_inputs, size_t blocks, const uint32_t key[8],
+		uint64_t counter, bool increment_counter, BYTE flags, BYTE flags_start, BYTE flags_end, BYTE* out)
+	{
+#ifdef FASTHASH_X86
+		while (Simd && num_inputs >= 4)
+		{
+			hash4(inputs, blocks, key, counter, increment_counter, flags, flags_start, flags_end, out);
+			if (increment_counter)
+				counter += 4;
+			inputs += 4;
+			num_inputs -= 4;
+			out += 4 * OUT_LEN;
+		}
+#endif
+		while (num_inputs > 0)
+		{
+			hash_one(inputs[0], blocks, key, counter, flags, flags_start, flags_end, out);
+			if (increment_counter)
+				counter += 1;
+			inputs += 1;
+			num_inputs -= 1;
+			out += OUT_LEN;
+		}
+	}
+
+	static output_t chunk_output(const chunk_state& cs)
+	{
+		output_t o;
+		memcpy(o.input_cv, cs.cv, sizeof(o.input_cv));
+		memcpy(o.block, cs.buf, sizeof(o.block));
+		o.block_len = cs.buf_len;
+		o.counter = cs.chunk_counter;
+		o.flags = cs.flags | cs.start_flag() | CHUNK_END;
+		return o;
+	}
+
+	static output_t parent_output(const BYTE block[BLOCK_LEN], const uint32_t key[8], BYTE flags)
+	{
+		output_t o;
+		memcpy(o.input_cv, key, sizeof(o.input_cv));
+		memcpy(o.block, block, sizeof(o.block));
+		o.block_len = BLOCK_LEN;
+		o.counter = 0;
+		o.flags = flags | PARENT;
+		return o;
+	}
+
+	static size_t round_down_to_power_of_2(uint64_t x)
+	{
+		uint64_t p = 1;
+		x |= 1;
+		while (x >>= 1)
+			p <<= 1;
+		return (size_t)p;
+	}
+
+	//largest power of 2 number of whole chunks that leaves at least 1 byte for the right side
+	static size_t left_len(size_t content_len)
+	{
+		size_t full_chunks = (content_len - 1) / CHUNK_LEN;
+		return round_down_to_power_of_2(full_chunks) * CHUNK_LEN;
+	}
+
+	static size_t compress_chunks_parallel(const BYTE* input, size_t input_len, const uint32_t key[8],
+		uint64_t chunk_counter, BYTE flags, BYTE* out)
+	{
+		const BYTE* chunks_array[SIMD_DEGREE];
+		size_t input_position = 0;
+		size_t chunks_array_len = 0;
+		while (input_len - input_position >= CHUNK_LEN)
+		{
+			chunks_array[chunks_array_len++] = input + input_position;
+			input_position += CHUNK_LEN;
+		}
+
+		hash_many(chunks_array, chunks_array_len, CHUNK_LEN / BLOCK_LEN, key, chunk_counter,
+			true, flags, CHUNK_START, CHUNK_END, out);
+
+		if (input_len > input_position)
+		{
+			chunk_state cs;
+			cs.init(key, flags);
+			cs.chunk_counter = chunk_counter + chunks_array_len;
+			cs.update(input + input_position, input_len - input_position);
+			chunk_output(cs).chaining_value(out + chunks_array_len * OUT_LEN);
+			return chunks_array_len + 1;
+		}
+		return chunks_array_len;
+	}
+
+	static size_t compress_parents_parallel(const BYTE* child_cvs, size_t num_cvs, const uint32_t key[8],
+		BYTE flags, BYTE* out)
+	{
+		const BYTE* parents_array[SIMD_DEGREE];
+		size_t parents_len = 0;
+		while (num_cvs - 2 * parents_len >= 2)
+		{
+			parents_array[parents_len] = child_cvs + 2 * parents_len * OUT_LEN;
+			parents_len++;
+		}
+
+		hash_many(parents_array, parents_len, 1, key, 0, false, flags | PARENT, 0, 0, out);
+
+		if (num_cvs > 2 * parents_len)
+		{
+			memcpy(out + parents_len * OUT_LEN, child_cvs + 2 * parents_len * OUT_LEN, OUT_LEN);
+			return parents_len + 1;
+		}
+		return parents_len;
+	}
+
+	//returns the number of chaining values written to out, at most SIMD_DEGREE
+	static size_t compress_subtree_wide(const BYTE* input, size_t input_len, const uint32_t key[8],
+		uint64_t chunk_counter, BYTE flags, BYTE* out)
+	{
+		if (input_len <= SIMD_DEGREE * CHUNK_LEN)
+			return compress_chunks_parallel(input, input_len, key, chunk_counter, flags, out);
+
+		size_t left_input_len = left_len(input_len);
+		size_t right_input_len = input_len - left_input_len;
+		uint64_t right_chunk_counter = chunk_counter + (uint64_t)(left_input_len / CHUNK_LEN);
+
+		BYTE cv_array[2 * SIMD_DEGREE * OUT_LEN];
+		size_t left_n = compress_subtree_wide(input, left_input_len, key, chunk_counter, flags, cv_array);
+		size_t right_n = compress_subtree_wide(input + left_input_len, right_input_len, key,
+			right_chunk_counter, flags, cv_array + SIMD_DEGREE * OUT_LEN);
+
+		if (left_n == 1)
+		{
+			memcpy(out, cv_array, 2 * OUT_LEN);
+			return 2;
+		}
+
+		//the left side always fills its SIMD_DEGREE slots here
+		return compress_parents_parallel(cv_array, left_n + right_n, key, flags, out);
+	}
+
+	static void compress_subtree_to_parent_node(const BYTE* input, size_t input_len, const uint32_t key[8],
+		uint64_t chunk_counter, BYTE flags, BYTE out[2 * OUT_LEN])
+	{
+		BYTE cv_array[SIMD_DEGREE * OUT_LEN];
+		size_t num_cvs = compress_subtree_wide(input, input_len, key, chunk_counter, flags, cv_array);
+		while (num_cvs > 2)
+		{
+			BYTE out_array[SIMD_DEGREE * OUT_LEN];
+			num_cvs = compress_parents_parallel(cv_array, num_cvs, key, flags, out_array);
+			memcpy(cv_array, out_array, num_cvs * OUT_LEN);
+		}
+		memcpy(out, cv_array, 2 * OUT_LEN);
+	}
+
+	//chaining value of a complete subtree of a power of 2 number of chunks
+	static void subtree_cv(const BYTE* input, size_t input_len, const uint32_t key[8],
+		uint64_t chunk_counter, BYTE flags, BYTE out[OUT_LEN])
+	{
+		if (input_len <= CHUNK_LEN)
+		{
+			chunk_state cs;
+			cs.init(key, flags);
+			cs.chunk_counter = chunk_counter;
+			cs.update(input, input_len);
+			chunk_output(cs).chaining_value(out);
+			return;
+		}
+		BYTE pair[2 * OUT_LEN];
+		compress_subtree_to_parent_node(input, input_len, key, chunk_counter, flags, pair);
+		parent_output(pair, key, flags).chaining_value(out);
+	}
+
+	struct SUBTREE_PART_T
+	{
+		const BYTE* input;
+		size_t part_len;
+		const uint32_t* key;
+		uint64_t chunk_counter;
+		BYTE flags;
+		BYTE* cvs;
+
+		void operator()(size_t i)
+		{
+			subtree_cv(input + i * part_len, part_len, key,
+				chunk_counter + (uint64_t)(i * part_len / CHUNK_LEN), flags, cvs + i * OUT_LEN);
+		}
+	};
+
+	//same result as compress_subtree_to_parent_node(), the subtree is split into equal
+	//power of 2 parts hashed on the work pool and merged level by level afterwards.
+	void compress_subtree_threaded(const BYTE* input, size_t input_len, uint64_t chunk_counter, BYTE out[2 * OUT_LEN])
+	{
+		size_t parts = 1;
+		while (parts * 2 <= _pool->size() && parts * 2 <= PARALLEL_PARTS_MAX
+			&& input_len / (parts * 2) >= PARALLEL_PART_MIN)
+			parts *= 2;
+
+		if (parts < 2)
+		{
+			compress_subtree_to_parent_node(input, input_len, _key, chunk_counter, _chunk.flags, out);
+			return;
+		}
+
+		BYTE cvs[PARALLEL_PARTS_MAX * OUT_LEN];
+		SUBTREE_PART_T part = { input, input_len / parts, _key, chunk_counter, _chunk.flags, cvs };
+		_pool->run(parts, part);
+
+		while (parts > 2)
+		{
+			for (size_t i = 0; i < parts / 2; i++)
+				parent_output(cvs + 2 * i * OUT_LEN, _key, _chunk.flags).chaining_value(cvs + i * OUT_LEN);
+			parts /= 2;
+		}
+		memcpy(out, cvs, 2 * OUT_LEN);
+	}
+
+	static unsigned int popcount(uint64_t x)
+	{
+		unsigned int n = 0;
+		for (; x != 0; x &= x - 1)
+			n++;
+		return n;
+	}
+
+	//the last chaining value on the stack may turn out to be the root, so merging is lazy
+	void merge_cv_stack(uint64_t total_len)
+	{
+		size_t post_merge_stack_len = (size_t)popcount(total_len);
+		while (_cv_stack_len > post_merge_stack_len)
+		{
+			BYTE* parent_node = _cv_stack + (_cv_stack_len - 2) * OUT_LEN;
+			parent_output(parent_node, _key, _chunk.flags).chaining_value(parent_node);
+			_cv_stack_len--;
+		}
+	}
+
+	void push_cv(const BYTE new_cv[OUT_LEN], uint64_t chunk_counter)
+	{
+		merge_cv_stack(chunk_counter);
+		memcpy(_cv_stack + _cv_stack_len * OUT_LEN, new_cv, OUT_LEN);
+		_cv_stack_len++;
+	}
+
+public:
+	//blocks of a whole message hashed in one SIMD lane by hash4_messages(), 0: longer than a chunk
+	static size_t message_blocks(size_t len)
+	{
+		if (len > CHUNK_LEN)
+			return 0;
+		return len == 0 ? 1 : (len + BLOCK_LEN - 1) / BLOCK_LEN;
+	}
+
+#ifdef FASTHASH_X86
+	//4 whole messages of the same message_blocks() in lockstep (--per-line). A message that fits
+	//one chunk is its own root, so each lane only differs in the length of its last block.
+	static void hash4_messages(const BYTE* const* messages, const size_t* lens, BYTE* out)
+	{
+		const size_t blocks = message_blocks(lens[0]);
+		BYTE last[4][BLOCK_LEN];
+		int last_len[4];
+		for (size_t j = 0; j < 4; j++)
+		{
+			last_len[j] = (int)(lens[j] - (blocks - 1) * BLOCK_LEN);
+			memset(last[j], 0, BLOCK_LEN);
+			memcpy(last[j], messages[j] + (blocks - 1) * BLOCK_LEN, last_len[j]);
+		}
+
+		__m128i h[8];
+		for (size_t i = 0; i < 8; i++)
+			h[i] = _mm_set1_epi32((int)iv()[i]);
+		const __m128i zero = _mm_setzero_si128();
+
+		BYTE block_flags = CHUNK_START;
+		for (size_t b = 0; b < blocks; b++)
+		{
+			const BYTE* block[4];
+			__m128i block_len = _mm_set1_epi32((int)BLOCK_LEN);
+			if (b + 1 == blocks)
+			{
+				block_flags |= CHUNK_END | ROOT;
+				for (size_t j = 0; j < 4; j++)
+					block[j] = last[j];
+				block_len = _mm_set_epi32(last_len[3], last_len[2], last_len[1], last_len[0]);
+			}
+			else
+			{
+				for (size_t j = 0; j < 4; j++)
+					block[j] = messages[j] + b * BLOCK_LEN;
+			}
+			__m128i m[16];
+			load4(m, block);
+			compress4(h, m, zero, zero, block_len, _mm_set1_epi32((int)block_flags));
+			block_flags = 0;
+		}
+
+		store4(out, h);
+	}
+#endif
+
+	blake3_engine(work_pool* pool = NULL) : _cv_stack_len(0), _pool(pool)
+	{
+		memcpy(_key, iv(), sizeof(_key));
+		_chunk.init(_key, 0);
+	}
+
+	void update(const BYTE* input, size_t input_len)
+	{
+		if (_chunk.len() > 0)
+		{
+			size_t take = CHUNK_LEN - _chunk.len();
+			if (take > input_len)
+				take = input_len;
+			_chunk.update(input, take);
+			input += take;
+			input_len -= take;
+			if (input_len == 0)
+				return;
+
+			BYTE chunk_cv[OUT_LEN];
+			chunk_output(_chunk).chaining_value(chunk_cv);
+			push_cv(chunk_cv, _chunk.chunk_counter);
+			uint64_t next_counter = _chunk.chunk_counter + 1;
+			_chunk.init(_key, _chunk.flags);
+			_chunk.chunk_counter = next_counter;
+		}
+
+		while (input_len > CHUNK_LEN)
+		{
+			size_t subtree_len = round_down_to_power_of_2(input_len);
+			uint64_t count_so_far = _chunk.chunk_counter * CHUNK_LEN;
+			while ((((uint64_t)(subtree_len - 1)) & count_so_far) != 0)
+				subtree_len /= 2;
+			uint64_t subtree_chunks = subtree_len / CHUNK_LEN;
+
+			if (subtree_len <= CHUNK_LEN)
+			{
+				chunk_state cs;
+				cs.init(_key, _chunk.flags);
+				cs.chunk_counter = _chunk.chunk_counter;
+				cs.update(input, subtree_len);
+				BYTE cv[OUT_LEN];
+				chunk_output(cs).chaining_value(cv);
+				push_cv(cv, cs.chunk_counter);
+			}
+			else
+			{
+				BYTE cv_pair[2 * OUT_LEN];
+				if (_pool != NULL && subtree_len >= 2 * PARALLEL_PART_MIN)
+					compress_subtree_threaded(input, subtree_len, _chunk.chunk_counter, cv_pair);
+				else
+					compress_subtree_to_parent_node(input, subtree_len, _key, _chunk.chunk_counter, _chunk.flags, cv_pair);
+				push_cv(cv_pair, _chunk.chunk_counter);
+				push_cv(cv_pair + OUT_LEN, _chunk.chunk_counter + subtree_chunks / 2);
+			}
+			_chunk.chunk_counter += subtree_chunks;
+			input += subtree_len;
+			input_len -= subtree_len;
+		}
+
+		if (input_len > 0)
+		{
+			_chunk.update(input, input_len);
+			merge_cv_stack(_chunk.chunk_counter);
+		}
+	}
+
+	DWORD finish(BYTE* digest)
+	{
+		if (_cv_stack_len == 0)
+		{
+			chunk_output(_chunk).root_bytes(digest);
+			return OUT_LEN;
+		}
+
+		output_t output;
+		size_t cvs_remaining;
+		if (_chunk.len() > 0)
+		{
+			cvs_remaining = _cv_stack_len;
+			output = chunk_output(_chunk);
+		}
+		else
+		{
+			//there are always at least 2 CVs on the stack in this case
+			cvs_remaining = _cv_stack_len - 2;
+			output = parent_output(_cv_stack + cvs_remaining * OUT_LEN, _key, _chunk.flags);
+		}
+		while (cvs_remaining > 0)
+		{
+			cvs_remaining--;
+			BYTE parent_block[BLOCK_LEN];
+			memcpy(parent_block, _cv_stack + cvs_remaining * OUT_LEN, OUT_LEN);
+			output.chaining_value(parent_block + OUT_LEN);
+			output = parent_output(parent_block, _key, _chunk.flags);
+		}
+		output.root_bytes(digest);
+		return OUT_LEN;
+	}
+};
+
+typedef blake3_engine<true> blake3_hasher;
+typedef blake3_engine<false> blake3_scalar;
+
+#ifdef FASTHASH_X86
+//MD5 (RFC 1321) of 4 messages in lockstep, one message per 32-bit lane. Only used for many
+//short messages (--per-line), a single stream is left to CryptoAPI.
+class md5_x4
+{
+private:
+	enum : size_t { BLOCK_LEN = 64 };
+
+	static __m128i rotl(__m128i x, int n)
+	{
+		return _mm_or_si128(_mm_sll_epi32(x, _mm_cvtsi32_si128(n)), _mm_srl_epi32(x, _mm_cvtsi32_si128(32 - n)));
+	}
+
+	static void transpose4(__m128i* v)
+	{
+		__m128i ab_01 = _mm_unpacklo_epi32(v[0], v[1]);
+		__m128i ab_23 = _mm_unpackhi_epi32(v[0], v[1]);
+		__m128i cd_01 = _mm_unpacklo_epi32(v[2], v[3]);
+		__m128i cd_23 = _mm_unpackhi_epi32(v[2], v[3]);
+		v[0] = _mm_unpacklo_epi64(ab_01, cd_01);
+		v[1] = _mm_unpackhi_epi64(ab_01, cd_01);
+		v[2] = _mm_unpacklo_epi64(ab_23, cd_23);
+		v[3] = _mm_unpackhi_epi64(ab_23, cd_23);
+	}
+
+	static void compress4(__m128i state[4], const BYTE* const* blocks)
+	{
+		static const uint32_t K[64] = {
+			0xd76aa478, 0xe8c7b756, 0x242070db, 0xc1bdceee, 0xf57c0faf, 0x4787c62a, 0xa8304613, 0xfd469501,
+			0x698098d8, 0x8b44f7af, 0xffff5bb1, 0x895cd7be, 0x6b901122, 0xfd987193, 0xa679438e, 0x49b40821,
+			0xf61e2562, 0xc040b340, 0x265e5a51, 0xe9b6c7aa, 0xd62f105d, 0x02441453, 0xd8a1e681, 0xe7d3fbc8,
+			0x21e1cde6, 0xc33707d6, 0xf4d50d87, 0x455a14ed, 0xa9e3e905, 0xfcefa3f8, 0x676f02d9, 0x8d2a4c8a,
+			0xfffa3942, 0x8771f681, 0x6d9d6122, 0xfde5380c, 0xa4beea44, 0x4bdecfa9, 0xf6bb4b60, 0xbebfbc70,
+			0x289b7ec6, 0xeaa127fa, 0xd4ef3085, 0x04881d05, 0xd9d4d039, 0xe6db99e5, 0x1fa27cf8, 0xc4ac5665,
+			0xf4292244, 0x432aff97, 0xab9423a7, 0xfc93a039, 0x655b59c3, 0x8f0ccc92, 0xffeff47d, 0x85845dd1,
+			0x6fa87e4f, 0xfe2ce6e0, 0xa3014314, 0x4e0811a1, 0xf7537e82, 0xbd3af235, 0x2ad7d2bb, 0xeb86d391 };
+		static const int S[4][4] = { { 7, 12, 17, 22 }, { 5, 9, 14, 20 }, { 4, 11, 16, 23 }, { 6, 10, 15, 21 } };
+
+		__m128i m[16];
+		for (size_t q = 0; q < 4; q++)
+		{
+			for (size_t j = 0; j < 4; j++)
+				m[4 * q + j] = _mm_loadu_si128((const __m128i*)(blocks[j] + 16 * q));
+			transpose4(m + 4 * q);
+		}
+
+		const __m128i ones = _mm_set1_epi32(-1);
+		__m128i a = state[0], b = state[1], c = state[2], d = state[3];
+		for (size_t i = 0; i < 64; i++)
+		{
+			__m128i f;
+			size_t g;
+			switch (i / 16)
+			{
+			case 0:
+				f = _mm_or_si128(_mm_and_si128(b, c), _mm_andnot_si128(b, d));
+				g = i;
+				break;
+			case 1:
+				f = _mm_or_si128(_mm_and_si128(d, b), _mm_andnot_si128(d, c));
+				g = (5 * i + 1) & 15;
+				break;
+			case 2:
+				f = _mm_xor_si128(_mm_xor_si128(b, c), d);
+				g = (3 * i + 5) & 15;
+				break;
+			default:
+				f = _mm_xor_si128(c, _mm_or_si128(b, _mm_xor_si128(d, ones)));
+				g = (7 * i) & 15;
+				break;
+			}
+			f = _mm_add_epi32(_mm_add_epi32(f, a), _mm_add_epi32(_mm_set1_epi32((int)K[i]), m[g]));
+			a = d;
+			d = c;
+			c = b;
+			b = _mm_add_epi32(b, rotl(f, S[i / 16][i % 4]));
+		}
+		state[0] = _mm_add_epi32(state[0], a);
+		state[1] = _mm_add_epi32(state[1], b);
+		state[2] = _mm_add_epi32(state[2], c);
+		state[3] = _mm_add_epi32(state[3], d);
+	}
+
+public:
+	enum : size_t { DIGEST_LEN = 16 };
+
+	//padded blocks of a message
+	static size_t blocks(size_t len)
+	{
+		return (len + 8) / BLOCK_LEN + 1;
+	}
+
+	//4 messages of the same blocks(), 4 digests to out
+	static void hash4(const BYTE* const* messages, const size_t* lens, BYTE* out)
+	{
+		const size_t count = blocks(lens[0]);
+
+		//the padding goes into a copy of the last one or two blocks of each message
+		BYTE tail[4][2 * BLOCK_LEN];
+		size_t tail_first[4];
+		for (size_t j = 0; j < 4; j++)
+		{
+			tail_first[j] = lens[j] / BLOCK_LEN;
+			size_t tail_len = lens[j] % BLOCK_LEN;
+			memset(tail[j], 0, sizeof(tail[j]));
+			memcpy(tail[j], messages[j] + tail_first[j] * BLOCK_LEN, tail_len);
+			tail[j][tail_len] = 0x80;
+			uint64_t bits = (uint64_t)lens[j] * 8;
+			BYTE* length = tail[j] + (count - tail_first[j]) * BLOCK_LEN - 8;
+			for (size_t k = 0; k < 8; k++)
+				length[k] = (BYTE)(bits >> (8 * k));
+		}
+
+		__m128i state[4] = {
+			_mm_set1_epi32(0x67452301), _mm_set1_epi32((int)0xefcdab89),
+			_mm_set1_epi32((int)0x98badcfe), _mm_set1_epi32(0x10325476) };
+		for (size_t b = 0; b < count; b++)
+		{
+			const BYTE* block[4];
+			for (size_t j = 0; j < 4; j++)
+				block[j] = b < tail_first[j] ? messages[j] + b * BLOCK_LEN : tail[j] + (b - tail_first[j]) * BLOCK_LEN;
+			compress4(state, block);
+		}
+
+		transpose4(state);
+		for (size_t j = 0; j < 4; j++)
+			_mm_storeu_si128((__m128i*)(out + j * DIGEST_LEN), state[j]);
+	}
+
+	static void hash1(const BYTE* message, size_t len, BYTE* out)
+	{
+		const BYTE* messages[4] = { message, message, message, message };
+		const size_t lens[4] = { len, len, len, len };
+		BYTE digests[4 * DIGEST_LEN];
+		hash4(messages, lens, digests);
+		memcpy(out, digests, DIGEST_LEN);
+	}
+};
+
+//BLAKE3 of 4 messages in lockstep, messages longer than a chunk are hashed one at a time
+class blake3_x4
+{
+public:
+	enum : size_t { DIGEST_LEN = 32 };
+
+	static size_t blocks(size_t len)
+	{
+		return blake3_hasher::message_blocks(len);
+	}
+
+	static void hash4(const BYTE* const* messages, const size_t* lens, BYTE* out)
+	{
+		blake3_hasher::hash4_messages(messages, lens, out);
+	}
+
+	static void hash1(const BYTE* message, size_t len, BYTE* out)
+	{
+		blake3_hasher hasher;
+		hasher.update(message, len);
+		hasher.finish(out);
+	}
+};
+
+//Digests of count messages with a 4-lane kernel (md5_x4, blake3_x4): messages are grouped by
+//their number of blocks so the lanes of a group finish together. A message the kernel has no
+//lane for (blocks() == 0) is hashed alone, a group left with less than 4 messages repeats its
+//last one in the free lanes. Digest i goes to out + i * out_stride.
+template<class KernelT>
+void hash_records(const BYTE* const* messages, const size_t* lens, size_t count, BYTE* out, size_t out_stride)
+{
+	struct group_t
+	{
+		size_t n;
+		size_t index[4];
+	};
+
+	struct flush_t
+	{
+		const BYTE* const* messages;
+		const size_t* lens;
+		BYTE* out;
+		size_t out_stride;
+
+		void operator()(group_t& group) const
+		{
+			const BYTE* lane_messages[4];
+			size_t lane_lens[4];
+			for (size_t j = 0; j < 4; j++)
+			{
+				size_t i = group.index[j < group.n ? j : group.n - 1];
+				lane_messages[j] = messages[i];
+				lane_lens[j] = lens[i];
+			}
+			BYTE digests[4 * KernelT::DIGEST_LEN];
+			KernelT::hash4(lane_messages, lane_lens, digests);
+			for (size_t j = 0; j < group.n; j++)
+				memcpy(out + group.index[j] * out_stride, digests + j * KernelT::DIGEST_LEN, KernelT::DIGEST_LEN);
+			group.n = 0;
+		}
+	} flush = { messages, lens, out, out_stride };
+
+	std::map<size_t, group_t> groups;
+	for (size_t i = 0; i < count; i++)
+	{
+		size_t blocks = KernelT::blocks(lens[i]);
+		if (blocks == 0)
+		{
+			KernelT::hash1(messages[i], lens[i], out + i * out_stride);
+			continue;
+		}
+
+		group_t& group = groups[blocks];
+		group.index[group.n++] = i;
+		if (group.n == 4)
+			flush(group);
+	}
+	for (typename std::map<size_t, group_t>::iterator it = groups.begin(); it != groups.end(); ++it)
+	{
+		if (it->second.n > 0)
+			flush(it->second);
+	}
+}
+#endif
+
+//Offsets (plus base) of every delimiter byte in data, 16 bytes at a time with SSE2.
+inline void find_delimiters(const BYTE* data, size_t len, BYTE delimiter, size_t base, std::vector<size_t>& offsets)
+{
+	size_t i = 0;
+#ifdef FASTHASH_X86
+	const __m128i d = _mm_set1_epi8((char)delimiter);
+	for (; i + 16 <= len; i += 16)
+	{
+		unsigned int mask = (unsigned int)_mm_movemask_epi8(_mm_cmpeq_epi8(_mm_loadu_si128((const __m128i*)(data + i)), d));
+		while (mask != 0)
+		{
+#ifdef _MSC_VER
+			unsigned long bit;
+			_BitScanForward(&bit, mask);
+#else
+			unsigned int bit = (unsigned int)__builtin_ctz(mask);
+#endif
+			offsets.push_back(base + i + bit);
+			mask &= mask - 1;
+		}
+	}
+#endif
+	for (; i < len; i++)
+	{
+		if (data[i] == delimiter)
+			offsets.push_back(base + i);
+	}
+}
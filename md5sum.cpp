@@ -5,6 +5,9 @@
  sha256sum - Print or check SHA256 checksums.
  sha384sum - Print or check SHA384 checksums.
  sha512sum - Print or check SHA512 checksums.
+ xxh3sum   - Print or check XXH3-128 checksums (not cryptographic).
+ crc32csum - Print or check CRC32C checksums (not cryptographic).
+ b3sum     - Print or check BLAKE3 checksums.
 
  Written in C++ for Windows platform. All above tools share the same source
  code and only compile once and modify the .exe files' name to md5sum.exe,
@@ -34,16 +37,37 @@
 #pragma once
 
 #include <stdio.h>
+#include <io.h>
+#include <fcntl.h>
+#include <map>
+#include <set>
+#include <deque>
 #include <tchar.h>
 #include <windows.h>
+#include <winioctl.h>
 #include <wincrypt.h>
+#include <bcrypt.h>
 #include "tstring.h"
 #include "opt.h"
+#include "workpool.h"
+#include "fasthash.h"
+#include "refhash.h"
+#ifdef USE_OPENSSL
+#include <openssl/evp.h>
+#endif
 
 msg_handler helpmsgs;
 msg_handler outs;
 msg_handler errs(stderr);
 
+work_pool g_pool; //shared by the hash engines that can use more than one thread
+buffer_pool g_buffers; //read buffers of the workers, within --max-memory
+rate_limiter g_bandwidth; //--bwlimit, shared by the readers of the files digested
+volatile LONG g_cancel = 0; //set by --fail-fast at the first failure, polled by the read loops
+FILE* g_tee = NULL; //--tee: standard input is copied here while it is digested
+FILE* g_escalate = NULL; //--escalate: the full checksum lines of the files that changed
+std::set<str> g_copy_destinations; //--copy-to: destinations taken in this run, lower case
+
 void USAGE(const TCHAR* fmt, ...)
 {
 	va_list ap;
@@ -63,9 +87,25 @@ enum AlgHash : ALG_ID
 	SHA384 = CALG_SHA_384,
 	SHA512 = CALG_SHA_512,
 
+	//built-in engines (fasthash.h), not provided by CryptoAPI
+	XXH3_128 = 0x00010001,
+	CRC32C = 0x00010002,
+	BLAKE3 = 0x00010003,
+
 	UNKNOWN_ALG
 };
+
+//--provider: what computes the digests, see hash_provider
+enum HashProvider
+{
+	NATIVE_PROVIDER, //CryptoAPI for MD5 and the SHA digests, the SIMD engines of fasthash.h
+	CNG_PROVIDER,
+	OPENSSL_PROVIDER, //only when built with USE_OPENSSL
+	REFERENCE_PROVIDER, //the portable scalar engines of refhash.h and fasthash.h
+	PROVIDER_COUNT
+};
 void Usage(int status);
+void ExitCommandLine(int status);
 struct global_options_struct
 {
 private:
@@ -80,6 +120,50 @@ public:
 	bool _status_only;
 	bool _ignore_missing;
 	bool _strict;
+	bool _find_duplicates;
+	bool _diff;
+	bool _fail_fast;
+	bool _physical_order;
+	DWORD _device_jobs; //concurrent reads per volume, 0: chosen per volume
+	bool _tee;
+	str _tee_file; //empty: standard output
+	str _sum_file; //empty: standard output, or standard error with --tee
+	str _copy_to; //target directory
+	bool _verify_copy;
+	bool _daemon;
+	bool _connect;
+	str _pipe_name; //--daemon and --connect, empty: the default name
+	str _watch_dir; //--watch, empty: not watching
+	bool _index;
+	bool _convert;
+	strs _only; //--only paths
+	str _only_from; //file of --only paths
+	bool _tar;
+	str _tar_file; //archive checked against the checksum file, empty: standard input
+	bool _chunks;
+	ULONGLONG _chunk_size; //--chunks when printing, 0 when checking
+	bool _no_numa;
+	DWORD _numa_node; //--numa-node, ~0: every node
+	ULONGLONG _max_memory; //--max-memory, 0: the default
+	bool _large_pages;
+	str _files_from; //list of the FILEs, "-": standard input
+	bool _files_from_null; //the paths of the list end with NUL instead of a newline
+	bool _per_line;
+	DWORD _shard_index; //--shard I, from 1
+	DWORD _shard_count; //--shard N, 0: not sharded
+	bool _merge_results;
+	bool _auto_tune;
+	ULONGLONG _read_size; //--read-size, 0: the default
+	ULONGLONG _bwlimit; //bytes per second, 0: unlimited
+	bool _idle;
+	str _journal; //--journal, empty: no journal
+	bool _resume;
+	DWORD _quick_samples; //--quick, 0: the files are digested whole
+	str _escalate_file; //--escalate, empty: not escalating
+	HashProvider _provider;
+	bool _benchmark;
+	bool _bench_providers;
+	str _local_option; //the first option given that a --daemon does not serve, empty: none
 	str _delim; //zero? delimiter
 	AlgHash _digest_alg;
 	str _program_name;
@@ -87,7 +171,15 @@ public:
 	str _digest_alg_name;
 	global_options_struct() : _binary(true), _do_check(false), _warn(false),
 		_bsd_tag(false), _quiet(false), _status_only(false),
-		_ignore_missing(false), _strict(false), _delim(_T("\n")),
+		_ignore_missing(false), _strict(false), _find_duplicates(false),
+		_diff(false), _fail_fast(false), _physical_order(false),
+		_device_jobs(0), _tee(false), _verify_copy(false), _daemon(false), _connect(false),
+		_index(false), _convert(false), _tar(false), _chunks(false), _chunk_size(0),
+		_no_numa(false), _numa_node(~0UL), _max_memory(0), _large_pages(false),
+		_files_from_null(false), _per_line(false), _shard_index(0), _shard_count(0), _merge_results(false),
+		_auto_tune(false), _read_size(0), _bwlimit(0), _idle(false), _resume(false), _quick_samples(0),
+		_provider(NATIVE_PROVIDER), _benchmark(false), _bench_providers(false),
+		_delim(_T("\n")),
 		binary_flag(0), _digest_alg(MD5), _program_name(_T("md5sum")),
 		_alg_lecture_ref(_T("RFC 1321")), _digest_alg_name(_T("MD5")) {}
 
@@ -146,6 +238,24 @@ public:
 			_digest_alg_name = _T("SHA512");
 			_alg_lecture_ref = _T("FIPS-180-2");
 		}
+		else if (_program_name == _T("xxh3sum") || _program_name == _T("xxh128sum"))
+		{
+			_digest_alg = XXH3_128;
+			_digest_alg_name = _T("XXH128");
+			_alg_lecture_ref = _T("the xxHash specification (XXH3, 128 bits)");
+		}
+		else if (_program_name == _T("crc32csum"))
+		{
+			_digest_alg = CRC32C;
+			_digest_alg_name = _T("CRC32C");
+			_alg_lecture_ref = _T("RFC 3720");
+		}
+		else if (_program_name == _T("b3sum") || _program_name == _T("blake3sum"))
+		{
+			_digest_alg = BLAKE3;
+			_digest_alg_name = _T("BLAKE3");
+			_alg_lecture_ref = _T("the BLAKE3 specification");
+		}
 		else
 		{
 			_digest_alg = MD5;
@@ -188,40 +298,325 @@ public:
 			Usage(EXIT_FAILURE);
 		}
 
-		if (_ignore_missing && !_do_check)
+		if (_ignore_missing && !_do_check && !_merge_results)
 		{
 			errs() << _T("the --ignore-missing option is meaningful only when verifying checksums");
 			errs.print();
 			Usage(EXIT_FAILURE);
 		}
 
-		if (_status_only && !_do_check)
+		if (_status_only && !_do_check && !_diff && !_merge_results)
 		{
 			errs() << _T("the --status option is meaningful only when verifying checksums");
 			errs.print();
 			Usage(EXIT_FAILURE);
 		}
 
-		if (_warn && !_do_check)
+		if (_warn && !_do_check && !_diff)
 		{
 			errs() << _T("the --warn option is meaningful only when verifying checksums");
 			errs.print();
 			Usage(EXIT_FAILURE);
 		}
 
-		if (_quiet && !_do_check)
+		if (_quiet && !_do_check && !_merge_results)
 		{
 			errs() << _T("the --quiet option is meaningful only when verifying checksums");
 			errs.print();
 			Usage(EXIT_FAILURE);
 		}
 
-		if (_strict & !_do_check)
+		if (_strict && !_do_check && !_diff && !_convert && !_merge_results)
 		{
 			errs() << _T("the --strict option is meaningful only when verifying checksums");
 			errs.print();
 			Usage(EXIT_FAILURE);
 		}
+
+		if (_physical_order && (_find_duplicates || _diff))
+		{
+			errs() << _T("the --physical-order option cannot be combined with --find-duplicates or --diff");
+			errs.print();
+			Usage(EXIT_FAILURE);
+		}
+
+		if ((_auto_tune || _read_size != 0) && (_find_duplicates || _diff || _per_line || _merge_results))
+		{
+			errs() << _T("the --auto-tune and --read-size options cannot be combined with --find-duplicates, --diff, --per-line or --merge-results");
+			errs.print();
+			Usage(EXIT_FAILURE);
+		}
+
+		if (_auto_tune && _bwlimit != 0)
+		{
+			errs() << _T("the --auto-tune option measures the full speed, it cannot be combined with --bwlimit");
+			errs.print();
+			Usage(EXIT_FAILURE);
+		}
+
+		if (_quick_samples != 0 && (_find_duplicates || _diff || _convert || _tee || !_watch_dir.empty()
+			|| !_copy_to.empty() || _index || _tar || _chunks || _per_line || _merge_results || !_binary))
+		{
+			errs() << _T("the --quick option cannot be combined with --find-duplicates, --diff, --convert, --tee, --watch, --copy-to, --index, --tar, --chunks, --per-line, --merge-results or --text");
+			errs.print();
+			Usage(EXIT_FAILURE);
+		}
+
+		if (_benchmark && (_do_check || _find_duplicates || _diff || _convert || _tee || !_watch_dir.empty()
+			|| !_copy_to.empty() || _index || _tar || _chunks || _per_line || _merge_results || !_files_from.empty()
+			|| _quick_samples != 0 || _shard_count != 0 || _auto_tune || !_binary))
+		{
+			errs() << _T("the --benchmark option can only be combined with --read-size, --bwlimit, --idle and the NUMA and memory options");
+			errs.print();
+			Usage(EXIT_FAILURE);
+		}
+
+		if (_bench_providers && (_do_check || _find_duplicates || _diff || _convert || _tee || !_watch_dir.empty()
+			|| !_copy_to.empty() || _index || _tar || _chunks || _per_line || _merge_results || !_files_from.empty()
+			|| _quick_samples != 0 || _shard_count != 0 || _auto_tune || _benchmark || _read_size != 0 || _bwlimit != 0
+			|| !_binary))
+		{
+			errs() << _T("the --bench-providers option hashes in memory, it can only be combined with --sum-file, --idle and the NUMA options");
+			errs.print();
+			Usage(EXIT_FAILURE);
+		}
+
+		if (!_escalate_file.empty() && (_quick_samples == 0 || !_do_check || _fail_fast))
+		{
+			errs() << _T("the --escalate option is meaningful only when verifying --quick checksums, and not with --fail-fast");
+			errs.print();
+			Usage(EXIT_FAILURE);
+		}
+
+		if (!_journal.empty() && (!_do_check || _tar))
+		{
+			errs() << _T("the --journal option is meaningful only when verifying checksums, and not with --tar");
+			errs.print();
+			Usage(EXIT_FAILURE);
+		}
+
+		if (_resume && _journal.empty())
+		{
+			errs() << _T("the --resume option needs the --journal of the check to resume");
+			errs.print();
+			Usage(EXIT_FAILURE);
+		}
+
+		if (_device_jobs != 0 && (_find_duplicates || _diff))
+		{
+			errs() << _T("the --device-jobs option cannot be combined with --find-duplicates or --diff");
+			errs.print();
+			Usage(EXIT_FAILURE);
+		}
+
+		if (_tee && (_do_check || _find_duplicates || _diff))
+		{
+			errs() << _T("the --tee option is meaningful only when printing checksums");
+			errs.print();
+			Usage(EXIT_FAILURE);
+		}
+
+		if (_tee && !_binary)
+		{
+			errs() << _T("--tee does not support --text mode");
+			errs.print();
+			Usage(EXIT_FAILURE);
+		}
+
+		if (!_sum_file.empty() && (_do_check || _diff))
+		{
+			errs() << _T("the --sum-file option is meaningful only when printing checksums");
+			errs.print();
+			Usage(EXIT_FAILURE);
+		}
+
+		if (!_copy_to.empty() && (_find_duplicates || _diff || _tee))
+		{
+			errs() << _T("the --copy-to option cannot be combined with --find-duplicates, --diff or --tee");
+			errs.print();
+			Usage(EXIT_FAILURE);
+		}
+
+		if (!_copy_to.empty() && !_binary && !_do_check)
+		{
+			errs() << _T("--copy-to does not support --text mode");
+			errs.print();
+			Usage(EXIT_FAILURE);
+		}
+
+		if (_verify_copy && _copy_to.empty())
+		{
+			errs() << _T("the --verify-copy option is meaningful only with --copy-to");
+			errs.print();
+			Usage(EXIT_FAILURE);
+		}
+
+		if (_daemon && _connect)
+		{
+			errs() << _T("the --daemon and --connect options are mutually exclusive");
+			errs.print();
+			Usage(EXIT_FAILURE);
+		}
+
+		if (!_watch_dir.empty() && (_do_check || _find_duplicates || _diff || _tee || !_copy_to.empty() || _connect))
+		{
+			errs() << _T("the --watch option cannot be combined with --check, --find-duplicates, --diff, --tee, --copy-to or --connect");
+			errs.print();
+			Usage(EXIT_FAILURE);
+		}
+
+		if (!_watch_dir.empty() && _sum_file.empty())
+		{
+			errs() << _T("the --watch option requires --sum-file");
+			errs.print();
+			Usage(EXIT_FAILURE);
+		}
+
+		if (!_watch_dir.empty() && _delim != _T("\n"))
+		{
+			errs() << _T("the --zero option is not supported with --watch");
+			errs.print();
+			Usage(EXIT_FAILURE);
+		}
+
+		if (_index && (_do_check || _find_duplicates || _diff || _tee || !_watch_dir.empty() || _delim != _T("\n")))
+		{
+			errs() << _T("the --index option is meaningful only when printing or converting checksums");
+			errs.print();
+			Usage(EXIT_FAILURE);
+		}
+
+		if (_index && _sum_file.empty())
+		{
+			errs() << _T("the --index option requires --sum-file");
+			errs.print();
+			Usage(EXIT_FAILURE);
+		}
+
+		if (_convert && (_do_check || _find_duplicates || _diff || _tee || !_watch_dir.empty() || !_copy_to.empty()
+			|| binary_flag || _bsd_tag || _delim != _T("\n")))
+		{
+			errs() << _T("the --convert option can only be combined with --index, --sum-file and --strict");
+			errs.print();
+			Usage(EXIT_FAILURE);
+		}
+
+		if (_tar && (_find_duplicates || _diff || _convert || _tee || !_watch_dir.empty() || !_copy_to.empty()))
+		{
+			errs() << _T("the --tar option cannot be combined with --find-duplicates, --diff, --convert, --tee, --watch or --copy-to");
+			errs.print();
+			Usage(EXIT_FAILURE);
+		}
+
+		if (_chunks && (_find_duplicates || _diff || _convert || _tee || !_watch_dir.empty() || !_copy_to.empty()
+			|| _index || _tar || !_binary || _delim != _T("\n")))
+		{
+			errs() << _T("the --chunks option cannot be combined with --find-duplicates, --diff, --convert, --tee, --watch, --copy-to, --index, --tar, --text or --zero");
+			errs.print();
+			Usage(EXIT_FAILURE);
+		}
+
+		if (_chunks && _do_check && _chunk_size != 0)
+		{
+			errs() << _T("a SIZE for --chunks is meaningful only when printing checksums, the checksum file lists the chunks");
+			errs.print();
+			Usage(EXIT_FAILURE);
+		}
+
+		if (!_files_from.empty() && (_do_check || _find_duplicates || _diff || _convert || _tee || !_watch_dir.empty() || _index))
+		{
+			errs() << _T("the --files-from option is meaningful only when printing checksums, and not with --index");
+			errs.print();
+			Usage(EXIT_FAILURE);
+		}
+
+		if (_per_line && (_do_check || _find_duplicates || _diff || _convert || _tee || !_watch_dir.empty() || !_copy_to.empty()
+			|| _index || _tar || _chunks || !_files_from.empty() || _bsd_tag))
+		{
+			errs() << _T("the --per-line option cannot be combined with --check, --find-duplicates, --diff, --convert, --tee, --watch, --copy-to, --index, --tar, --chunks, --files-from or --tag");
+			errs.print();
+			Usage(EXIT_FAILURE);
+		}
+
+		if (_shard_count != 0 && (_find_duplicates || _diff || _convert || _tee || !_watch_dir.empty() || _tar
+			|| _per_line || _merge_results))
+		{
+			errs() << _T("the --shard option cannot be combined with --find-duplicates, --diff, --convert, --tee, --watch, --tar, --per-line or --merge-results");
+			errs.print();
+			Usage(EXIT_FAILURE);
+		}
+
+		if (_merge_results && (_do_check || _find_duplicates || _diff || _convert || _tee || !_watch_dir.empty()
+			|| !_copy_to.empty() || _index || _tar || _chunks || _per_line || !_files_from.empty()
+			|| !_only.empty() || !_only_from.empty()))
+		{
+			errs() << _T("the --merge-results option can only be combined with --ignore-missing, --quiet, --status and --strict");
+			errs.print();
+			Usage(EXIT_FAILURE);
+		}
+
+		if (_files_from_null && _files_from.empty())
+		{
+			errs() << _T("the --null option is meaningful only with --files-from");
+			errs.print();
+			Usage(EXIT_FAILURE);
+		}
+
+		if (_no_numa && _numa_node != ~0UL)
+		{
+			errs() << _T("the --no-numa and --numa-node options are mutually exclusive");
+			errs.print();
+			Usage(EXIT_FAILURE);
+		}
+
+		if (!_tar_file.empty() && !_do_check)
+		{
+			errs() << _T("an ARCHIVE for --tar is meaningful only when verifying checksums");
+			errs.print();
+			Usage(EXIT_FAILURE);
+		}
+
+		if ((!_only.empty() || !_only_from.empty()) && !_do_check)
+		{
+			errs() << _T("the --only and --only-from options are meaningful only when verifying checksums");
+			errs.print();
+			Usage(EXIT_FAILURE);
+		}
+
+		if (_fail_fast && !_do_check)
+		{
+			errs() << _T("the --fail-fast option is meaningful only when verifying checksums");
+			errs.print();
+			Usage(EXIT_FAILURE);
+		}
+
+		if (_find_duplicates && _do_check)
+		{
+			errs() << _T("the --find-duplicates option is meaningless when verifying checksums");
+			errs.print();
+			Usage(EXIT_FAILURE);
+		}
+
+		if (_find_duplicates && !_binary)
+		{
+			errs() << _T("--find-duplicates does not support --text mode");
+			errs.print();
+			Usage(EXIT_FAILURE);
+		}
+
+		if (_diff && (_do_check || _find_duplicates))
+		{
+			errs() << _T("the --diff option cannot be combined with --check or --find-duplicates");
+			errs.print();
+			Usage(EXIT_FAILURE);
+		}
+
+		if (_diff && (binary_flag || _bsd_tag || _delim != _T("\n")))
+		{
+			errs() << _T("the --binary, --text, --tag and --zero options are meaningless when comparing checksums");
+			errs.print();
+			Usage(EXIT_FAILURE);
+		}
 	}
 
 	void DisposeInvalidOption(bool haserr = false) const
@@ -231,7 +626,7 @@ public:
 
 		errs().format(_T("Try '%s --help' for more information."), _program_name.c_str());
 		errs.print();
-		exit(EXIT_FAILURE);
+		ExitCommandLine(EXIT_FAILURE);
 	}
 } g_option;
 
@@ -243,17 +638,103 @@ void Usage(int status)
 	USAGE(_T("With no FILE, or when FILE is '-', read standard input. "));
 	USAGE(_T(""));
 	USAGE(_T("  -b, --binary          read in binary mode (default)"));
+	USAGE(_T("      --auto-tune       find the --device-jobs and --read-size that read the"));
+	USAGE(_T("                          fastest in the first seconds, and print them"));
+	USAGE(_T("      --bench-providers print the MB/s of each --provider for each algorithm"));
+	USAGE(_T("                          on this machine, hashing a buffer in memory"));
+	USAGE(_T("      --benchmark       digest each FILE with each --provider and print the"));
+	USAGE(_T("                          speeds, the FILE read once before into the cache"));
+	USAGE(_T("      --bwlimit=RATE    read at most RATE bytes per second, all files together;"));
+	USAGE(_T("                          RATE may end with K, M or G"));
 	USAGE(_T("  -c, --check           read %s sums from the FILEs and check them"), g_option._digest_alg_name.c_str());
+	USAGE(_T("                          (or from indexes written by --index)"));
+	USAGE(_T("      --connect[=NAME]  have the daemon serving on the pipe NAME do the work,"));
+	USAGE(_T("                          or do it here if there is none"));
+	USAGE(_T("      --chunks[=SIZE]   also print a digest of each SIZE bytes (4M by default)"));
+	USAGE(_T("                          of the FILEs; when checking, print the byte ranges"));
+	USAGE(_T("                          that changed in the files that FAILED"));
+	USAGE(_T("      --copy-to=DIR     copy the FILEs (or the files listed when checking) to"));
+	USAGE(_T("                          DIR while digesting them"));
+	USAGE(_T("      --convert         print the lines of the index FILE, or with --index"));
+	USAGE(_T("                          write the index of the checksum FILE"));
+	USAGE(_T("      --device-jobs=N   read at most N files at a time from each volume, by"));
+	USAGE(_T("                          default 1 on rotational disks, one per processor"));
+	USAGE(_T("                          on the others"));
+	USAGE(_T("      --files-from=LIST digest the files listed in LIST, one per line, as"));
+	USAGE(_T("                          they are read; '-' reads the list from standard input"));
+	USAGE(_T("      --idle            run with idle CPU and background I/O priority"));
+	USAGE(_T("      --index           write a binary index, sorted by file name, to the"));
+	USAGE(_T("                          --sum-file instead of the checksum lines"));
+	USAGE(_T("      --large-pages     back the read buffers with large pages, which needs the"));
+	USAGE(_T("                          'Lock pages in memory' privilege"));
+	USAGE(_T("      --max-memory=SIZE use at most SIZE bytes (1G by default) for the read"));
+	USAGE(_T("                          buffers, the reads wait for a buffer beyond that"));
+	USAGE(_T("      --merge-results   read the result FILEs of the --shard runs of a check"));
+	USAGE(_T("                          and report what a single run would have, with its"));
+	USAGE(_T("                          exit status"));
+	USAGE(_T("      --no-numa         don't pin the workers to the processors of the NUMA"));
+	USAGE(_T("                          nodes nor allocate their buffers on their node"));
+	USAGE(_T("      --null            the paths of --files-from end with NUL, not a newline"));
+	USAGE(_T("      --numa-node=N     run the workers on NUMA node N only, e.g. the node"));
+	USAGE(_T("                          nearest the storage controller"));
+	USAGE(_T("      --per-line        print a digest for each line of the FILEs instead, or"));
+	USAGE(_T("                          for each NUL-terminated record with --zero"));
+	USAGE(_T("      --physical-order  read the files of each volume one at a time in the"));
+	USAGE(_T("                          order of their position on disk, results are"));
+	USAGE(_T("                          still printed in the given order"));
+	USAGE(_T("      --provider=NAME   compute the digests with 'native' (the default,"));
+	USAGE(_T("                          CryptoAPI and the SIMD engines), 'cng', which hashes"));
+	USAGE(_T("                          the pages of the files mapped in memory and uses the"));
+	USAGE(_T("                          crypto offload engines CNG has providers for,"));
+	USAGE(_T("                          'openssl' when built with it, or 'reference', the"));
+	USAGE(_T("                          portable scalar code"));
+	USAGE(_T("      --quick[=N]       digest the size and N + 2 blocks of 64K (16 by"));
+	USAGE(_T("                          default) of the FILEs, the first, the last and N"));
+	USAGE(_T("                          evenly spaced; when checking, check such lines"));
+	USAGE(_T("      --read-size=SIZE  read the files SIZE bytes at a time (1M by default)"));
+	USAGE(_T("      --shard=I/N       digest or check only the files of shard I of N, chosen"));
+	USAGE(_T("                          by a hash of their path; a check ends with a #shard"));
+	USAGE(_T("                          line for --merge-results"));
+	USAGE(_T("      --sum-file=FILE   write the checksum lines to FILE"));
 	USAGE(_T("      --tag             create a BSD-style checksum"));
+	USAGE(_T("      --tar[=ARCHIVE]   digest the regular members of the tar archive FILEs;"));
+	USAGE(_T("                          when checking, check the checksum FILE against the"));
+	USAGE(_T("                          members of ARCHIVE, or of standard input"));
+	USAGE(_T("      --tee[=FILE]      copy standard input to FILE, or to standard output,"));
+	USAGE(_T("                          while digesting it; the checksum line goes to"));
+	USAGE(_T("                          standard error unless --sum-file is given"));
 	USAGE(_T("  -t, --text            read in text mode"));
+	USAGE(_T("      --verify-copy     read the copies of --copy-to back from disk and"));
+	USAGE(_T("                          compare their digests"));
+	USAGE(_T("      --watch=DIR       keep the --sum-file manifest of the files under DIR up"));
+	USAGE(_T("                          to date until killed, digesting a changed file"));
+	USAGE(_T("                          again once it is no longer being written"));
+	USAGE(_T("      --find-duplicates print the FILEs with identical contents, one group per"));
+	USAGE(_T("                          paragraph; only files of equal size and equal first"));
+	USAGE(_T("                          and last blocks are read in full"));
+	USAGE(_T("      --diff            read two %s sum FILEs, OLD and NEW, and print the"), g_option._digest_alg_name.c_str());
+	USAGE(_T("                          files added, removed or changed between them"));
 	USAGE(_T(""));
-	USAGE(_T("The following five options are useful only when verifying checksums:"));
+	USAGE(_T("The following eleven options are useful only when verifying checksums"));
+	USAGE(_T("(--status, --strict and --warn also when comparing them with --diff):"));
+	USAGE(_T("      --escalate=FILE   with --quick, read the files that FAILED in full and"));
+	USAGE(_T("                          write their checksum lines to FILE"));
+	USAGE(_T("      --fail-fast       stop at the first mismatch or read error"));
 	USAGE(_T("      --ignore-missing  don't fail or report status for missing files"));
+	USAGE(_T("      --journal=FILE    keep the progress of the check in FILE, which is"));
+	USAGE(_T("                          removed once the check is over"));
+	USAGE(_T("      --only=PATH       check only the file PATH, or the files under the"));
+	USAGE(_T("                          directory PATH; may be given more than once"));
+	USAGE(_T("      --only-from=LIST  check only the paths listed in LIST, one per line"));
 	USAGE(_T("      --quiet           don't print OK for each successfully verified file"));
+	USAGE(_T("      --resume          skip the lines the --journal FILE has as done by an"));
+	USAGE(_T("                          interrupted check and report the whole of it"));
 	USAGE(_T("      --status          don't output anything, status code shows success"));
 	USAGE(_T("      --strict          exit non-zero for improperly formatted checksum lines"));
 	USAGE(_T("  -w, --warn            warn about improperly formatted checksum lines"));
 	USAGE(_T(""));
+	USAGE(_T("      --daemon[=NAME]   serve the requests of --connect on the pipe NAME until"));
+	USAGE(_T("                          killed, keeping the digests of unchanged files"));
 	USAGE(_T("      --help            display this help and exit"));
 	USAGE(_T("      --version         output version information and exit"));
 	USAGE(_T(""));
@@ -263,7 +744,7 @@ void Usage(int status)
 		_T("('*' for binary, ' ' for text or where binary is insignificant), and name for each FILE."), 
 		g_option._alg_lecture_ref.c_str());
 	PrintUsage();
-	exit(status);
+	ExitCommandLine(status);
 }
 
 void Version()
@@ -271,7 +752,127 @@ void Version()
 	USAGE(_T("%s: version 1.0\n"), g_option._program_name.c_str());
 	USAGE(_T("Author: Sun Hongbo (Felix), @2019\n"));
 	PrintUsage();
-	exit(EXIT_SUCCESS);
+	ExitCommandLine(EXIT_SUCCESS);
+}
+
+//--daemon: a request whose command line would end the process (an invalid option, --help) ends
+//only the request, the daemon catches request_exit_t and sends the status back to the client
+struct request_exit_t
+{
+	int status;
+};
+bool g_serving_request = false;
+
+void ExitCommandLine(int status)
+{
+	if (g_serving_request)
+	{
+		request_exit_t request_exit = { status };
+		throw request_exit;
+	}
+	exit(status);
+}
+
+bool ParseCount(str& zIn_Count, DWORD& nOut_Count)
+{
+	TCHAR* pEnd = NULL;
+	unsigned long n = _tcstoul(zIn_Count.c_str(), &pEnd, 10);
+	if (zIn_Count.is_null() || pEnd == NULL || *pEnd != '\0' || n > MAXLONG)
+		return false;
+
+	nOut_Count = (DWORD)n;
+	return true;
+}
+
+//the read buffers in use and kept for reuse, without --max-memory
+const size_t default_max_memory = 1024 * 1024 * 1024;
+
+//a number of bytes, with an optional K, M or G suffix for powers of 1024
+bool ParseSize(str& zIn_Size, ULONGLONG& nOut_Size)
+{
+	TCHAR* pEnd = NULL;
+	ULONGLONG n = _tcstoui64(zIn_Size.c_str(), &pEnd, 10);
+	if (zIn_Size.is_null() || pEnd == NULL || pEnd == zIn_Size.c_str())
+		return false;
+
+	int nShift = 0;
+	if (*pEnd == 'k' || *pEnd == 'K')
+		nShift = 10;
+	else if (*pEnd == 'm' || *pEnd == 'M')
+		nShift = 20;
+	else if (*pEnd == 'g' || *pEnd == 'G')
+		nShift = 30;
+	if (nShift != 0)
+		pEnd++;
+	if (*pEnd != '\0' || n > (~0ULL >> nShift))
+		return false;
+
+	nOut_Size = n << nShift;
+	return true;
+}
+
+//the largest K, M or G unit that divides the size, as ParseSize reads it back
+void FormatSize(ULONGLONG nIn_Size, str& zOut_Size)
+{
+	const TCHAR* cUnits = _T("KMG");
+	int nUnit = -1;
+	while (nUnit < 2 && nIn_Size != 0 && (nIn_Size & 1023) == 0)
+	{
+		nIn_Size >>= 10;
+		nUnit++;
+	}
+	if (nUnit < 0)
+		zOut_Size.format(_T("%llu"), nIn_Size);
+	else
+		zOut_Size.format(_T("%llu%c"), nIn_Size, cUnits[nUnit]);
+}
+
+//--shard=I/N, I from 1 to N
+bool ParseShard(str& zIn_Shard, DWORD& nOut_Index, DWORD& nOut_Count)
+{
+	TCHAR* pEnd = NULL;
+	unsigned long i = _tcstoul(zIn_Shard.c_str(), &pEnd, 10);
+	if (zIn_Shard.is_null() || pEnd == NULL || pEnd == zIn_Shard.c_str() || *pEnd != '/')
+		return false;
+
+	const TCHAR* pCount = pEnd + 1;
+	unsigned long n = _tcstoul(pCount, &pEnd, 10);
+	if (pEnd == NULL || pEnd == pCount || *pEnd != '\0' || i == 0 || i > n || n > MAXLONG)
+		return false;
+
+	nOut_Index = (DWORD)i;
+	nOut_Count = (DWORD)n;
+	return true;
+}
+
+//--shard: a path belongs to a shard by the xxh3 of its name, with '/' as '\\' and ASCII letters
+//in lower case, so that every host, the command line and the checksum file agree on it
+bool InShard(const TCHAR* pName, size_t nLen)
+{
+	if (g_option._shard_count == 0)
+		return true;
+
+	xxh3_128_hasher hasher;
+	TCHAR cFolded[256];
+	while (nLen > 0)
+	{
+		size_t n = nLen < 256 ? nLen : 256;
+		for (size_t i = 0; i < n; i++)
+		{
+			TCHAR c = pName[i];
+			cFolded[i] = (c == '/') ? '\\' : ((c >= 'A' && c <= 'Z') ? c - 'A' + 'a' : c);
+		}
+		hasher.update((const BYTE*)cFolded, n * sizeof(TCHAR));
+		pName += n;
+		nLen -= n;
+	}
+
+	BYTE pbHash[16];
+	hasher.finish(pbHash);
+	ULONGLONG h = 0;
+	for (int i = 7; i >= 0; i--)
+		h = h << 8 | pbHash[i];
+	return h % g_option._shard_count == g_option._shard_index - 1;
 }
 
 bool VerifyFile(str& zIn_FileToVerify)
@@ -307,18 +908,16 @@ bool VerifyFile(str& zIn_FileToVerify)
 
 void SplitFileName(str& zIn_FileNameToSplit, str& zOut_SplitedFilePath, str& zOut_SplitedFileName)
 {
-	size_t len = zIn_FileNameToSplit.length();
-	size_t i = len;
-	while (i != 0)
+	//the path keeps its trailing '\' so that path + name rebuilds the file name
+	str::size_type pos = zIn_FileNameToSplit.find_last_of(_T("\\/:"));
+	if (pos == str::npos)
 	{
-		if (zIn_FileNameToSplit[i] == '\\')
-		{
-			zOut_SplitedFilePath = zIn_FileNameToSplit.substr(i + 1);
-			zOut_SplitedFileName = zIn_FileNameToSplit.substr(0, i - 1);
-			break;
-		}
-		i--;
+		zOut_SplitedFilePath = _T("");
+		zOut_SplitedFileName = zIn_FileNameToSplit;
+		return;
 	}
+	zOut_SplitedFilePath = zIn_FileNameToSplit.substr(0, pos + 1);
+	zOut_SplitedFileName = zIn_FileNameToSplit.substr(pos + 1);
 }
 
 bool ParseFileName(std::vector<str>& zOut_ParsedFiles, str& zIn_FileToParse)
@@ -359,527 +958,5502 @@ bool ParseFileName(std::vector<str>& zOut_ParsedFiles, str& zIn_FileToParse)
 	return true;
 }
 
-bool ComputeFileDigest(str& zIn_FileToCompute, str& zOut_Digest, AlgHash alg_id, bool is_binary_mode)
+bool IsBuiltinAlg(AlgHash alg_id)
 {
-	FILE* f = NULL;
-	if (zIn_FileToCompute == _T("-"))
-		f = stdin;
-	else
-		_tfopen_s(&f, zIn_FileToCompute.c_str(), is_binary_mode ? _T("rb") : _T("r"));
+	return alg_id == XXH3_128 || alg_id == CRC32C || alg_id == BLAKE3;
+}
 
-	if (f == NULL)
-		return false;
+//number of hex digits in a digest of the algorithm, 0 if unknown
+size_t DigestHexLength(AlgHash alg_id)
+{
+	switch (alg_id)
+	{
+	case MD5:
+		return 32;
+	case SHA1:
+		return 40;
+	case SHA256:
+		return 64;
+	case SHA384:
+		return 96;
+	case SHA512:
+		return 128;
+	case XXH3_128:
+		return 32;
+	case CRC32C:
+		return 8;
+	case BLAKE3:
+		return 64;
+	default:
+		return 0;
+	}
+}
+
+class cryptoapi_hasher : public digest_hasher
+{
+private:
+	HCRYPTPROV _hProv;
+	HCRYPTHASH _hHash;
+	ALG_ID _alg_id;
+
+public:
+	cryptoapi_hasher(ALG_ID alg_id) : _hProv(0), _hHash(0), _alg_id(alg_id)
+	{
+		//create CSP
+		CryptAcquireContext(&_hProv, NULL, NULL, PROV_RSA_AES/*use PROV_RSA_AES instead of PROV_RSA_FULL to support SHA2 algorithms*/, CRYPT_VERIFYCONTEXT | CRYPT_MACHINE_KEYSET);
+		CryptCreateHash(_hProv, alg_id, 0, 0, &_hHash);
+	}
+	~cryptoapi_hasher()
+	{
+		CryptDestroyHash(_hHash);
+		CryptReleaseContext(_hProv, 0);
+	}
+
+	//starts a new digest on the same CSP, acquiring one costs more than hashing a short record
+	void reset()
+	{
+		CryptDestroyHash(_hHash);
+		_hHash = 0;
+		CryptCreateHash(_hProv, _alg_id, 0, 0, &_hHash);
+	}
+
+	void update(const BYTE* data, size_t len)
+	{
+		CryptHashData(_hHash, data, (DWORD)len, 0);
+	}
+
+	DWORD finish(BYTE* digest)
+	{
+		DWORD dwHashLen = 0;
+		CryptGetHashParam(_hHash, HP_HASHVAL, NULL, &dwHashLen, 0);  //get dwHashLen
+		CryptGetHashParam(_hHash, HP_HASHVAL, digest, &dwHashLen, 0); //get bHash
+		return dwHashLen;
+	}
+};
+
+//--provider: an implementation of the algorithms. A provider is opened for the algorithm once,
+//in the main thread before the workers start, then creates the hashers of every worker; create()
+//returns NULL for an algorithm it wasn't opened for.
+class hash_provider
+{
+public:
+	virtual ~hash_provider() {}
+
+	virtual bool open(AlgHash alg_id) = 0; //false if the provider has no such algorithm here
+	virtual digest_hasher* create(AlgHash alg_id) = 0;
+};
+
+//--provider=native, the default: CryptoAPI for MD5 and the SHA digests, the SIMD engines of
+//fasthash.h for the others
+class native_provider : public hash_provider
+{
+public:
+	bool open(AlgHash alg_id)
+	{
+		return DigestHexLength(alg_id) != 0;
+	}
 
-	struct
+	digest_hasher* create(AlgHash alg_id)
 	{
-		bool operator()(TCHAR c, BYTE* buf, size_t max_buf_size, DWORD* n_bytes_transferred)
+		switch (alg_id)
 		{
-			if (max_buf_size < sizeof(TCHAR))
-				return false;
-			int n = sizeof(TCHAR);
-			for (int i = 0; i < n; i++)
-			{
-				buf[i] = (c >> (n - i - 1)) & 0xFF;
-			}
+		case XXH3_128:
+			return new xxh3_128_hasher;
+		case CRC32C:
+			return new crc32c_hasher;
+		case BLAKE3:
+			return new blake3_hasher(&g_pool);
+		default:
+			return new cryptoapi_hasher(alg_id);
+		}
+	}
+} g_native;
+
+class cng_hasher : public digest_hasher
+{
+private:
+	BCRYPT_HASH_HANDLE _hHash;
+	std::vector<BYTE> _object; //the hash object, allocated here for Windows 7
+	DWORD _cbHash;
+
+public:
+	cng_hasher(BCRYPT_ALG_HANDLE hAlg) : _hHash(NULL), _cbHash(0)
+	{
+		DWORD cbObject = 0;
+		ULONG cbResult = 0;
+		BCryptGetProperty(hAlg, BCRYPT_OBJECT_LENGTH, (PUCHAR)&cbObject, sizeof(cbObject), &cbResult, 0);
+		BCryptGetProperty(hAlg, BCRYPT_HASH_LENGTH, (PUCHAR)&_cbHash, sizeof(_cbHash), &cbResult, 0);
+		_object.resize(cbObject != 0 ? cbObject : 1);
+		BCryptCreateHash(hAlg, &_hHash, &_object[0], cbObject, NULL, 0, 0);
+	}
+	~cng_hasher()
+	{
+		if (_hHash != NULL)
+			BCryptDestroyHash(_hHash);
+	}
+
+	void update(const BYTE* data, size_t len)
+	{
+		//BCryptHashData takes a ULONG length
+		const size_t max_update_len = 1UL << 30;
+		while (len > 0)
+		{
+			ULONG n = (ULONG)(len < max_update_len ? len : max_update_len);
+			BCryptHashData(_hHash, (PUCHAR)data, n, 0);
+			data += n;
+			len -= n;
+		}
+	}
+
+	DWORD finish(BYTE* digest)
+	{
+		BCryptFinishHash(_hHash, digest, _cbHash, 0);
+		return _cbHash;
+	}
+};
+
+//--provider=cng: the CNG algorithm providers are kept open for the whole run, the hash objects
+//of the workers are created from them. CNG hands the hashing to the crypto offload engines it
+//has a provider for.
+class cng_provider : public hash_provider
+{
+	std::map<AlgHash, BCRYPT_ALG_HANDLE> _algs;
+
+public:
+	~cng_provider()
+	{
+		for (std::map<AlgHash, BCRYPT_ALG_HANDLE>::iterator it = _algs.begin(); it != _algs.end(); ++it)
+			BCryptCloseAlgorithmProvider(it->second, 0);
+	}
+
+	bool open(AlgHash alg_id)
+	{
+		if (_algs.find(alg_id) != _algs.end())
 			return true;
+
+		LPCWSTR pszAlgId;
+		switch (alg_id)
+		{
+		case MD5:
+			pszAlgId = BCRYPT_MD5_ALGORITHM;
+			break;
+		case SHA1:
+			pszAlgId = BCRYPT_SHA1_ALGORITHM;
+			break;
+		case SHA256:
+			pszAlgId = BCRYPT_SHA256_ALGORITHM;
+			break;
+		case SHA384:
+			pszAlgId = BCRYPT_SHA384_ALGORITHM;
+			break;
+		case SHA512:
+			pszAlgId = BCRYPT_SHA512_ALGORITHM;
+			break;
+		default:
+			return false;
 		}
-	} _tchar2byte;
 
-	HCRYPTPROV hProv;
-	HCRYPTHASH hHash;
+		BCRYPT_ALG_HANDLE hAlg = NULL;
+		if (!BCRYPT_SUCCESS(BCryptOpenAlgorithmProvider(&hAlg, pszAlgId, NULL, 0)))
+			return false;
+		_algs[alg_id] = hAlg;
+		return true;
+	}
 
-	//at least 64 bytes since SHA512 has the longest output (512 bits == 64 bytes)
-	const size_t max_hash_data_bytes = 64;
-	BYTE *pbHash = new BYTE[max_hash_data_bytes];
+	digest_hasher* create(AlgHash alg_id)
+	{
+		BCRYPT_ALG_HANDLE hAlg = handle(alg_id);
+		return hAlg != NULL ? new cng_hasher(hAlg) : NULL;
+	}
+
+	//NULL if not opened
+	BCRYPT_ALG_HANDLE handle(AlgHash alg_id)
+	{
+		std::map<AlgHash, BCRYPT_ALG_HANDLE>::iterator it = _algs.find(alg_id);
+		return it != _algs.end() ? it->second : NULL;
+	}
+} g_cng;
+
+#ifdef USE_OPENSSL
+class openssl_hasher : public digest_hasher
+{
+private:
+	EVP_MD_CTX* _ctx;
+
+public:
+	openssl_hasher(const EVP_MD* md) : _ctx(EVP_MD_CTX_new())
+	{
+		EVP_DigestInit_ex(_ctx, md, NULL);
+	}
+	~openssl_hasher()
+	{
+		EVP_MD_CTX_free(_ctx);
+	}
 
-	const size_t max_buffer_size = 1024;//1KB buffer
-	BYTE *pbBuffer = new BYTE[max_buffer_size];
+	void update(const BYTE* data, size_t len)
+	{
+		EVP_DigestUpdate(_ctx, data, len);
+	}
 
-	DWORD nBytesRead;
-	DWORD dwHashLen = 0;
+	DWORD finish(BYTE* digest)
+	{
+		unsigned int len = 0;
+		EVP_DigestFinal_ex(_ctx, digest, &len);
+		return len;
+	}
+};
 
-	//create CSP
-	CryptAcquireContext(&hProv, NULL, NULL, PROV_RSA_AES/*use PROV_RSA_AES instead of PROV_RSA_FULL to support SHA2 algorithms*/, CRYPT_VERIFYCONTEXT | CRYPT_MACHINE_KEYSET);
-	CryptCreateHash(hProv, alg_id, 0, 0, &hHash);
+//--provider=openssl: the EVP digests of the libcrypto the tools were built with (USE_OPENSSL),
+//which has none of the built-in algorithms
+class openssl_provider : public hash_provider
+{
+	std::map<AlgHash, const EVP_MD*> _mds;
 
-	do {
-		if (!is_binary_mode)
+public:
+	bool open(AlgHash alg_id)
+	{
+		const EVP_MD* md;
+		switch (alg_id)
 		{
-			if (!_tchar2byte(_fgettc(f), pbBuffer, max_buffer_size, &nBytesRead))
-				break;
+		case MD5:
+			md = EVP_md5();
+			break;
+		case SHA1:
+			md = EVP_sha1();
+			break;
+		case SHA256:
+			md = EVP_sha256();
+			break;
+		case SHA384:
+			md = EVP_sha384();
+			break;
+		case SHA512:
+			md = EVP_sha512();
+			break;
+		default:
+			return false;
 		}
-		else
-			nBytesRead = (DWORD) fread(pbBuffer, sizeof(BYTE), max_buffer_size, f);
+		if (md == NULL)
+			return false;
+		_mds[alg_id] = md;
+		return true;
+	}
 
-		CryptHashData(hHash, pbBuffer, nBytesRead, 0);
-	} while (!feof(f) && !ferror(f));
+	digest_hasher* create(AlgHash alg_id)
+	{
+		std::map<AlgHash, const EVP_MD*>::iterator it = _mds.find(alg_id);
+		return it != _mds.end() ? new openssl_hasher(it->second) : NULL;
+	}
+} g_openssl;
+#endif
 
-	fclose(f);
+//--provider=reference: the scalar engines, one block at a time and on one thread, to check
+//and measure the others against
+class reference_provider : public hash_provider
+{
+public:
+	bool open(AlgHash alg_id)
+	{
+		return DigestHexLength(alg_id) != 0;
+	}
+
+	digest_hasher* create(AlgHash alg_id)
+	{
+		switch (alg_id)
+		{
+		case MD5:
+			return new md5_reference;
+		case SHA1:
+			return new sha1_reference;
+		case SHA256:
+			return new sha256_reference;
+		case SHA384:
+			return new sha512_reference(true);
+		case SHA512:
+			return new sha512_reference;
+		case XXH3_128:
+			return new xxh3_128_scalar;
+		case CRC32C:
+			return new crc32c_scalar;
+		case BLAKE3:
+			return new blake3_scalar;
+		default:
+			return NULL;
+		}
+	}
+} g_reference;
+
+//--provider names, in HashProvider order
+const TCHAR* const provider_names[PROVIDER_COUNT] = { _T("native"), _T("cng"), _T("openssl"), _T("reference") };
+
+//'cryptoapi' is still taken for the native provider, its name before there were others
+bool ParseProvider(const str& zName, HashProvider& provider)
+{
+	for (int k = 0; k < PROVIDER_COUNT; k++)
+	{
+		if (zName == provider_names[k])
+		{
+			provider = (HashProvider)k;
+			return true;
+		}
+	}
+	if (zName == _T("cryptoapi"))
+	{
+		provider = NATIVE_PROVIDER;
+		return true;
+	}
+	return false;
+}
+
+//NULL if the provider wasn't built in
+hash_provider* GetProvider(HashProvider provider)
+{
+	switch (provider)
+	{
+	case NATIVE_PROVIDER:
+		return &g_native;
+	case CNG_PROVIDER:
+		return &g_cng;
+#ifdef USE_OPENSSL
+	case OPENSSL_PROVIDER:
+		return &g_openssl;
+#endif
+	case REFERENCE_PROVIDER:
+		return &g_reference;
+	default:
+		return NULL;
+	}
+}
 
-	CryptGetHashParam(hHash, HP_HASHVAL, NULL, &dwHashLen, 0);  //get dwHashLen
-	CryptGetHashParam(hHash, HP_HASHVAL, pbHash, &dwHashLen, 0); //get bHash
+//a hasher of the --provider, of the native one for an algorithm the provider wasn't opened for
+digest_hasher* CreateDigestHasher(AlgHash alg_id)
+{
+	hash_provider* provider = GetProvider(g_option._provider);
+	digest_hasher* hasher = provider != NULL ? provider->create(alg_id) : NULL;
+	return hasher != NULL ? hasher : g_native.create(alg_id);
+}
 
+void DigestToString(const BYTE* pbHash, DWORD dwHashLen, AlgHash alg_id, str& zOut_Digest)
+{
 	DWORD i, k;
 
 	//at least 128 + 1('\0') chars because SHA512 algorithm will generate 128 chars
 	const size_t max_hash_str_len = 129;
 	TCHAR *cHashStr = new TCHAR[max_hash_str_len];
-	memset(cHashStr, 0, max_hash_str_len);
+	memset(cHashStr, 0, max_hash_str_len * sizeof(TCHAR));
+
+	//CryptoAPI digests have always been written lower nibble first by these tools, keep it
+	//so existing checksum files still verify; the built-in engines use the canonical order
+	//of xxh128sum and b3sum.
+	bool lower_nibble_first = !IsBuiltinAlg(alg_id);
 
 	static const TCHAR *HexDigits = _T("0123456789abcdef");
 	for (i = 0; i < dwHashLen; i++)
 	{
 		k = pbHash[i] & 0xF;
-		cHashStr[2 * i] = HexDigits[k]; //lower nibble
+		cHashStr[2 * i + (lower_nibble_first ? 0 : 1)] = HexDigits[k]; //lower nibble
 
 		k = pbHash[i] >> 4 & 0xF;
-		cHashStr[2 * i + 1] = HexDigits[k]; //upper nibble
+		cHashStr[2 * i + (lower_nibble_first ? 1 : 0)] = HexDigits[k]; //upper nibble
 	}
 	zOut_Digest = cHashStr;
 
-	delete[] pbBuffer;
-	delete[] pbHash;
 	delete[] cHashStr;
-
-	CryptDestroyHash(hHash);
-	CryptReleaseContext(hProv, 0);
-
-	return true;
-}
-bool IsHexDigit(TCHAR c)
-{
-	static const TCHAR *s = _T("0123456789abcdefABCDEF");
-	int i = 0;
-	while (s[i] != '\0')
-	{
-		if (c == s[i])
-			return true;
-		i++;
-	}
-	return false;
 }
 
-bool ParseLine(TCHAR* cLine, str& zOut_DigestInLine, str& zOut_FileNameInLine, bool& is_binary, AlgHash& alg_id)
-{
-	str zLine = cLine;
-	size_t len = zLine.length();
-	if (len < 32)
-		return false;
+//--auto-tune: the first seconds of a run climb to the number of concurrent reads per volume and
+//the read size that give the most bytes per second. Each period measures the settings in
+//effect: the best ones first, then a neighbour of them (twice or half the workers, twice or half
+//the read size). A neighbour at least 5% faster becomes the best and the same move is tried
+//again, any other is undone and the next move tried. The settings are fixed once no move gains
+//or the tuning time is over.
+const size_t default_read_size = 1024 * 1024;
+const size_t min_read_size = 4 * 1024;
+const size_t max_read_size = 64 * 1024 * 1024;
+const DWORD tune_period_ms = 250;
+const DWORD tune_time_ms = 5000;
+const double tune_min_gain = 0.05;
 
-	const size_t max_filename_len = 512;
-	TCHAR* cFileName = new TCHAR[max_filename_len];
-	memset(cFileName, '\0', max_filename_len * sizeof(TCHAR));
+class auto_tuner
+{
+private:
+	enum { MORE_WORKERS, FEWER_WORKERS, LARGER_READS, SMALLER_READS, MOVES };
 
-	//at least 128 + 1('\0') chars because SHA512 algorithm will generate 128 chars
-	const size_t max_digest_chars = 129;
-	TCHAR* cDigest = new TCHAR[max_digest_chars];
-	memset(cDigest, '\0', max_digest_chars * sizeof(TCHAR));
+	CRITICAL_SECTION _lock;
+	CONDITION_VARIABLE _changed; //the settings moved, the tuning ended or a volume ran out of jobs
+	volatile bool _started;
+	volatile bool _tuning;
+	DWORD _max_workers;
+	volatile DWORD _workers;
+	volatile size_t _read_size;
+	DWORD _best_workers;
+	size_t _best_read_size;
+	double _best_rate; //bytes per millisecond
+	int _move; //being measured, -1: the best settings
+	int _gain_move; //the move that made the best settings, -1: none
+	int _tried; //moves tried without a gain since the last one
+	ULONGLONG _bytes;
+	DWORD _start;
+	DWORD _period_start;
 
-	str::size_type i = 0;
-	if (zLine.find(_T("MD5")) == 0 || zLine.find(_T("SHA")) == 0)// BSD style: '--tag'
+	//the best settings moved, false if that leaves the allowed range
+	bool apply(int move)
 	{
-		//BSD style (doesn't support '--text' mode):
-		//MD5 (file) = 05b04f4921652d0bc7dbf0835ba89fe1
-		if (zLine.find(_T("MD5")) == 0)
-		{
-			alg_id = MD5; //32 hex digits
-			i = 3;
-		}
-		else if (zLine.find(_T("SHA1")) == 0)
-		{
-			alg_id = SHA1; //40 hex digits
-			i = 5;
-		}
-		else if (zLine.find(_T("SHA256")) == 0)
+		DWORD workers = _best_workers;
+		size_t read_size = _best_read_size;
+		switch (move)
 		{
-			alg_id = SHA256; //64 hex digits
-			i = 6;
+		case MORE_WORKERS: workers *= 2; break;
+		case FEWER_WORKERS: workers /= 2; break;
+		case LARGER_READS: read_size *= 2; break;
+		default: read_size /= 2; break;
 		}
-		else if (zLine.find(_T("SHA384")) == 0)
+		if (workers < 1 || read_size < min_read_size || read_size > max_read_size)
+			return false;
+		if (workers > _max_workers)
+			workers = _max_workers;
+		if (workers == _best_workers && read_size == _best_read_size)
+			return false;
+		_workers = workers;
+		_read_size = read_size;
+		return true;
+	}
+
+	void freeze()
+	{
+		_workers = _best_workers;
+		_read_size = _best_read_size;
+		_tuning = false;
+	}
+
+	void step(double rate)
+	{
+		int next;
+		if (_move < 0)
 		{
-			alg_id = SHA384; //96 hex digits
-			i = 6;
+			_best_rate = rate;
+			next = MORE_WORKERS;
 		}
-		else if (zLine.find(_T("SHA512")) == 0)
+		else if (rate > _best_rate * (1 + tune_min_gain))
 		{
-			alg_id = SHA512; //128 hex digits
-			i = 6;
+			_best_workers = _workers;
+			_best_read_size = _read_size;
+			_best_rate = rate;
+			_gain_move = _move;
+			_tried = 0;
+			next = _move;
 		}
 		else
 		{
-			alg_id = UNKNOWN_ALG;
+			_tried++;
+			next = _move + 1;
 		}
 
-		while (i < len)
+		for (; _tried < MOVES; _tried++, next++)
 		{
-			if (zLine[i] == '(')
+			next %= MOVES;
+			if (_gain_move >= 0 && next == (_gain_move ^ 1)) //back where the gain came from
+				continue;
+			if (apply(next))
 			{
-				i++;
-				size_t k = 0;
-				while (zLine[i] != ')' && zLine[i] != '\0') //read file name
-				{
-					cFileName[k] = zLine[i];
-					i++;
-					k++;
-				}
-				k = 0;
-				while (zLine[i] != '\0')//read digest data
-				{
-					if (zLine[i] == '=' || zLine[i] == ' ')
-						i++;
-					else
-					{
-						if (zLine[i] != '\n' && IsHexDigit(zLine[i]))
-						{
-							cDigest[k] = zLine[i];
-							k++;
-						}
-					}
-				}
+				_move = next;
+				return;
 			}
-			i++;
 		}
-		is_binary = false;//--tag does not support --text mode
+		freeze();
 	}
-	else // GNU style
+
+public:
+	auto_tuner() : _started(false), _tuning(false), _max_workers(1), _workers(1), _read_size(default_read_size),
+		_best_workers(1), _best_read_size(default_read_size), _best_rate(0), _move(-1), _gain_move(-1), _tried(0),
+		_bytes(0), _start(0), _period_start(0)
 	{
-		//GNU style:
-		//05b04f4921652d0bc7dbf0835ba89fe1 *file
-		//05b04f4921652d0bc7dbf0835ba89fe1  file
-		i = 0;
-		if (!IsHexDigit(zLine[0]))
+		InitializeCriticalSection(&_lock);
+		InitializeConditionVariable(&_changed);
+	}
+	~auto_tuner() { DeleteCriticalSection(&_lock); }
+
+	//the first run of digest jobs starts tuning from its settings
+	void begin(DWORD workers, size_t read_size, DWORD max_workers)
+	{
+		EnterCriticalSection(&_lock);
+		if (!_started)
 		{
-			delete[] cDigest;
-			delete[] cFileName;
-			return false;
+			_max_workers = max_workers;
+			_workers = _best_workers = workers < max_workers ? workers : max_workers;
+			_read_size = _best_read_size = read_size;
+			_start = _period_start = GetTickCount();
+			_tuning = true;
+			_started = true;
 		}
-		size_t k = 0, j = 0;
-		bool bEndReadDigest = false;
-		bool bStartReadFilename = false;
-		is_binary = false;
-		while (i < len)
+		LeaveCriticalSection(&_lock);
+	}
+
+	bool started() const { return _started; }
+	bool tuning() const { return _tuning; }
+	size_t read_size() const { return _read_size; }
+
+	//a worker of rank k among those of its volume waits while k workers are enough
+	bool parked(DWORD rank) const { return _started && rank >= _workers; }
+
+	//a parked worker sleeps until the tuning wants it, the tuning ends or its volume has no job left
+	void wait_unparked(DWORD rank, volatile LONG& next, LONG count)
+	{
+		EnterCriticalSection(&_lock);
+		while (parked(rank) && _tuning && next < count && !g_cancel)
+			SleepConditionVariableCS(&_changed, &_lock, INFINITE);
+		LeaveCriticalSection(&_lock);
+	}
+
+	void wake()
+	{
+		EnterCriticalSection(&_lock);
+		WakeAllConditionVariable(&_changed);
+		LeaveCriticalSection(&_lock);
+	}
+
+	//bytes read by any worker, a period that is over moves the settings
+	void account(size_t nBytes)
+	{
+		if (!_tuning)
+			return;
+
+		EnterCriticalSection(&_lock);
+		DWORD now = GetTickCount();
+		if (_tuning)
 		{
-			if (!bEndReadDigest && IsHexDigit(zLine[i]))//read digest data
-			{
-				cDigest[k] = zLine[i];
-				k++;
-			}
-			else// read file name
+			_bytes += nBytes;
+			if (now - _period_start >= tune_period_ms)
 			{
-				bEndReadDigest = true;
-				if (!bStartReadFilename)
-				{
-					if (zLine[i] != ' ')
-						bStartReadFilename = true;
-				}
-				else if (zLine[i] != '\n')
+				double rate = (double)_bytes / (now - _period_start);
+				_bytes = 0;
+				_period_start = now;
+				if (now - _start >= tune_time_ms)
 				{
-					cFileName[j] = zLine[i];
-					j++;
-					if (j == 0 && cFileName[j] == '*')
-						is_binary = true;
+					if (_move < 0 || rate > _best_rate * (1 + tune_min_gain))
+					{
+						_best_workers = _workers;
+						_best_read_size = _read_size;
+						_best_rate = rate;
+					}
+					freeze();
 				}
+				else
+					step(rate);
+				WakeAllConditionVariable(&_changed);
 			}
-			i++;
-		}
-		i = _tcslen(cDigest);
-		switch (i)
-		{
-		case 32:
-			alg_id = MD5;
-			break;
-		case 40:
-			alg_id = SHA1;
-			break;
-		case 64:
-			alg_id = SHA256;
-			break;
-		case 96:
-			alg_id = SHA384;
-			break;
-		case 128:
-			alg_id = SHA512;
-			break;
-		default:
-			alg_id = UNKNOWN_ALG;
-			break;
 		}
+		LeaveCriticalSection(&_lock);
 	}
 
-	i = _tcslen(cDigest);
-	if ((alg_id == MD5 && i != 32)
-		|| (alg_id == SHA1 && i != 40)
-		|| (alg_id == SHA256 && i != 64)
-		|| (alg_id == SHA384 && i != 96)
-		|| (alg_id == SHA512 && i != 128)
-		|| alg_id == UNKNOWN_ALG)
+	//the settings to pin on the command line
+	void report()
 	{
-		delete[] cDigest;
-		delete[] cFileName;
-		return false;
+		if (!_started)
+			return;
+
+		str zReadSize;
+		FormatSize(_best_read_size, zReadSize);
+		if (_best_rate == 0)
+			errs(1).format(_T("%s: auto-tune: the run was too short to measure, kept --device-jobs=%lu --read-size=%s"),
+				g_option._program_name.c_str(), _best_workers, zReadSize.c_str());
+		else
+			errs(1).format(_T("%s: auto-tune: --device-jobs=%lu --read-size=%s (%.1f MB/s%s)"),
+				g_option._program_name.c_str(), _best_workers, zReadSize.c_str(), _best_rate * 1000 / (1024 * 1024),
+				_tuning ? _T(", still tuning when the run ended") : _T(""));
 	}
+} g_tuner;
 
-	zOut_FileNameInLine = cFileName;
-	zOut_DigestInLine = cDigest;
+//--bwlimit: no read larger than a tenth of a second's worth, the reads stay smooth; never larger
+//than nReadSize, the room left in the buffer of the caller
+size_t LimitedReadSize(size_t nReadSize)
+{
+	if (g_option._bwlimit != 0 && nReadSize > g_option._bwlimit / 10)
+	{
+		size_t nLimit = g_option._bwlimit / 10 > min_read_size ? (size_t)(g_option._bwlimit / 10) : min_read_size;
+		if (nLimit < nReadSize)
+			nReadSize = nLimit;
+	}
+	return nReadSize;
+}
 
-	delete[] cDigest;
-	delete[] cFileName;
+//the read size of ComputeFileDigest: --auto-tune's, --read-size or the default
+size_t FileReadSize()
+{
+	if (g_tuner.started())
+		return g_tuner.read_size();
+
+	return LimitedReadSize(g_option._read_size != 0 ? (size_t)g_option._read_size : default_read_size);
+}
+
+//--provider=cng: a file is hashed through views of a mapping of it, the pages go from the file
+//cache to the hash without a copy into a read buffer. A read error of a page surfaces as an
+//in-page exception while its view is hashed.
+const size_t mapped_view_size = 64 * 1024 * 1024; //a multiple of the allocation granularity
 
+bool HashMappedView(digest_hasher* hasher, const BYTE* pbView, size_t nBytes)
+{
+	__try
+	{
+		hasher->update(pbView, nBytes);
+	}
+	__except (GetExceptionCode() == EXCEPTION_IN_PAGE_ERROR ? EXCEPTION_EXECUTE_HANDLER : EXCEPTION_CONTINUE_SEARCH)
+	{
+		return false;
+	}
 	return true;
 }
 
-bool DigestFile(str& zIn_FileToCompute)
+//false if the file cannot be mapped, an empty one for instance, or a view of it cannot be, when
+//a 32-bit process runs out of address space; it is then read as usual
+bool ComputeMappedDigest(str& zIn_FileToCompute, str& zOut_Digest, AlgHash alg_id, bool& bOut_ReadOk)
 {
-	str zDigestComputed;
-	bool status = ComputeFileDigest(zIn_FileToCompute, zDigestComputed, g_option._digest_alg, g_option._binary);
-	if (status)
+	HANDLE hFile = CreateFile(zIn_FileToCompute.c_str(), GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING,
+		FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+	if (hFile == INVALID_HANDLE_VALUE)
+		return false;
+
+	LARGE_INTEGER size;
+	HANDLE hMapping = NULL;
+	if (!GetFileSizeEx(hFile, &size) || size.QuadPart == 0
+		|| (hMapping = CreateFileMapping(hFile, NULL, PAGE_READONLY, 0, 0, NULL)) == NULL)
+	{
+		CloseHandle(hFile);
+		return false;
+	}
+
+	digest_hasher* hasher = CreateDigestHasher(alg_id);
+	ULONGLONG nSize = (ULONGLONG)size.QuadPart;
+	bool bMapped = true;
+	bOut_ReadOk = true;
+	for (ULONGLONG nOffset = 0; nOffset < nSize && bOut_ReadOk && !g_cancel; nOffset += mapped_view_size)
 	{
-		outs.set_delimiter(g_option._delim);
-		if (g_option._bsd_tag)
+		size_t nView = nSize - nOffset < mapped_view_size ? (size_t)(nSize - nOffset) : mapped_view_size;
+		const BYTE* pbView = (const BYTE*)MapViewOfFile(hMapping, FILE_MAP_READ, (DWORD)(nOffset >> 32), (DWORD)nOffset, nView);
+		if (pbView == NULL)
 		{
-			//BSD style (doesn't support '--text' mode):
-			//MD5 (file) = 05b04f4921652d0bc7dbf0835ba89fe1
-			outs().format(_T("%s (%s) = %s"),
-				g_option._digest_alg_name.c_str(),
-				zIn_FileToCompute.c_str(),
-				zDigestComputed.c_str());
+			bMapped = false;
+			break;
 		}
-		else
+
+		//--bwlimit and --auto-tune see the pages a read size at a time
+		for (size_t pos = 0; pos < nView && bOut_ReadOk && !g_cancel; )
 		{
-			//GNU style:
-			//05b04f4921652d0bc7dbf0835ba89fe1 *file
-			//05b04f4921652d0bc7dbf0835ba89fe1  file
-			outs().format(_T("%s %c%s"),
-				zDigestComputed.c_str(),
-				g_option._binary ? _T('*') : _T(' '),
-				zIn_FileToCompute.c_str());
+			size_t nBytes = nView - pos < FileReadSize() ? nView - pos : FileReadSize();
+			g_bandwidth.consume(nBytes);
+			bOut_ReadOk = HashMappedView(hasher, pbView + pos, nBytes);
+			g_tuner.account(nBytes);
+			pos += nBytes;
 		}
+		UnmapViewOfFile(pbView);
 	}
-	return status;
+	bOut_ReadOk = bOut_ReadOk && !g_cancel;
+	CloseHandle(hMapping);
+	CloseHandle(hFile);
+	if (!bMapped)
+	{
+		delete hasher;
+		return false;
+	}
+
+	const size_t max_hash_data_bytes = 64;
+	BYTE pbHash[max_hash_data_bytes];
+	DigestToString(pbHash, hasher->finish(pbHash), alg_id, zOut_Digest);
+	delete hasher;
+	return true;
 }
-bool DigestCheck(str& zIn_FileContainsDigestInfo)
+
+//fCopy, if given, receives a copy of the data read (--copy-to)
+bool ComputeFileDigest(str& zIn_FileToCompute, str& zOut_Digest, AlgHash alg_id, bool is_binary_mode, FILE* fCopy = NULL)
 {
-	str zDigestComputed;
-	DWORD nMisformattedLines = 0;
-	DWORD nImproperlyFormattedLines = 0;
-	DWORD nMismatchedChecksums = 0;
-	DWORD nOpenOrReadFailures = 0;
-	bool bProperlyFormattedLines = false;
-	bool bMatchedChecksums = false;
+	bool bMappedOk;
+	if (g_option._provider == CNG_PROVIDER && g_cng.handle(alg_id) != NULL && is_binary_mode && fCopy == NULL
+		&& zIn_FileToCompute != _T("-") && ComputeMappedDigest(zIn_FileToCompute, zOut_Digest, alg_id, bMappedOk))
+		return bMappedOk;
 
-	const int max_line_length = 1024;
-	TCHAR* cLine = new TCHAR[max_line_length];
+	FILE* f = NULL;
+	if (zIn_FileToCompute == _T("-"))
+	{
+		f = stdin;
+		_setmode(_fileno(stdin), is_binary_mode ? _O_BINARY : _O_TEXT);
+	}
+	else
+		_tfopen_s(&f, zIn_FileToCompute.c_str(), is_binary_mode ? _T("rb") : _T("r"));
 
-	bool is_binary = false;
+	if (f == NULL)
+		return false;
 
-	bool is_stdin = (zIn_FileContainsDigestInfo == _T("-"));
+	FILE* fTee = (fCopy != NULL) ? fCopy : ((f == stdin) ? g_tee : NULL);
 
-	FILE* f = NULL;
+	//at least 64 bytes since SHA512 has the longest output (512 bits == 64 bytes)
+	const size_t max_hash_data_bytes = 64;
+	BYTE *pbHash = new BYTE[max_hash_data_bytes];
 
-	if (is_stdin)
+	//1MB buffer by default, large enough for BLAKE3 to split a read over the work pool, from the
+	//shared buffers on the node of the worker reading the file
+	size_t nBufferSize = FileReadSize();
+	BYTE *pbBuffer = (BYTE*)g_buffers.acquire(nBufferSize);
+	if (pbBuffer == NULL)
 	{
-		zIn_FileContainsDigestInfo = _T("standard input");
-		f = stdin;
+		if (f != stdin)
+			fclose(f);
+		delete[] pbHash;
+		return false;
 	}
-	else
+
+	digest_hasher* hasher = CreateDigestHasher(alg_id);
+
+	//--tee, --copy-to: a buffer is digested and written out at the same time, on two workers
+	struct TEE_T
 	{
-		_tfopen_s(&f, zIn_FileContainsDigestInfo.c_str(), _T("r"));
-		if (f == NULL)
+		digest_hasher* hasher;
+		FILE* fTee;
+		const BYTE* pbData;
+		size_t nBytes;
+		void operator()(size_t i)
 		{
-			errs().format(_T("%s: %s: no such file or directory"),
-				g_option._program_name.c_str(), zIn_FileContainsDigestInfo.c_str());
-			return false;
+			if (i == 0)
+				hasher->update(pbData, nBytes);
+			else
+				fwrite(pbData, sizeof(BYTE), nBytes, fTee);
 		}
-	}
+	} _tee = { hasher, fTee, pbBuffer, 0 };
 
-	DWORD nLine = 0;
-	size_t nLineLen;
-	std::vector<str> file;
-	str zDigestInFile;
-	AlgHash alg;
+	//in text mode the C runtime translates line endings since the file is opened with "r"
+	size_t nBytesRead;
 	do {
-		++nLine;
-		if (nLine == 0)
-			errs(1).format(_T("%s: too many checksum lines"),
-				zIn_FileContainsDigestInfo.c_str());
-			
+		//--auto-tune may have changed the read size since the last read
+		if (nBufferSize != FileReadSize())
+		{
+			g_buffers.release(pbBuffer);
+			nBufferSize = FileReadSize();
+			pbBuffer = (BYTE*)g_buffers.acquire(nBufferSize);
+			if (pbBuffer == NULL)
+				break;
+			_tee.pbData = pbBuffer;
+		}
 
-		if (NULL == _fgetts(cLine, max_line_length, f))
-			break;
+		nBytesRead = fread(pbBuffer, sizeof(BYTE), nBufferSize, f);
+		g_tuner.account(nBytesRead);
+		g_bandwidth.consume(nBytesRead);
+		if (fTee == NULL)
+			hasher->update(pbBuffer, nBytesRead);
+		else if (nBytesRead > 0)
+		{
+			_tee.nBytes = nBytesRead;
+			g_pool.run(2, _tee);
+			if (ferror(fTee))
+				break;
+		}
+	} while (!feof(f) && !ferror(f) && !g_cancel);
 
-		nLineLen = _tcslen(cLine);
-		//Ignore comment lines, which begin with a '#' character.
-		if (cLine[0] == '#')
-			continue;
+	//a failed --copy-to write is the caller's error on the copy, see ferror(fCopy)
+	bool bReadOk = pbBuffer != NULL && !ferror(f) && !g_cancel && (fCopy != NULL || fTee == NULL || !ferror(fTee));
+	if (f != stdin)
+		fclose(f);
 
-		str zFileToCheck;
-		bool bParseOk = ParseLine(cLine, zDigestInFile, zFileToCheck, is_binary, alg);
-		if (!bParseOk || (bParseOk && (alg != g_option._digest_alg)))
+	DWORD dwHashLen = hasher->finish(pbHash);
+	DigestToString(pbHash, dwHashLen, alg_id, zOut_Digest);
+
+	delete hasher;
+	g_buffers.release(pbBuffer);
+	delete[] pbHash;
+
+	return bReadOk;
+}
+//--chunks: the file is digested as a whole and in chunks of nChunkSize bytes in the same read.
+//A read covers several chunks, which are digested in parallel with the whole file; the part of
+//a chunk that does not fit in one read is continued by the next.
+const ULONGLONG default_chunk_size = 4 * 1024 * 1024;
+const size_t min_chunk_read_size = 4 * 1024 * 1024;
+const size_t max_chunk_read_size = 64 * 1024 * 1024;
+const ULONGLONG max_chunk_size = 1ULL << 48; //256 TB, keeps the read size arithmetic from overflowing
+
+bool ComputeChunkedDigest(str& zIn_File, ULONGLONG nChunkSize, bool is_binary_mode, str& zOut_Digest,
+	std::vector<str>& zOut_Chunks, ULONGLONG& nOut_Size)
+{
+	FILE* f = NULL;
+	if (zIn_File == _T("-"))
+	{
+		f = stdin;
+		_setmode(_fileno(stdin), is_binary_mode ? _O_BINARY : _O_TEXT);
+	}
+	else
+		_tfopen_s(&f, zIn_File.c_str(), is_binary_mode ? _T("rb") : _T("r"));
+
+	if (f == NULL)
+		return false;
+
+	//a whole number of chunks per read, one for each worker, unless they are too small or too large
+	ULONGLONG nReadSize = max_chunk_read_size;
+	if (nChunkSize < max_chunk_read_size)
+	{
+		nReadSize = nChunkSize * g_pool.size();
+		if (nReadSize < min_chunk_read_size)
+			nReadSize = (min_chunk_read_size + nChunkSize - 1) / nChunkSize * nChunkSize;
+		if (nReadSize > max_chunk_read_size)
+			nReadSize = max_chunk_read_size / nChunkSize * nChunkSize;
+	}
+	size_t nBufferSize = (size_t)nReadSize;
+	BYTE *pbBuffer = (BYTE*)g_buffers.acquire(nBufferSize);
+	if (pbBuffer == NULL)
+	{
+		if (f != stdin)
+			fclose(f);
+		return false;
+	}
+
+	struct chunk_span_t
+	{
+		digest_hasher* hasher;
+		const BYTE* pbData;
+		size_t nBytes;
+	};
+
+	struct CHUNKS_T
+	{
+		digest_hasher* whole;
+		const BYTE* pbData;
+		size_t nBytes;
+		std::vector<chunk_span_t>& spans;
+		CHUNKS_T(digest_hasher* h, std::vector<chunk_span_t>& s) : whole(h), pbData(NULL), nBytes(0), spans(s) {}
+		void operator()(size_t i)
 		{
-			++nMisformattedLines;
-			++nImproperlyFormattedLines;
-			errs(1, g_option._warn || g_option._status_only)
-				.format(_T("%s: %lu: ill-formatted %s checksum line"),
-					zIn_FileContainsDigestInfo.c_str(), nLine, g_option._digest_alg_name.c_str());
-			
+			if (i == 0)
+				whole->update(pbData, nBytes);
+			else
+				spans[i - 1].hasher->update(spans[i - 1].pbData, spans[i - 1].nBytes);
 		}
-		else
+	};
+
+	const size_t max_hash_data_bytes = 64;
+	BYTE pbHash[max_hash_data_bytes];
+	str zDigest;
+
+	digest_hasher* whole = CreateDigestHasher(g_option._digest_alg);
+	digest_hasher* carry = NULL; //the chunk continued from the previous read
+	std::vector<chunk_span_t> spans;
+	CHUNKS_T _chunks(whole, spans);
+	zOut_Chunks.clear();
+	nOut_Size = 0;
+
+	size_t nBytesRead;
+	do {
+		nBytesRead = fread(pbBuffer, sizeof(BYTE), LimitedReadSize(nBufferSize), f);
+		g_bandwidth.consume(nBytesRead);
+
+		spans.clear();
+		for (size_t pos = 0; pos < nBytesRead; pos += spans.back().nBytes)
 		{
-			bool ok = false;
+			ULONGLONG nChunkLeft = nChunkSize - (nOut_Size + pos) % nChunkSize;
+			chunk_span_t span;
+			span.hasher = (pos == 0 && carry != NULL) ? carry : CreateDigestHasher(g_option._digest_alg);
+			span.pbData = pbBuffer + pos;
+			span.nBytes = nChunkLeft < nBytesRead - pos ? (size_t)nChunkLeft : nBytesRead - pos;
+			spans.push_back(span);
+		}
+		carry = NULL;
 
-			bProperlyFormattedLines = true;
-			zDigestComputed = _T("");//clear contents
-			ok = ComputeFileDigest(zFileToCheck, zDigestComputed, g_option._digest_alg, is_binary);
-			if (!ok)
-			{
-				++nOpenOrReadFailures;
-				errs(0, g_option._status_only || g_option._ignore_missing)
-					.format(_T("%s: open or read error"), zFileToCheck.c_str());
-			}
-			else
-			{
-				if (zDigestComputed != zDigestInFile)
-					++nMismatchedChecksums;
-				else
-					bMatchedChecksums = true;
+		_chunks.pbData = pbBuffer;
+		_chunks.nBytes = nBytesRead;
+		g_pool.run(spans.size() + 1, _chunks);
+		nOut_Size += nBytesRead;
 
-				outs(0, g_option._status_only).format(_T("%s: %s%c"),
-					zFileToCheck.c_str(),
-					(zDigestComputed != zDigestInFile) ? _T("FAILED") : ((!g_option._quiet) ? _T("OK") : _T("")),
-					g_option._delim);
+		for (size_t i = 0; i < spans.size(); i++)
+		{
+			if (i + 1 == spans.size() && nOut_Size % nChunkSize != 0)
+			{
+				carry = spans[i].hasher; //finished by a later read or at the end of the file
+				break;
 			}
+			DigestToString(pbHash, spans[i].hasher->finish(pbHash), g_option._digest_alg, zDigest);
+			zOut_Chunks.push_back(zDigest);
+			delete spans[i].hasher;
 		}
-	} while (!feof(f) && !ferror(f));
+	} while (!feof(f) && !ferror(f) && !g_cancel);
 
-	delete[] cLine;
+	if (carry != NULL)
+	{
+		DigestToString(pbHash, carry->finish(pbHash), g_option._digest_alg, zDigest);
+		zOut_Chunks.push_back(zDigest);
+		delete carry;
+	}
+
+	bool bReadOk = !ferror(f) && !g_cancel;
+	if (f != stdin)
+		fclose(f);
+
+	DigestToString(pbHash, whole->finish(pbHash), g_option._digest_alg, zOut_Digest);
+	delete whole;
+	g_buffers.release(pbBuffer);
+
+	return bReadOk;
+}
+
+//--quick: the size of the file and N + 2 blocks of it, the first, the last and N evenly spaced
+//between them, digested with the program's algorithm. A file no larger than the blocks is
+//digested whole after its size. The lines are labelled "MD5-QUICK16 (file) = ..." so that a
+//quick digest is never taken for the digest of a whole file.
+const size_t quick_block_size = 64 * 1024;
+const DWORD default_quick_samples = 16;
+const DWORD max_quick_samples = 4096;
+
+bool ComputeQuickDigest(str& zIn_File, DWORD nSamples, str& zOut_Digest)
+{
+	FILE* f = NULL;
+	_tfopen_s(&f, zIn_File.c_str(), _T("rb"));
+	if (f == NULL)
+		return false;
 
-	if ((!is_stdin && fclose(f) != 0) || (ferror(f)))
+	LONGLONG nSize = -1;
+	if (_fseeki64(f, 0, SEEK_END) == 0)
+		nSize = _ftelli64(f);
+	BYTE *pbBuffer = nSize < 0 ? NULL : (BYTE*)g_buffers.acquire(quick_block_size);
+	if (pbBuffer == NULL)
 	{
-		errs().format(_T("%s: read error"),
-			zIn_FileContainsDigestInfo.c_str());
+		fclose(f);
 		return false;
 	}
 
-	if (!bProperlyFormattedLines)
+	digest_hasher* hasher = CreateDigestHasher(g_option._digest_alg);
+	BYTE pbSize[8]; //little endian
+	for (int i = 0; i < 8; i++)
+		pbSize[i] = (BYTE)((ULONGLONG)nSize >> (8 * i));
+	hasher->update(pbSize, sizeof(pbSize));
+
+	bool bReadOk = (_fseeki64(f, 0, SEEK_SET) == 0);
+	ULONGLONG nBlocks = (ULONGLONG)nSamples + 2;
+	if ((ULONGLONG)nSize <= nBlocks * quick_block_size)
 	{
-		//Warn if no tests are found.
-		errs(1).format(_T("%s: no well-formatted %s checksum lines found"),
-			zIn_FileContainsDigestInfo.c_str(), g_option._digest_alg_name.c_str());
+		size_t nBytesRead;
+		do {
+			nBytesRead = fread(pbBuffer, sizeof(BYTE), quick_block_size, f);
+			g_bandwidth.consume(nBytesRead);
+			hasher->update(pbBuffer, nBytesRead);
+		} while (bReadOk && nBytesRead == quick_block_size && !g_cancel);
+		bReadOk = bReadOk && !ferror(f);
 	}
 	else
 	{
-		if (!g_option._status_only)
+		//block k of 0..N+1 starts at (size - block) * k / (N + 1), without overflowing
+		ULONGLONG nSpan = (ULONGLONG)nSize - quick_block_size;
+		ULONGLONG nStep = nSpan / (nSamples + 1), nRest = nSpan % (nSamples + 1);
+		for (ULONGLONG k = 0; bReadOk && k < nBlocks && !g_cancel; k++)
 		{
-			errs(1, (nMisformattedLines == 0)).format(_T("WARNING: %lu: line(s) is ill-formatted"),
-				nMisformattedLines);
+			ULONGLONG nOffset = nStep * k + nRest * k / (nSamples + 1);
+			bReadOk = _fseeki64(f, (LONGLONG)nOffset, SEEK_SET) == 0
+				&& fread(pbBuffer, sizeof(BYTE), quick_block_size, f) == quick_block_size;
+			g_bandwidth.consume(quick_block_size);
+			hasher->update(pbBuffer, quick_block_size);
+		}
+	}
+	bReadOk = bReadOk && !g_cancel;
+	fclose(f);
 
-			errs(1, (nOpenOrReadFailures == 0)).format(_T("WARNING: %lu: listed file(s) could not be read"),
-				nOpenOrReadFailures);
+	const size_t max_hash_data_bytes = 64;
+	BYTE pbHash[max_hash_data_bytes];
+	DigestToString(pbHash, hasher->finish(pbHash), g_option._digest_alg, zOut_Digest);
+	delete hasher;
+	g_buffers.release(pbBuffer);
 
-			errs(1, (nMismatchedChecksums == 0)).format(_T("WARNING: %lu: computed checksum(s) did NOT match"),
-				nMismatchedChecksums);
+	return bReadOk;
+}
 
-			errs(1, g_option._ignore_missing || bMatchedChecksums).format(_T("%s: no file was verified"),
-				zIn_FileContainsDigestInfo.c_str());
-		}
+bool IsHexDigit(TCHAR c)
+{
+	static const TCHAR *s = _T("0123456789abcdefABCDEF");
+	int i = 0;
+	while (s[i] != '\0')
+	{
+		if (c == s[i])
+			return true;
+		i++;
 	}
-
-	return (bProperlyFormattedLines
-		&& bMatchedChecksums
-		&& nMismatchedChecksums == 0
-		&& nOpenOrReadFailures == 0
-		&& (!g_option._strict || nImproperlyFormattedLines == 0));
+	return false;
 }
 
-int main(int argc, const TCHAR* argv[])
+bool ParseLine(TCHAR* cLine, str& zOut_DigestInLine, str& zOut_FileNameInLine, bool& is_binary, AlgHash& alg_id)
 {
-	g_option.InitMain(argc, argv);
+	str zLine = cLine;
+	size_t len = zLine.length();
+	while (len > 0 && (zLine[len - 1] == '\n' || zLine[len - 1] == '\r'))
+		len--;
+	zLine = zLine.substr(0, len);
 
-	if (argc == 1)
+	//the shortest line is a CRC32C digest, a space, the mode character and a file name
+	if (len < DigestHexLength(CRC32C) + 3)
+		return false;
+
+	static const struct
 	{
-		errs().format(_T("%s: requires argument(s)."), g_option._program_name.c_str());
-		g_option.DisposeInvalidOption(true);
-	}
-	
-	option::definition optdefs[] = {
-		{_T("--binary"), 'b', option::no_argument},
-		{_T("--check"), 'c', option::no_argument},
-		{_T("--ignore-missing"), -300, option::no_argument},
-		{_T("--quiet"), -301, option::no_argument},
-		{_T("--status"), -302, option::no_argument},
-		{_T("--text"), 't', option::no_argument},
-		{_T("--warn"), 'w', option::no_argument},
-		{_T("--strict"), -303, option::no_argument},
-		{_T("--tag"), -304, option::no_argument},
-		{_T("--zero"), '0', option::no_argument},
-		{_T("--help"), -305, option::no_argument},
-		{_T("--version"), -306, option::no_argument},
-		option::definition::nullopt() };
+		const TCHAR* tag;
+		AlgHash alg_id;
+	} bsd_tags[] = {
+		{ _T("MD5 ("), MD5 },
+		{ _T("SHA1 ("), SHA1 },
+		{ _T("SHA256 ("), SHA256 },
+		{ _T("SHA384 ("), SHA384 },
+		{ _T("SHA512 ("), SHA512 },
+		{ _T("XXH128 ("), XXH3_128 },
+		{ _T("CRC32C ("), CRC32C },
+		{ _T("BLAKE3 ("), BLAKE3 },
+		{ NULL, UNKNOWN_ALG } };
 
-	option opt(argc, argv, optdefs);
+	str zDigest, zFileName;
+	str::size_type i = 0;
 
-	std::vector<str> files;
-	while (!opt.is_end())
+	alg_id = UNKNOWN_ALG;
+	for (i = 0; bsd_tags[i].tag != NULL; i++)
 	{
-		switch (opt.value())
+		if (zLine.find(bsd_tags[i].tag) == 0)
 		{
-		case 'b':
-			g_option._binary = true;
-			g_option.SetBinaryFlag();
-			break;
-		case 'c':
-			g_option._do_check = true;
-			break;
-		case 't':
-			g_option._binary = false;
-			break;
-		case 'w':
-			g_option._status_only = false;
-			g_option._warn = true;
-			g_option._quiet = false;
-			break;
-		case '0':
-			g_option._delim = _T("");
-			break;
-		case -300:
-			g_option._ignore_missing = true;
-			break;
-		case -301:
-			g_option._status_only = false;
-			g_option._warn = false;
-			g_option._quiet = true;
-			break;
-		case -302:
-			g_option._status_only = true;
-			g_option._warn = false;
-			g_option._quiet = false;
-			break;
-		case -303:
-			g_option._strict = true;
-			break;
-		case -304:
-			g_option._bsd_tag = true;
-			g_option._binary = true;
+			alg_id = bsd_tags[i].alg_id;
 			break;
-		case -305:
-			Usage(EXIT_SUCCESS);
-			break;
-		case -306:
-			Version();
-			break;
-		default:
-			if (opt.kind() == option::operand)
-			{
-				ParseFileName(files, opt.optname());
-				break;
-			}
-			else
-				g_option.DisposeInvalidOption(opt.has_error());
 		}
-		opt.to_next();
 	}
 
-	g_option.DisposeOptionConflict();
+	if (alg_id != UNKNOWN_ALG)// BSD style: '--tag'
+	{
+		//BSD style (doesn't support '--text' mode):
+		//MD5 (file) = 05b04f4921652d0bc7dbf0835ba89fe1
+		str::size_type name_start = zLine.find(_T("(")) + 1;
+		str::size_type name_end = zLine.rfind(_T(") = "), str::npos); //file names may contain ") = "
+		if (name_end == str::npos || name_end < name_start)
+			return false;
+
+		zFileName = zLine.substr(name_start, name_end - name_start);
+		zDigest = zLine.substr(name_end + 4);
+		is_binary = true;//--tag does not support --text mode
+	}
+	else // GNU style
+	{
+		//GNU style:
+		//05b04f4921652d0bc7dbf0835ba89fe1 *file
+		//05b04f4921652d0bc7dbf0835ba89fe1  file
+		i = 0;
+		while (i < len && IsHexDigit(zLine[i]))//read digest data
+			i++;
+
+		if (i == 0 || i + 2 >= len || zLine[i] != ' ' || (zLine[i + 1] != ' ' && zLine[i + 1] != '*'))
+			return false;
+
+		zDigest = zLine.substr(0, i);
+		is_binary = (zLine[i + 1] == '*');
+		zFileName = zLine.substr(i + 2);
+
+		//xxh3sum and md5sum (or b3sum and sha256sum) digests have the same length,
+		//prefer the algorithm of this program.
+		if (zDigest.length() == DigestHexLength(g_option._digest_alg))
+			alg_id = g_option._digest_alg;
+		else
+		{
+			switch (zDigest.length())
+			{
+			case 8:
+				alg_id = CRC32C;
+				break;
+			case 32:
+				alg_id = MD5;
+				break;
+			case 40:
+				alg_id = SHA1;
+				break;
+			case 64:
+				alg_id = SHA256;
+				break;
+			case 96:
+				alg_id = SHA384;
+				break;
+			case 128:
+				alg_id = SHA512;
+				break;
+			default:
+				alg_id = UNKNOWN_ALG;
+				break;
+			}
+		}
+	}
+
+	if (alg_id == UNKNOWN_ALG || zDigest.length() != DigestHexLength(alg_id) || zFileName.is_null())
+		return false;
+
+	for (i = 0; i < zDigest.length(); i++)
+	{
+		if (!IsHexDigit(zDigest[i]))
+			return false;
+	}
+
+	zOut_FileNameInLine = zFileName;
+	zOut_DigestInLine = zDigest;
+
+	return true;
+}
+
+//--quick: the length of the "MD5-QUICK16" label of a quick line of the program's algorithm,
+//followed by " (", 0 if the line has none; nOut_Samples receives the N of the label
+size_t QuickLabelLength(const TCHAR* cLine, DWORD& nOut_Samples)
+{
+	str zLabel = g_option._digest_alg_name + _T("-QUICK");
+	size_t len = zLabel.length();
+	if (_tcsncmp(cLine, zLabel.c_str(), len) != 0)
+		return 0;
+
+	ULONGLONG nSamples = 0;
+	size_t nDigits = 0;
+	while (cLine[len + nDigits] >= '0' && cLine[len + nDigits] <= '9' && nDigits < 5)
+		nSamples = nSamples * 10 + (cLine[len + nDigits++] - '0');
+	len += nDigits;
+	if (nDigits == 0 || nSamples == 0 || nSamples > max_quick_samples || cLine[len] != ' ' || cLine[len + 1] != '(')
+		return 0;
+
+	nOut_Samples = (DWORD)nSamples;
+	return len;
+}
+
+//--quick: MD5-QUICK16 (file) = 05b04f4921652d0bc7dbf0835ba89fe1
+bool ParseQuickLine(TCHAR* cLine, str& zOut_DigestInLine, str& zOut_FileNameInLine, DWORD& nOut_Samples)
+{
+	str zLine = cLine;
+	size_t len = zLine.length();
+	while (len > 0 && (zLine[len - 1] == '\n' || zLine[len - 1] == '\r'))
+		len--;
+	zLine = zLine.substr(0, len);
+
+	size_t nLabel = QuickLabelLength(zLine.c_str(), nOut_Samples);
+	if (nLabel == 0)
+		return false;
+
+	str::size_type name_start = nLabel + 2;
+	str::size_type name_end = zLine.rfind(_T(") = "), str::npos);
+	if (name_end == str::npos || name_end <= name_start)
+		return false;
+
+	str zDigest = zLine.substr(name_end + 4);
+	if (zDigest.length() != DigestHexLength(g_option._digest_alg))
+		return false;
+	for (size_t i = 0; i < zDigest.length(); i++)
+	{
+		if (!IsHexDigit(zDigest[i]))
+			return false;
+	}
+
+	zOut_FileNameInLine = zLine.substr(name_start, name_end - name_start);
+	zOut_DigestInLine = zDigest;
+	return true;
+}
+
+//--copy-to: a file is not copied when a copy would not be identical or would take the place
+//of another one
+enum CopySkip { COPY_NOT_SKIPPED, COPY_TEXT_MODE, COPY_NAME_TAKEN, COPY_STANDARD_INPUT };
+
+struct digest_job_t
+{
+	str file;
+	bool is_binary;
+	str digest; //digest listed in the checksum file when checking
+	str computed;
+	bool ok; //opened and read
+	bool done; //false if the job was cancelled by --fail-fast
+	ULONGLONG volume; //volume serial number, jobs are scheduled per volume
+	ULONGLONG position; //physical position for --physical-order
+	str copy_to; //destination for --copy-to
+	CopySkip copy_skip; //why the file is not copied, it is still digested
+	bool copy_error; //the destination could not be written or did not verify
+	ULONGLONG chunk_size; //--chunks, 0: the file is digested as a whole only
+	ULONGLONG size; //bytes read, with --chunks
+	std::vector<str> chunks; //digests of the chunks read
+	ULONGLONG listed_size; //bytes covered by the chunks listed in the checksum file
+	std::vector<str> listed_chunks;
+	DWORD quick; //--quick, the blocks sampled between the first and the last, 0: the whole file
+	digest_job_t() : is_binary(true), ok(false), done(false), volume(0), position(0), copy_skip(COPY_NOT_SKIPPED), copy_error(false),
+		chunk_size(0), size(0), listed_size(0), quick(0) {}
+};
+
+//--chunks: the chunks follow the checksum line of their file as "#chunk OFFSET LENGTH DIGEST"
+//comment lines, so the checksum file is still read by a plain --check
+void PrintChunkLines(digest_job_t& job)
+{
+	for (size_t i = 0; i < job.chunks.size(); i++)
+	{
+		ULONGLONG nOffset = i * job.chunk_size;
+		ULONGLONG nLength = job.size - nOffset < job.chunk_size ? job.size - nOffset : job.chunk_size;
+		outs().format(_T("#chunk %llu %llu %s"), nOffset, nLength, job.chunks[i].c_str());
+	}
+}
+
+//a "#chunk" line for the job of the checksum line before it; the chunks must be listed in
+//order, all of the size of the first one except the last
+bool ParseChunkLine(const TCHAR* cLine, digest_job_t& job)
+{
+	const TCHAR* p = cLine + 7;
+	TCHAR* pEnd = NULL;
+	ULONGLONG nOffset = _tcstoui64(p, &pEnd, 10);
+	if (pEnd == p || *pEnd != ' ')
+		return false;
+	p = pEnd + 1;
+	ULONGLONG nLength = _tcstoui64(p, &pEnd, 10);
+	if (pEnd == p || *pEnd != ' ' || nLength == 0 || nLength > max_chunk_size)
+		return false;
+
+	str zDigest = pEnd + 1;
+	size_t len = zDigest.length();
+	while (len > 0 && (zDigest[len - 1] == '\n' || zDigest[len - 1] == '\r'))
+		len--;
+	zDigest = zDigest.substr(0, len);
+	if (len != DigestHexLength(g_option._digest_alg))
+		return false;
+	for (size_t i = 0; i < len; i++)
+	{
+		if (!IsHexDigit(zDigest[i]))
+			return false;
+	}
+
+	if (job.listed_chunks.empty())
+	{
+		if (nOffset != 0)
+			return false;
+		job.chunk_size = nLength;
+	}
+	else if (nOffset != job.listed_size || nOffset != job.listed_chunks.size() * job.chunk_size || nLength > job.chunk_size)
+		return false;
+
+	job.listed_chunks.push_back(zDigest);
+	job.listed_size = nOffset + nLength;
+	return true;
+}
+
+bool IsChunkChanged(digest_job_t& job, size_t i)
+{
+	return i >= job.chunks.size() || i >= job.listed_chunks.size() || job.chunks[i] != job.listed_chunks[i];
+}
+
+//--chunks: the byte ranges of the chunks that differ from the listed ones, adjacent chunks
+//merged; the chunks past the end of the shorter of the two sizes have changed too
+void ReportChangedRanges(digest_job_t& job)
+{
+	ULONGLONG nSize = job.size > job.listed_size ? job.size : job.listed_size;
+	size_t nChunks = job.chunks.size() > job.listed_chunks.size() ? job.chunks.size() : job.listed_chunks.size();
+	size_t i = 0;
+	while (i < nChunks)
+	{
+		if (!IsChunkChanged(job, i))
+		{
+			i++;
+			continue;
+		}
+
+		size_t nFirst = i;
+		while (i < nChunks && IsChunkChanged(job, i))
+			i++;
+		ULONGLONG nEnd = i * job.chunk_size < nSize ? i * job.chunk_size : nSize;
+		outs(0, g_option._status_only).format(_T("%s: changed bytes %llu-%llu"),
+			job.file.c_str(), nFirst * job.chunk_size, nEnd - 1);
+	}
+}
+
+//--physical-order: the position of the first byte of a file is the first logical cluster
+//reported by FSCTL_GET_RETRIEVAL_POINTERS, or the file index (the MFT record number on NTFS)
+//for files without clusters of their own, e.g. small files resident in the MFT. Files placed
+//by clusters come first on their volume, in cluster order, then the others in index order.
+const ULONGLONG position_by_file_index = 0x8000000000000000ULL;
+
+void QueryFilePlacement(digest_job_t& job)
+{
+	job.volume = ~0ULL; //unknown volumes go last, standard input among them
+	job.position = ~0ULL;
+
+	if (job.file == _T("-"))
+		return;
+
+	HANDLE hFile = CreateFile(job.file.c_str(), FILE_READ_ATTRIBUTES,
+		FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE, NULL, OPEN_EXISTING, 0, NULL);
+	if (hFile == INVALID_HANDLE_VALUE)
+		return;
+
+	BY_HANDLE_FILE_INFORMATION info;
+	if (GetFileInformationByHandle(hFile, &info))
+	{
+		job.volume = info.dwVolumeSerialNumber;
+		job.position = position_by_file_index | ((ULONGLONG)info.nFileIndexHigh << 32) | info.nFileIndexLow;
+	}
+
+	STARTING_VCN_INPUT_BUFFER vcn;
+	vcn.StartingVcn.QuadPart = 0;
+	RETRIEVAL_POINTERS_BUFFER extents; //room for the first extent only, enough for its position
+	DWORD dwBytes = 0;
+	if ((DeviceIoControl(hFile, FSCTL_GET_RETRIEVAL_POINTERS, &vcn, sizeof(vcn), &extents, sizeof(extents), &dwBytes, NULL)
+			|| GetLastError() == ERROR_MORE_DATA)
+		&& extents.ExtentCount > 0 && extents.Extents[0].Lcn.QuadPart >= 0)
+		job.position = (ULONGLONG)extents.Extents[0].Lcn.QuadPart;
+
+	CloseHandle(hFile);
+}
+
+//the volume of a file without --physical-order, from its path so the file isn't opened an extra
+//time: the serial number of the volume mounted at its volume path, looked up once per path
+class volume_cache
+{
+private:
+	std::map<str, ULONGLONG> _volumes; //by lower case volume path
+	CRITICAL_SECTION _lock;
+
+public:
+	volume_cache() { InitializeCriticalSection(&_lock); }
+	~volume_cache() { DeleteCriticalSection(&_lock); }
+
+	//~0 if unknown, standard input among them
+	ULONGLONG lookup(str& zFile)
+	{
+		TCHAR cVolumePath[MAX_PATH];
+		if (zFile == _T("-") || !GetVolumePathName(zFile.c_str(), cVolumePath, MAX_PATH))
+			return ~0ULL;
+		str zVolumePath = cVolumePath;
+		zVolumePath.to_lower();
+
+		EnterCriticalSection(&_lock);
+		std::map<str, ULONGLONG>::iterator it = _volumes.find(zVolumePath);
+		bool found = it != _volumes.end();
+		ULONGLONG nVolume = found ? it->second : ~0ULL;
+		LeaveCriticalSection(&_lock);
+		if (found)
+			return nVolume;
+
+		DWORD dwSerialNumber = 0;
+		if (GetVolumeInformation(cVolumePath, NULL, 0, &dwSerialNumber, NULL, NULL, NULL, 0))
+			nVolume = dwSerialNumber;
+		EnterCriticalSection(&_lock);
+		_volumes[zVolumePath] = nVolume;
+		LeaveCriticalSection(&_lock);
+		return nVolume;
+	}
+} g_volumes;
+
+//concurrent reads allowed on the volume holding the file: --device-jobs if given, otherwise
+//one for volumes whose disk reports a seek penalty (rotational media) and one per worker
+//thread for the others (solid state, network shares, unknown).
+DWORD QueryDeviceConcurrency(str& zIn_File)
+{
+	if (g_option._device_jobs != 0)
+		return g_option._device_jobs;
+
+	TCHAR cVolumePath[MAX_PATH];
+	TCHAR cVolumeName[MAX_PATH];
+	if (zIn_File == _T("-")
+		|| !GetVolumePathName(zIn_File.c_str(), cVolumePath, MAX_PATH)
+		|| !GetVolumeNameForVolumeMountPoint(cVolumePath, cVolumeName, MAX_PATH))
+		return g_pool.size();
+
+	//"\\?\Volume{GUID}\" names the root directory, the device is without the trailing '\'
+	size_t len = _tcslen(cVolumeName);
+	if (len > 0 && cVolumeName[len - 1] == '\\')
+		cVolumeName[len - 1] = '\0';
+
+	HANDLE hVolume = CreateFile(cVolumeName, 0, FILE_SHARE_READ | FILE_SHARE_WRITE, NULL, OPEN_EXISTING, 0, NULL);
+	if (hVolume == INVALID_HANDLE_VALUE)
+		return g_pool.size();
+
+	STORAGE_PROPERTY_QUERY query;
+	memset(&query, 0, sizeof(query));
+	query.PropertyId = StorageDeviceSeekPenaltyProperty;
+	query.QueryType = PropertyStandardQuery;
+
+	DEVICE_SEEK_PENALTY_DESCRIPTOR seek;
+	memset(&seek, 0, sizeof(seek));
+	DWORD dwBytes = 0;
+	bool bSeekPenalty = DeviceIoControl(hVolume, IOCTL_STORAGE_QUERY_PROPERTY, &query, sizeof(query),
+		&seek, sizeof(seek), &dwBytes, NULL) && dwBytes >= sizeof(seek) && seek.IncursSeekPenalty;
+
+	CloseHandle(hVolume);
+
+	return bSeekPenalty ? 1 : g_pool.size();
+}
+
+//--copy-to: the destination of a file is its name in the target directory, as with copy; a
+//file whose name was already taken in this run is not copied over the earlier one.
+CopySkip CopyDestination(str& zIn_File, str& zOut_Destination)
+{
+	if (zIn_File == _T("-"))
+		return COPY_STANDARD_INPUT;
+
+	str zPath, zName;
+	SplitFileName(zIn_File, zPath, zName);
+	zOut_Destination = g_option._copy_to;
+	if (zOut_Destination[zOut_Destination.length() - 1] != '\\' && zOut_Destination[zOut_Destination.length() - 1] != '/')
+		zOut_Destination += _T("\\");
+	zOut_Destination += zName;
+
+	str zKey = zOut_Destination;
+	zKey.to_lower();
+	return g_copy_destinations.insert(zKey).second ? COPY_NOT_SKIPPED : COPY_NAME_TAKEN;
+}
+
+//--verify-copy: reads the copy back past the file cache, with FILE_FLAG_NO_BUFFERING the
+//buffer must be sector aligned, which VirtualAlloc's page alignment is.
+bool ComputeReadBackDigest(str& zIn_File, str& zOut_Digest)
+{
+	HANDLE hFile = CreateFile(zIn_File.c_str(), GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING,
+		FILE_FLAG_NO_BUFFERING | FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+	if (hFile == INVALID_HANDLE_VALUE)
+		return false;
+
+	const DWORD max_buffer_size = 1024 * 1024;
+	BYTE* pbBuffer = (BYTE*)g_buffers.acquire(max_buffer_size);
+	digest_hasher* hasher = CreateDigestHasher(g_option._digest_alg);
+
+	bool bReadOk = (pbBuffer != NULL);
+	DWORD dwBytesRead = 0;
+	while (bReadOk)
+	{
+		bReadOk = ReadFile(hFile, pbBuffer, max_buffer_size, &dwBytesRead, NULL) != FALSE;
+		if (!bReadOk || dwBytesRead == 0)
+			break;
+		g_bandwidth.consume(dwBytesRead);
+		hasher->update(pbBuffer, dwBytesRead);
+	}
+
+	BYTE pbHash[64];
+	DWORD dwHashLen = hasher->finish(pbHash);
+	DigestToString(pbHash, dwHashLen, g_option._digest_alg, zOut_Digest);
+
+	delete hasher;
+	g_buffers.release(pbBuffer);
+	CloseHandle(hFile);
+
+	return bReadOk;
+}
+
+//false for a directory or a file that cannot be queried
+bool QueryFileStamp(str& zIn_File, ULONGLONG& nOut_Size, FILETIME& ftOut_LastWrite)
+{
+	WIN32_FILE_ATTRIBUTE_DATA fad;
+	if (!GetFileAttributesEx(zIn_File.c_str(), GetFileExInfoStandard, &fad)
+		|| (fad.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY))
+		return false;
+
+	nOut_Size = ((ULONGLONG)fad.nFileSizeHigh << 32) | fad.nFileSizeLow;
+	ftOut_LastWrite = fad.ftLastWriteTime;
+	return true;
+}
+
+//--daemon: the digests computed by earlier requests, looked up by algorithm, mode and full path
+//and valid as long as the size and the last write time of the file are unchanged.
+class digest_cache
+{
+public:
+	struct stamp_t
+	{
+		str key;
+		ULONGLONG size;
+		FILETIME last_write;
+		str digest;
+	};
+
+private:
+	std::map<str, stamp_t> _entries;
+	CRITICAL_SECTION _lock;
+
+	static const size_t max_entries = 100000;
+
+public:
+	digest_cache() { InitializeCriticalSection(&_lock); }
+	~digest_cache() { DeleteCriticalSection(&_lock); }
+
+	//true with job.computed set when the file is unchanged since it was stored, otherwise stamp
+	//receives the state of the file before it is read, so that a file written meanwhile is read again
+	bool lookup(digest_job_t& job, stamp_t& stamp)
+	{
+		TCHAR szFullPath[MAX_PATH];
+		DWORD dwLen = GetFullPathName(job.file.c_str(), MAX_PATH, szFullPath, NULL);
+		str zFullPath = szFullPath;
+		if (dwLen == 0 || dwLen >= MAX_PATH || !QueryFileStamp(zFullPath, stamp.size, stamp.last_write))
+			return false;
+
+		stamp.key.format(_T("%x%c%s"), (unsigned int)g_option._digest_alg, job.is_binary ? _T('*') : _T(' '), szFullPath);
+		stamp.key.to_lower();
+
+		bool bFound = false;
+		EnterCriticalSection(&_lock);
+		std::map<str, stamp_t>::iterator it = _entries.find(stamp.key);
+		if (it != _entries.end() && it->second.size == stamp.size
+			&& CompareFileTime(&it->second.last_write, &stamp.last_write) == 0)
+		{
+			job.computed = it->second.digest;
+			bFound = true;
+		}
+		LeaveCriticalSection(&_lock);
+		return bFound;
+	}
+
+	void store(stamp_t& stamp, str& zIn_Digest)
+	{
+		if (stamp.key.empty())
+			return;
+
+		EnterCriticalSection(&_lock);
+		if (_entries.size() >= max_entries)
+			_entries.clear();
+		stamp_t& entry = _entries[stamp.key];
+		entry = stamp;
+		entry.digest = zIn_Digest;
+		LeaveCriticalSection(&_lock);
+	}
+};
+
+digest_cache* g_cache = NULL; //set by --daemon
+
+void RunDigestJob(digest_job_t& job)
+{
+	if (g_cancel)
+		return;
+
+	FILE* fCopy = NULL;
+	if (!job.copy_to.empty() && job.copy_skip == COPY_NOT_SKIPPED && !job.copy_error)
+	{
+		//a text mode read is translated and would not give an identical copy
+		if (!job.is_binary)
+			job.copy_skip = COPY_TEXT_MODE;
+		else if (_tfopen_s(&fCopy, job.copy_to.c_str(), _T("wb")) != 0 || fCopy == NULL)
+			job.copy_error = true;
+	}
+
+	if (!job.copy_error)
+	{
+		//a copy needs the read, standard input cannot be read again
+		digest_cache::stamp_t stamp;
+		bool bCached = g_cache != NULL && fCopy == NULL && job.file != _T("-") && job.chunk_size == 0
+			&& job.quick == 0 && g_cache->lookup(job, stamp);
+
+		if (job.chunk_size != 0)
+			job.ok = ComputeChunkedDigest(job.file, job.chunk_size, job.is_binary, job.computed, job.chunks, job.size);
+		else if (job.quick != 0)
+			job.ok = ComputeQuickDigest(job.file, job.quick, job.computed);
+		else
+			job.ok = bCached || ComputeFileDigest(job.file, job.computed, g_option._digest_alg, job.is_binary, fCopy);
+		if (job.ok && !bCached && g_cache != NULL)
+			g_cache->store(stamp, job.computed);
+
+		if (fCopy != NULL)
+		{
+			if (ferror(fCopy))
+				job.copy_error = true;
+			//the copy is committed to disk before it is read back
+			if (job.ok && g_option._verify_copy && _commit(_fileno(fCopy)) != 0)
+				job.copy_error = true;
+			if (fclose(fCopy) != 0)
+				job.copy_error = true;
+
+			//a failed copy is not left behind, nor the copy of a file that did not match when checking
+			if (!job.ok || job.copy_error || (g_option._do_check && job.computed != job.digest))
+				_tremove(job.copy_to.c_str());
+		}
+
+		if (!job.ok && g_cancel)
+			return; //the read was cancelled, its result means nothing
+	}
+
+	job.done = true;
+	if (g_option._fail_fast
+		&& ((!job.ok && !g_option._ignore_missing) || job.copy_error || (job.ok && job.computed != job.digest)))
+		InterlockedExchange(&g_cancel, 1);
+}
+
+void ReportJobError(digest_job_t& job, bool suppress)
+{
+	if (job.copy_error)
+		errs(0, suppress).format(_T("%s: write error, the copy of %s failed"), job.copy_to.c_str(), job.file.c_str());
+	else
+		errs(0, suppress).format(_T("%s: open or read error"), job.file.c_str());
+}
+
+//--copy-to: the file was digested but not copied
+void ReportCopySkipped(digest_job_t& job, bool suppress)
+{
+	if (job.copy_skip == COPY_TEXT_MODE)
+		errs(0, suppress).format(_T("%s: not copied, a text mode read would not copy it as it is"), job.file.c_str());
+	else if (job.copy_skip == COPY_NAME_TAKEN)
+		errs(0, suppress).format(_T("%s: not copied, %s is the copy of an earlier file"), job.file.c_str(), job.copy_to.c_str());
+	else if (job.copy_skip == COPY_STANDARD_INPUT)
+		errs(0, suppress).format(_T("standard input: not copied, it has no name to copy it to"));
+}
+
+//digests the files of the jobs on the work pool, with a separate concurrency limit for each
+//volume so that a slow disk is not thrashed while a fast one is kept busy. With
+//--physical-order the files of a volume are read one at a time in the order of their position.
+void RunDigestJobs(std::vector<digest_job_t>& jobs)
+{
+	if (jobs.empty())
+		return;
+
+	struct QUERY_T
+	{
+		std::vector<digest_job_t>& jobs;
+		QUERY_T(std::vector<digest_job_t>& j) : jobs(j) {}
+		void operator()(size_t i)
+		{
+			if (g_option._physical_order)
+				QueryFilePlacement(jobs[i]);
+			else
+			{
+				jobs[i].volume = g_volumes.lookup(jobs[i].file);
+				jobs[i].position = 0;
+			}
+		}
+	} _query(jobs);
+	g_pool.run(jobs.size(), _query);
+
+	struct PLACEMENT_ORDER_T
+	{
+		std::vector<digest_job_t>& jobs;
+		PLACEMENT_ORDER_T(std::vector<digest_job_t>& j) : jobs(j) {}
+		bool operator()(size_t a, size_t b) const
+		{
+			if (jobs[a].volume != jobs[b].volume)
+				return jobs[a].volume < jobs[b].volume;
+			return jobs[a].position < jobs[b].position;
+		}
+	} _placement_order(jobs);
+
+	std::vector<size_t> order(jobs.size());
+	for (size_t i = 0; i < order.size(); i++)
+		order[i] = i;
+	std::stable_sort(order.begin(), order.end(), _placement_order);
+
+	struct device_queue_t
+	{
+		size_t first; //range of the volume's jobs in order
+		LONG count;
+		volatile LONG next;
+		DWORD limit;
+	};
+
+	//the limit of a volume is looked up once per run of the program, or of a --daemon; --device-jobs
+	//is not kept, a request of the daemon sets it or not for itself
+	static std::map<ULONGLONG, DWORD> device_limits;
+
+	std::vector<device_queue_t> devices;
+	DWORD nTuneWorkers = 0; //--auto-tune starts from the limit of the first volume
+	for (size_t i = 0; i < order.size(); i++)
+	{
+		digest_job_t& job = jobs[order[i]];
+		if (i == 0 || job.volume != jobs[order[i - 1]].volume)
+		{
+			device_queue_t device = { i, 0, 0, 1 };
+			if ((!g_option._physical_order || job.volume == ~0ULL)
+				&& (g_option._device_jobs != 0 || job.volume == ~0ULL))
+				device.limit = QueryDeviceConcurrency(job.file);
+			else if (!g_option._physical_order)
+			{
+				std::map<ULONGLONG, DWORD>::iterator it = device_limits.find(job.volume);
+				if (it == device_limits.end())
+					it = device_limits.insert(std::make_pair(job.volume, QueryDeviceConcurrency(job.file))).first;
+				device.limit = it->second;
+			}
+			if (nTuneWorkers == 0)
+				nTuneWorkers = device.limit;
+			//--auto-tune: every volume gets a slot for each worker, those beyond the tuned
+			//count are parked
+			if (g_option._auto_tune && !g_option._physical_order)
+				device.limit = g_pool.size();
+			devices.push_back(device);
+		}
+		devices.back().count++;
+	}
+
+	if (g_option._auto_tune)
+		g_tuner.begin(nTuneWorkers, FileReadSize(), g_option._physical_order ? 1 : g_pool.size());
+
+	//a slot is a worker bound to one volume; slots are interleaved across volumes so that each
+	//volume gets its first worker before any volume gets its second.
+	std::vector<size_t> slots;
+	std::vector<DWORD> ranks; //of the slot among those of its volume
+	for (DWORD k = 0; k < g_pool.size(); k++)
+	{
+		size_t nSlots = slots.size();
+		for (size_t d = 0; d < devices.size(); d++)
+		{
+			if (k < devices[d].limit && (LONG)k < devices[d].count)
+			{
+				slots.push_back(d);
+				ranks.push_back(k);
+			}
+		}
+		if (slots.size() == nSlots)
+			break;
+	}
+
+	struct SLOT_T
+	{
+		std::vector<digest_job_t>& jobs;
+		std::vector<size_t>& order;
+		std::vector<device_queue_t>& devices;
+		std::vector<size_t>& slots;
+		std::vector<DWORD>& ranks;
+		SLOT_T(std::vector<digest_job_t>& j, std::vector<size_t>& o, std::vector<device_queue_t>& d,
+			std::vector<size_t>& s, std::vector<DWORD>& r) : jobs(j), order(o), devices(d), slots(s), ranks(r) {}
+		void operator()(size_t i)
+		{
+			device_queue_t& device = devices[slots[i]];
+			LONG k;
+			for (;;)
+			{
+				//--auto-tune: a parked worker waits for the tuning to want it, or leaves
+				if (g_tuner.parked(ranks[i]))
+				{
+					if (!g_tuner.tuning() || device.next >= device.count || g_cancel)
+						break;
+					g_tuner.wait_unparked(ranks[i], device.next, device.count);
+					continue;
+				}
+				if ((k = InterlockedIncrement(&device.next) - 1) >= device.count)
+				{
+					if (g_option._auto_tune)
+						g_tuner.wake(); //the parked workers of the volume leave too
+					break;
+				}
+				RunDigestJob(jobs[order[device.first + k]]);
+			}
+		}
+	} _slot(jobs, order, devices, slots, ranks);
+	g_pool.run(slots.size(), _slot);
+
+	if (g_option._verify_copy)
+	{
+		//all copies are in the one target directory, the reads are limited like a volume's
+		struct VERIFY_T
+		{
+			std::vector<digest_job_t>& jobs;
+			volatile LONG next;
+			VERIFY_T(std::vector<digest_job_t>& j) : jobs(j), next(0) {}
+			void operator()(size_t)
+			{
+				LONG i;
+				while ((i = InterlockedIncrement(&next) - 1) < (LONG)jobs.size())
+				{
+					digest_job_t& job = jobs[i];
+					str zDigestReadBack;
+					if (job.done && job.ok && !job.copy_error && !job.copy_to.empty() && job.copy_skip == COPY_NOT_SKIPPED
+						&& (!g_option._do_check || job.computed == job.digest)
+						&& (!ComputeReadBackDigest(job.copy_to, zDigestReadBack) || zDigestReadBack != job.computed))
+					{
+						job.copy_error = true;
+						_tremove(job.copy_to.c_str());
+					}
+				}
+			}
+		} _verify(jobs);
+
+		size_t nVerifiers = QueryDeviceConcurrency(g_option._copy_to);
+		g_pool.run(nVerifiers < jobs.size() ? nVerifiers : jobs.size(), _verify);
+	}
+}
+
+void FormatDigestLine(str& zIn_FileComputed, str& zIn_DigestComputed, bool is_binary, bool bsd_tag, str& zOut_Line)
+{
+	if (bsd_tag)
+	{
+		//BSD style (doesn't support '--text' mode):
+		//MD5 (file) = 05b04f4921652d0bc7dbf0835ba89fe1
+		zOut_Line.format(_T("%s (%s) = %s"),
+			g_option._digest_alg_name.c_str(),
+			zIn_FileComputed.c_str(),
+			zIn_DigestComputed.c_str());
+	}
+	else
+	{
+		//GNU style:
+		//05b04f4921652d0bc7dbf0835ba89fe1 *file
+		//05b04f4921652d0bc7dbf0835ba89fe1  file
+		zOut_Line.format(_T("%s %c%s"),
+			zIn_DigestComputed.c_str(),
+			is_binary ? _T('*') : _T(' '),
+			zIn_FileComputed.c_str());
+	}
+}
+
+void FormatDigestLine(str& zIn_FileComputed, str& zIn_DigestComputed, str& zOut_Line)
+{
+	if (g_option._quick_samples != 0)
+		zOut_Line.format(_T("%s-QUICK%lu (%s) = %s"), g_option._digest_alg_name.c_str(), g_option._quick_samples,
+			zIn_FileComputed.c_str(), zIn_DigestComputed.c_str());
+	else
+		FormatDigestLine(zIn_FileComputed, zIn_DigestComputed, g_option._binary, g_option._bsd_tag, zOut_Line);
+}
+
+void PrintDigestLine(str& zIn_FileComputed, str& zIn_DigestComputed)
+{
+	str zLine;
+	FormatDigestLine(zIn_FileComputed, zIn_DigestComputed, zLine);
+	outs.set_delimiter(g_option._delim);
+	outs() << zLine;
+}
+
+//--index writes a binary manifest instead of the text lines, which -c and --convert read through
+//a file mapping. The names are sorted and prefix compressed, every index_restart_interval-th
+//name is stored in full so that a name is found by a binary search over those and a short
+//scan. The order section keeps the order of the lines, a manifest converted to an index and
+//back is the same text except for the case of the digests.
+const BYTE manifest_index_magic[8] = { 'D', 'C', 'T', 'I', 'D', 'X', '1', '\0' };
+const DWORD index_restart_interval = 16;
+const DWORD index_flag_bsd_tag = 1;
+const DWORD index_flag_stamps = 2;
+
+struct manifest_index_header_t
+{
+	BYTE magic[8];
+	DWORD alg;
+	DWORD digest_len; //bytes
+	DWORD char_size; //sizeof(TCHAR) of the names
+	DWORD flags;
+	ULONGLONG count;
+	ULONGLONG names_offset; //for each name: the length shared with the previous one, the length of the rest and the rest
+	ULONGLONG names_len;
+	ULONGLONG restarts_offset; //ULONGLONG offset into the names of every index_restart_interval-th name
+	ULONGLONG digests_offset; //digest_len bytes per name
+	ULONGLONG modes_offset; //'*' or ' ' per name
+	ULONGLONG order_offset; //DWORD per line, the name of the line
+	ULONGLONG stamps_offset; //with index_flag_stamps: ULONGLONG size and last write time per name
+};
+
+struct index_entry_t
+{
+	str name;
+	str digest;
+	bool is_binary;
+	bool has_stamp;
+	ULONGLONG size;
+	FILETIME last_write;
+	index_entry_t() : is_binary(true), has_stamp(false), size(0) { last_write.dwLowDateTime = last_write.dwHighDateTime = 0; }
+};
+
+//the digests of --diff are only compared with each other and those of an index are turned back
+//into text with BytesToHex, so the nibble order does not matter here
+void HexToBytes(str& zIn_Hex, std::vector<BYTE>& zOut_Bytes)
+{
+	for (size_t i = 0; i + 1 < zIn_Hex.length(); i += 2)
+	{
+		BYTE b = 0;
+		for (size_t k = i; k < i + 2; k++)
+		{
+			TCHAR c = zIn_Hex[k];
+			b <<= 4;
+			if (c >= '0' && c <= '9')
+				b |= (BYTE)(c - '0');
+			else if (c >= 'a' && c <= 'f')
+				b |= (BYTE)(c - 'a' + 10);
+			else
+				b |= (BYTE)(c - 'A' + 10);
+		}
+		zOut_Bytes.push_back(b);
+	}
+}
+
+void BytesToHex(const BYTE* pbBytes, size_t nBytes, str& zOut_Hex)
+{
+	static const TCHAR hex[] = _T("0123456789abcdef");
+	zOut_Hex = str(nBytes * 2, _T('0'));
+	for (size_t i = 0; i < nBytes; i++)
+	{
+		zOut_Hex[2 * i] = hex[pbBytes[i] >> 4];
+		zOut_Hex[2 * i + 1] = hex[pbBytes[i] & 0x0f];
+	}
+}
+
+void PutVarint(std::vector<BYTE>& buffer, ULONGLONG value)
+{
+	while (value >= 0x80)
+	{
+		buffer.push_back((BYTE)(value | 0x80));
+		value >>= 7;
+	}
+	buffer.push_back((BYTE)value);
+}
+
+bool GetVarint(const BYTE* pbData, ULONGLONG nLen, ULONGLONG& nPos, ULONGLONG& nOut_Value)
+{
+	nOut_Value = 0;
+	for (int shift = 0; shift < 64 && nPos < nLen; shift += 7)
+	{
+		BYTE b = pbData[nPos++];
+		nOut_Value |= (ULONGLONG)(b & 0x7f) << shift;
+		if (!(b & 0x80))
+			return true;
+	}
+	return false;
+}
+
+struct INDEX_ORDER_T
+{
+	std::vector<index_entry_t>& entries;
+	INDEX_ORDER_T(std::vector<index_entry_t>& e) : entries(e) {}
+	bool operator()(size_t a, size_t b) const
+	{
+		return entries[a].name.compare(entries[b].name) < 0;
+	}
+};
+
+//entries are in the order of the lines, the digests in hex
+bool WriteManifestIndex(str& zIn_Index, std::vector<index_entry_t>& entries, bool bsd_tag)
+{
+	std::vector<size_t> sorted(entries.size());
+	for (size_t i = 0; i < sorted.size(); i++)
+		sorted[i] = i;
+	std::stable_sort(sorted.begin(), sorted.end(), INDEX_ORDER_T(entries));
+
+	const size_t digest_len = DigestHexLength(g_option._digest_alg) / 2;
+	std::vector<BYTE> names, digests, modes, stamps;
+	std::vector<ULONGLONG> restarts;
+	std::vector<DWORD> order(entries.size());
+	bool has_stamps = false;
+	for (size_t k = 0; k < sorted.size(); k++)
+	{
+		index_entry_t& entry = entries[sorted[k]];
+		size_t nShared = 0;
+		if (k % index_restart_interval == 0)
+			restarts.push_back(names.size());
+		else
+		{
+			str& zPrevious = entries[sorted[k - 1]].name;
+			while (nShared < zPrevious.length() && nShared < entry.name.length() && zPrevious[nShared] == entry.name[nShared])
+				nShared++;
+		}
+		PutVarint(names, nShared);
+		PutVarint(names, entry.name.length() - nShared);
+		const BYTE* pbRest = (const BYTE*)(entry.name.c_str() + nShared);
+		names.insert(names.end(), pbRest, pbRest + (entry.name.length() - nShared) * sizeof(TCHAR));
+
+		size_t nDigests = digests.size();
+		HexToBytes(entry.digest, digests);
+		digests.resize(nDigests + digest_len);
+		modes.push_back(entry.is_binary ? '*' : ' ');
+
+		ULONGLONG stamp[2] = { entry.has_stamp ? entry.size : ~0ULL,
+			((ULONGLONG)entry.last_write.dwHighDateTime << 32) | entry.last_write.dwLowDateTime };
+		stamps.insert(stamps.end(), (const BYTE*)stamp, (const BYTE*)(stamp + 2));
+		has_stamps = has_stamps || entry.has_stamp;
+
+		order[sorted[k]] = (DWORD)k;
+	}
+
+	manifest_index_header_t header;
+	memset(&header, 0, sizeof(header));
+	memcpy(header.magic, manifest_index_magic, sizeof(header.magic));
+	header.alg = g_option._digest_alg;
+	header.digest_len = (DWORD)digest_len;
+	header.char_size = sizeof(TCHAR);
+	header.flags = (bsd_tag ? index_flag_bsd_tag : 0) | (has_stamps ? index_flag_stamps : 0);
+	header.count = entries.size();
+
+	//the sections follow the header in this order, each 8 byte aligned
+	const void* sections[6] = { names.empty() ? NULL : &names[0], restarts.empty() ? NULL : &restarts[0],
+		digests.empty() ? NULL : &digests[0], modes.empty() ? NULL : &modes[0], order.empty() ? NULL : &order[0],
+		stamps.empty() ? NULL : &stamps[0] };
+	ULONGLONG lengths[6] = { names.size(), restarts.size() * sizeof(ULONGLONG), digests.size(), modes.size(),
+		order.size() * sizeof(DWORD), has_stamps ? stamps.size() : 0 };
+	ULONGLONG* offsets[6] = { &header.names_offset, &header.restarts_offset, &header.digests_offset,
+		&header.modes_offset, &header.order_offset, &header.stamps_offset };
+	ULONGLONG nOffset = sizeof(header);
+	for (int i = 0; i < 6; i++)
+	{
+		*offsets[i] = nOffset;
+		nOffset = (nOffset + lengths[i] + 7) & ~7ULL;
+	}
+	header.names_len = names.size();
+
+	FILE* f = NULL;
+	if (_tfopen_s(&f, zIn_Index.c_str(), _T("wb")) != 0 || f == NULL)
+	{
+		errs().format(_T("%s: %s: cannot create file"), g_option._program_name.c_str(), zIn_Index.c_str());
+		return false;
+	}
+
+	static const BYTE padding[8] = { 0 };
+	bool bWriteOk = fwrite(&header, sizeof(header), 1, f) == 1;
+	for (int i = 0; bWriteOk && i < 6; i++)
+	{
+		if (lengths[i] > 0)
+			bWriteOk = fwrite(sections[i], 1, (size_t)lengths[i], f) == lengths[i];
+		if (bWriteOk && lengths[i] % 8 != 0)
+			bWriteOk = fwrite(padding, 1, (size_t)(8 - lengths[i] % 8), f) == 8 - lengths[i] % 8;
+	}
+	if (fclose(f) != 0 || !bWriteOk)
+	{
+		errs().format(_T("%s: %s: write error"), g_option._program_name.c_str(), zIn_Index.c_str());
+		return false;
+	}
+	return true;
+}
+
+class manifest_index
+{
+private:
+	HANDLE _hFile;
+	HANDLE _hMapping;
+	const BYTE* _base;
+	const manifest_index_header_t* _header;
+	ULONGLONG _nRestarts;
+
+	bool section_ok(ULONGLONG offset, ULONGLONG len, ULONGLONG size) const
+	{
+		return offset <= size && len <= size - offset;
+	}
+
+	const ULONGLONG* restarts() const { return (const ULONGLONG*)(_base + _header->restarts_offset); }
+
+	//decodes the name after the one in zName, at nPos in the names
+	bool next_name(ULONGLONG& nPos, str& zName) const
+	{
+		const BYTE* pbNames = _base + _header->names_offset;
+		ULONGLONG nShared, nRest;
+		if (!GetVarint(pbNames, _header->names_len, nPos, nShared) || !GetVarint(pbNames, _header->names_len, nPos, nRest)
+			|| nShared > zName.length() || nRest > (_header->names_len - nPos) / sizeof(TCHAR))
+			return false;
+
+		zName = str(zName.c_str(), (size_t)nShared);
+		zName += str((const TCHAR*)(pbNames + nPos), (size_t)nRest);
+		nPos += nRest * sizeof(TCHAR);
+		return true;
+	}
+
+public:
+	manifest_index() : _hFile(INVALID_HANDLE_VALUE), _hMapping(NULL), _base(NULL), _header(NULL), _nRestarts(0) {}
+	~manifest_index()
+	{
+		if (_base != NULL)
+			UnmapViewOfFile(_base);
+		if (_hMapping != NULL)
+			CloseHandle(_hMapping);
+		if (_hFile != INVALID_HANDLE_VALUE)
+			CloseHandle(_hFile);
+	}
+
+	//false if the file cannot be mapped or is not a valid index of this build
+	bool open(str& zIn_Index)
+	{
+		_hFile = CreateFile(zIn_Index.c_str(), GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_FLAG_RANDOM_ACCESS, NULL);
+		LARGE_INTEGER size;
+		if (_hFile == INVALID_HANDLE_VALUE || !GetFileSizeEx(_hFile, &size) || (ULONGLONG)size.QuadPart < sizeof(manifest_index_header_t))
+			return false;
+
+		_hMapping = CreateFileMapping(_hFile, NULL, PAGE_READONLY, 0, 0, NULL);
+		if (_hMapping == NULL || (_base = (const BYTE*)MapViewOfFile(_hMapping, FILE_MAP_READ, 0, 0, 0)) == NULL)
+			return false;
+
+		_header = (const manifest_index_header_t*)_base;
+		_nRestarts = (_header->count + index_restart_interval - 1) / index_restart_interval;
+		ULONGLONG nSize = (ULONGLONG)size.QuadPart;
+		ULONGLONG nCount = _header->count;
+		if (memcmp(_header->magic, manifest_index_magic, sizeof(_header->magic)) != 0
+			|| _header->char_size != sizeof(TCHAR) || nCount > 0xffffffffULL
+			|| _header->digest_len == 0 || _header->digest_len != DigestHexLength((AlgHash)_header->alg) / 2
+			|| !section_ok(_header->names_offset, _header->names_len, nSize)
+			|| !section_ok(_header->restarts_offset, _nRestarts * sizeof(ULONGLONG), nSize)
+			|| !section_ok(_header->digests_offset, nCount * _header->digest_len, nSize)
+			|| !section_ok(_header->modes_offset, nCount, nSize)
+			|| !section_ok(_header->order_offset, nCount * sizeof(DWORD), nSize)
+			|| ((_header->flags & index_flag_stamps) && !section_ok(_header->stamps_offset, nCount * 2 * sizeof(ULONGLONG), nSize))
+			|| _header->restarts_offset % sizeof(ULONGLONG) != 0 || _header->order_offset % sizeof(DWORD) != 0
+			|| _header->stamps_offset % sizeof(ULONGLONG) != 0)
+			return false;
+
+		const DWORD* order = (const DWORD*)(_base + _header->order_offset);
+		for (ULONGLONG i = 0; i < nCount; i++)
+		{
+			if (order[i] >= nCount)
+				return false;
+		}
+		for (ULONGLONG r = 0; r < _nRestarts; r++)
+		{
+			if (restarts()[r] >= _header->names_len)
+				return false;
+		}
+		return true;
+	}
+
+	size_t size() const { return (size_t)_header->count; }
+	AlgHash alg() const { return (AlgHash)_header->alg; }
+	bool bsd_tag() const { return (_header->flags & index_flag_bsd_tag) != 0; }
+
+	//the name of line n
+	size_t line(size_t n) const { return ((const DWORD*)(_base + _header->order_offset))[n]; }
+
+	bool name(size_t i, str& zOut_Name) const
+	{
+		ULONGLONG nPos = restarts()[i / index_restart_interval];
+		zOut_Name = _T("");
+		for (size_t k = i - i % index_restart_interval; k <= i; k++)
+		{
+			if (!next_name(nPos, zOut_Name))
+				return false;
+		}
+		return true;
+	}
+
+	void digest(size_t i, str& zOut_Digest) const
+	{
+		BytesToHex(_base + _header->digests_offset + (ULONGLONG)i * _header->digest_len, _header->digest_len, zOut_Digest);
+	}
+
+	bool is_binary(size_t i) const { return _base[_header->modes_offset + i] == '*'; }
+
+	bool stamp(size_t i, ULONGLONG& nOut_Size, FILETIME& ftOut_LastWrite) const
+	{
+		if (!(_header->flags & index_flag_stamps))
+			return false;
+		const ULONGLONG* stamp = (const ULONGLONG*)(_base + _header->stamps_offset) + 2 * (ULONGLONG)i;
+		if (stamp[0] == ~0ULL)
+			return false;
+		nOut_Size = stamp[0];
+		ftOut_LastWrite.dwLowDateTime = (DWORD)stamp[1];
+		ftOut_LastWrite.dwHighDateTime = (DWORD)(stamp[1] >> 32);
+		return true;
+	}
+
+	struct cursor_t
+	{
+		size_t index; //size() past the last name
+		ULONGLONG pos; //of the next name
+		str name;
+	};
+
+	//c at the first name not less than zIn_Name: a binary search for the last full name before
+	//it, then a scan of at most a block, or more with duplicate names
+	bool seek(str& zIn_Name, cursor_t& c) const
+	{
+		ULONGLONG lo = 0, hi = _nRestarts;
+		while (lo < hi)
+		{
+			ULONGLONG mid = lo + (hi - lo) / 2;
+			ULONGLONG nPos = restarts()[mid];
+			str zName;
+			if (!next_name(nPos, zName))
+				return false;
+			if (zName.compare(zIn_Name) < 0)
+				lo = mid + 1;
+			else
+				hi = mid;
+		}
+
+		c.index = (size_t)(lo == 0 ? 0 : (lo - 1) * index_restart_interval);
+		c.name = _T("");
+		if (c.index >= size())
+		{
+			c.index = size();
+			return true;
+		}
+		c.pos = restarts()[c.index / index_restart_interval];
+		if (!next_name(c.pos, c.name))
+			return false;
+		while (c.index < size() && c.name.compare(zIn_Name) < 0)
+		{
+			if (!next(c))
+				return false;
+		}
+		return true;
+	}
+
+	bool next(cursor_t& c) const
+	{
+		if (++c.index >= size())
+		{
+			c.index = size();
+			return true;
+		}
+		return next_name(c.pos, c.name);
+	}
+
+	//the first name equal to zIn_Name
+	bool find(str& zIn_Name, size_t& nOut_Index) const
+	{
+		cursor_t c;
+		if (!seek(zIn_Name, c) || c.index == size() || c.name != zIn_Name)
+			return false;
+		nOut_Index = c.index;
+		return true;
+	}
+};
+
+bool IsManifestIndex(str& zIn_File)
+{
+	FILE* f = NULL;
+	BYTE magic[sizeof(manifest_index_magic)];
+	if (_tfopen_s(&f, zIn_File.c_str(), _T("rb")) != 0 || f == NULL)
+		return false;
+	bool bIndex = fread(magic, 1, sizeof(magic), f) == sizeof(magic) && memcmp(magic, manifest_index_magic, sizeof(magic)) == 0;
+	fclose(f);
+	return bIndex;
+}
+
+bool WriteJobsIndex(std::vector<digest_job_t>& jobs)
+{
+	std::vector<index_entry_t> entries;
+	for (size_t i = 0; i < jobs.size(); i++)
+	{
+		if (!jobs[i].ok || jobs[i].copy_error)
+			continue;
+
+		index_entry_t entry;
+		entry.name = jobs[i].file;
+		entry.digest = jobs[i].computed;
+		entry.is_binary = jobs[i].is_binary;
+		entry.has_stamp = jobs[i].file != _T("-") && !g_option._tar && QueryFileStamp(jobs[i].file, entry.size, entry.last_write);
+		entries.push_back(entry);
+	}
+	return WriteManifestIndex(g_option._sum_file, entries, g_option._bsd_tag);
+}
+
+//--tar: an archive is a sequence of 512-byte headers, each followed by the data of its member
+//padded to a whole block, and ends with zero blocks. The archive is read once, front to back,
+//so it may come from a pipe; the data of a member is digested straight out of the read buffer.
+const size_t tar_block_size = 512;
+const size_t tar_buffer_size = 1024 * 1024;
+
+struct tar_member_t
+{
+	str name;
+	ULONGLONG size;
+	char type;
+	bool is_regular() const { return type == '0' || type == '\0' || type == '7'; }
+};
+
+class tar_reader
+{
+private:
+	FILE* _f;
+	BYTE* _buffer;
+	size_t _pos;
+	size_t _len;
+	bool _invalid;
+
+	//the next buffered bytes, at most nMax of them; false at the end of the archive
+	bool span(ULONGLONG nMax, const BYTE*& pbData, size_t& nBytes)
+	{
+		if (_pos == _len)
+		{
+			if (_buffer == NULL)
+				return false;
+			_pos = 0;
+			_len = fread(_buffer, 1, LimitedReadSize(tar_buffer_size), _f);
+			g_bandwidth.consume(_len);
+			if (_len == 0)
+				return false;
+		}
+		nBytes = (ULONGLONG)(_len - _pos) < nMax ? _len - _pos : (size_t)nMax;
+		pbData = _buffer + _pos;
+		_pos += nBytes;
+		return true;
+	}
+
+	//hasher and data, if given, receive the bytes read
+	bool read(ULONGLONG nBytes, digest_hasher* hasher, std::vector<BYTE>* data)
+	{
+		while (nBytes > 0 && !g_cancel)
+		{
+			const BYTE* pbData;
+			size_t n;
+			if (!span(nBytes, pbData, n))
+				return false;
+			if (hasher != NULL)
+				hasher->update(pbData, n);
+			if (data != NULL)
+				data->insert(data->end(), pbData, pbData + n);
+			nBytes -= n;
+		}
+		return nBytes == 0;
+	}
+
+	static ULONGLONG padding(ULONGLONG nSize)
+	{
+		return (tar_block_size - nSize % tar_block_size) % tar_block_size;
+	}
+
+	//octal, space or NUL terminated, or base-256 when the high bit of the first byte is set
+	static bool number(const BYTE* pbField, size_t nLen, ULONGLONG& nOut_Value)
+	{
+		nOut_Value = 0;
+		if (pbField[0] & 0x80)
+		{
+			for (size_t i = 0; i < nLen; i++)
+				nOut_Value = (nOut_Value << 8) | (i == 0 ? (pbField[0] & 0x7f) : pbField[i]);
+			return true;
+		}
+
+		size_t i = 0;
+		while (i < nLen && pbField[i] == ' ')
+			i++;
+		size_t nDigits = 0;
+		for (; i < nLen && pbField[i] >= '0' && pbField[i] <= '7'; i++, nDigits++)
+			nOut_Value = (nOut_Value << 3) | (pbField[i] - '0');
+		return nDigits > 0 && (i == nLen || pbField[i] == ' ' || pbField[i] == '\0');
+	}
+
+	static str name(const BYTE* pbName, size_t nMax)
+	{
+		size_t n = 0;
+		while (n < nMax && pbName[n] != '\0')
+			n++;
+#ifdef UNICODE
+		//names are UTF-8 in pax headers and in the archives of current tools
+		int nChars = MultiByteToWideChar(CP_UTF8, 0, (const char*)pbName, (int)n, NULL, 0);
+		std::vector<WCHAR> wide(nChars + 1);
+		MultiByteToWideChar(CP_UTF8, 0, (const char*)pbName, (int)n, &wide[0], nChars);
+		return str(&wide[0], (size_t)nChars);
+#else
+		return str((const char*)pbName, n);
+#endif
+	}
+
+	//the "path" record of a pax extended header, each record is "LENGTH KEY=VALUE\n"
+	static bool pax_path(std::vector<BYTE>& records, str& zOut_Path)
+	{
+		size_t pos = 0;
+		while (pos < records.size())
+		{
+			size_t nLen = 0;
+			size_t i = pos;
+			for (; i < records.size() && records[i] >= '0' && records[i] <= '9'; i++)
+				nLen = nLen * 10 + (records[i] - '0');
+			if (i == pos || i >= records.size() || records[i] != ' ' || nLen <= i - pos || pos + nLen > records.size())
+				return false;
+
+			const BYTE* pbKey = &records[i + 1];
+			size_t nRecord = pos + nLen - (i + 1) - 1; //without the newline
+			if (nRecord > 5 && memcmp(pbKey, "path=", 5) == 0)
+				zOut_Path = name(pbKey + 5, nRecord - 5);
+			pos += nLen;
+		}
+		return true;
+	}
+
+public:
+	tar_reader(FILE* f) : _f(f), _pos(0), _len(0), _invalid(false) { _buffer = (BYTE*)g_buffers.acquire(tar_buffer_size); }
+	~tar_reader() { g_buffers.release(_buffer); }
+
+	//not a tar archive, or a truncated one
+	bool invalid() const { return _invalid; }
+
+	//the header of the next member, false at the end of the archive or on an error. A GNU
+	//long name or a pax path that comes before the header replaces the name in the header.
+	bool next(tar_member_t& member)
+	{
+		str zLongName;
+		while (!g_cancel)
+		{
+			std::vector<BYTE> header;
+			header.reserve(tar_block_size);
+			if (!read(tar_block_size, NULL, &header))
+			{
+				_invalid = !header.empty() && !g_cancel;
+				return false;
+			}
+
+			const BYTE* h = &header[0];
+			if (h[0] == '\0')
+				return false; //a zero block ends the archive
+
+			ULONGLONG nChecksum, nSize;
+			DWORD nSum = 0;
+			for (size_t i = 0; i < tar_block_size; i++)
+				nSum += (i >= 148 && i < 156) ? ' ' : h[i];
+			if (!number(h + 148, 8, nChecksum) || nChecksum != nSum || !number(h + 124, 12, nSize))
+			{
+				_invalid = true;
+				return false;
+			}
+
+			member.type = (char)h[156];
+			member.size = nSize;
+			if (member.type == 'L' || member.type == 'x')
+			{
+				std::vector<BYTE> data;
+				if (!read(nSize, NULL, &data) || !read(padding(nSize), NULL, NULL)
+					|| (member.type == 'x' && !pax_path(data, zLongName)))
+				{
+					_invalid = !g_cancel;
+					return false;
+				}
+				if (member.type == 'L')
+					zLongName = name(data.empty() ? NULL : &data[0], data.size());
+				continue;
+			}
+
+			if (!zLongName.empty())
+				member.name = zLongName;
+			else if (memcmp(h + 257, "ustar", 5) == 0 && h[345] != '\0')
+				member.name = name(h + 345, 155) + _T("/") + name(h, 100); //ustar prefix
+			else
+				member.name = name(h, 100);
+			return true;
+		}
+		return false;
+	}
+
+	//the data of the member just read by next(), digested if hasher is given
+	bool data(tar_member_t& member, digest_hasher* hasher)
+	{
+		if (!read(member.size, hasher, NULL) || !read(padding(member.size), NULL, NULL))
+		{
+			_invalid = !g_cancel && !ferror(_f);
+			return false;
+		}
+		return true;
+	}
+};
+
+//--tar: digests the regular members of the archive. Without bListed every member is appended
+//to the jobs; with it only the members named by the jobs are digested, the last of several
+//members of one name wins as it would when extracting, and jobs of no member fail.
+bool ReadTarArchive(str& zIn_Archive, std::vector<digest_job_t>& jobs, bool bListed)
+{
+	FILE* f = NULL;
+	if (zIn_Archive == _T("-"))
+	{
+		f = stdin;
+		_setmode(_fileno(stdin), _O_BINARY);
+	}
+	else if (_tfopen_s(&f, zIn_Archive.c_str(), _T("rb")) != 0 || f == NULL)
+	{
+		errs().format(_T("%s: %s: no such file or directory"), g_option._program_name.c_str(), zIn_Archive.c_str());
+		if (bListed)
+			jobs.clear(); //nothing was verified
+		return false;
+	}
+
+	std::multimap<str, size_t> listed;
+	if (bListed)
+	{
+		for (size_t i = 0; i < jobs.size(); i++)
+			listed.insert(std::make_pair(jobs[i].file, i));
+	}
+
+	const size_t max_hash_data_bytes = 64;
+	BYTE pbHash[max_hash_data_bytes];
+	tar_reader reader(f);
+	tar_member_t member;
+	while (!g_cancel && reader.next(member))
+	{
+		std::pair<std::multimap<str, size_t>::iterator, std::multimap<str, size_t>::iterator> range
+			= listed.equal_range(member.name);
+		if (!member.is_regular() || (bListed && range.first == range.second))
+		{
+			if (!reader.data(member, NULL))
+				break;
+			continue;
+		}
+
+		digest_hasher* hasher = CreateDigestHasher(g_option._digest_alg);
+		bool bReadOk = reader.data(member, hasher);
+		str zDigest;
+		DigestToString(pbHash, hasher->finish(pbHash), g_option._digest_alg, zDigest);
+		delete hasher;
+		if (!bReadOk)
+			break;
+
+		if (!bListed)
+		{
+			digest_job_t job;
+			job.file = member.name;
+			job.computed = zDigest;
+			job.ok = job.done = true;
+			jobs.push_back(job);
+			continue;
+		}
+
+		for (std::multimap<str, size_t>::iterator it = range.first; it != range.second; ++it)
+		{
+			digest_job_t& job = jobs[it->second];
+			job.computed = zDigest;
+			job.ok = job.done = true;
+			if (g_option._fail_fast && job.computed != job.digest)
+				InterlockedExchange(&g_cancel, 1);
+		}
+	}
+
+	bool bReadOk = !ferror(f) && !reader.invalid();
+	if (ferror(f))
+		errs().format(_T("%s: read error"), zIn_Archive.c_str());
+	else if (reader.invalid())
+		errs().format(_T("%s: not a valid tar archive"), zIn_Archive.c_str());
+	if (f != stdin)
+		fclose(f);
+
+	//the members missing from the archive are read errors, unless the read was cancelled
+	for (size_t i = 0; bListed && !g_cancel && i < jobs.size(); i++)
+		jobs[i].done = true;
+	return bReadOk && !g_cancel;
+}
+
+bool DigestFiles(std::vector<str>& files)
+{
+	std::vector<digest_job_t> jobs;
+	bool status = true;
+	if (g_option._tar)
+	{
+		//the regular members of the archives take the place of the files
+		for (size_t i = 0; i < files.size() && !g_cancel; i++)
+		{
+			if (!ReadTarArchive(files[i], jobs, false))
+				status = false;
+		}
+	}
+	else
+	{
+		for (size_t i = 0; i < files.size(); i++)
+		{
+			if (!InShard(files[i].c_str(), files[i].length()))
+				continue;
+			digest_job_t job;
+			job.file = files[i];
+			job.is_binary = g_option._binary;
+			job.chunk_size = g_option._chunk_size;
+			job.quick = g_option._quick_samples;
+			if (!g_option._copy_to.empty())
+				job.copy_skip = CopyDestination(job.file, job.copy_to);
+			jobs.push_back(job);
+		}
+		RunDigestJobs(jobs);
+	}
+
+	for (size_t i = 0; i < jobs.size(); i++)
+	{
+		if (jobs[i].ok && !jobs[i].copy_error)
+		{
+			if (!g_option._index)
+				PrintDigestLine(jobs[i].file, jobs[i].computed);
+			PrintChunkLines(jobs[i]);
+			if (jobs[i].copy_skip != COPY_NOT_SKIPPED)
+			{
+				ReportCopySkipped(jobs[i], false);
+				status = false;
+			}
+		}
+		else
+		{
+			ReportJobError(jobs[i], false);
+			status = false;
+		}
+	}
+
+	if (g_option._index && !WriteJobsIndex(jobs))
+		status = false;
+	return status;
+}
+
+//--files-from: the paths are read by a thread of their own into a bounded queue, the main thread
+//takes what is there, at least one path, and digests it as a batch. The first file is digested
+//as soon as its path is read, and neither the list nor the lines printed are held in memory.
+const size_t path_queue_size = 4096;
+const size_t path_read_size = 64 * 1024;
+
+struct path_queue_t
+{
+	FILE* f;
+	TCHAR delimiter;
+	CRITICAL_SECTION lock;
+	CONDITION_VARIABLE changed; //a path was queued or taken, or the list ended
+	std::deque<str> paths;
+	bool bounded; //false when the list is read by the main thread, nobody would make room
+	bool end;
+	bool error;
+};
+
+void QueuePath(path_queue_t& queue, std::string& path)
+{
+	if (!path.empty() && path[path.length() - 1] == '\r' && queue.delimiter == '\n')
+		path.erase(path.length() - 1);
+	if (path.empty())
+		return;
+
+#ifdef UNICODE
+	int nChars = MultiByteToWideChar(CP_ACP, 0, path.c_str(), (int)path.length(), NULL, 0);
+	std::vector<WCHAR> wide(nChars + 1);
+	MultiByteToWideChar(CP_ACP, 0, path.c_str(), (int)path.length(), &wide[0], nChars);
+	str zPath(&wide[0], (size_t)nChars);
+#else
+	str zPath(path.c_str(), path.length());
+#endif
+
+	EnterCriticalSection(&queue.lock);
+	while (queue.bounded && queue.paths.size() >= path_queue_size && !g_cancel)
+		SleepConditionVariableCS(&queue.changed, &queue.lock, INFINITE);
+	queue.paths.push_back(zPath);
+	WakeAllConditionVariable(&queue.changed);
+	LeaveCriticalSection(&queue.lock);
+	path.clear();
+}
+
+DWORD WINAPI ReadPathsProc(LPVOID param)
+{
+	path_queue_t& queue = *(path_queue_t*)param;
+	std::vector<char> buffer(path_read_size);
+	std::string path;
+	size_t nBytesRead;
+	while (!g_cancel && (nBytesRead = fread(&buffer[0], 1, buffer.size(), queue.f)) > 0)
+	{
+		const char* p = &buffer[0];
+		const char* pEnd = p + nBytesRead;
+		while (p < pEnd)
+		{
+			const char* pDelimiter = (const char*)memchr(p, (char)queue.delimiter, pEnd - p);
+			if (pDelimiter == NULL)
+			{
+				path.append(p, pEnd);
+				break;
+			}
+			path.append(p, pDelimiter);
+			QueuePath(queue, path);
+			p = pDelimiter + 1;
+		}
+	}
+	QueuePath(queue, path); //the last path may have no delimiter
+
+	EnterCriticalSection(&queue.lock);
+	queue.error = ferror(queue.f) != 0;
+	queue.end = true;
+	WakeAllConditionVariable(&queue.changed);
+	LeaveCriticalSection(&queue.lock);
+	return 0;
+}
+
+//--benchmark: each FILE is digested by each provider, after a first read that brings it into
+//the file cache, and the speeds are printed; the providers must agree on the digest
+bool BenchmarkProviders(std::vector<str>& files)
+{
+	bool status = true;
+	HashProvider saved = g_option._provider;
+	LARGE_INTEGER frequency;
+	QueryPerformanceFrequency(&frequency);
+	for (size_t i = 0; i < files.size() && !g_cancel; i++)
+	{
+		ULONGLONG nSize;
+		FILETIME ftLastWrite;
+		str zFirst, zDigest;
+		g_option._provider = NATIVE_PROVIDER;
+		if (!QueryFileStamp(files[i], nSize, ftLastWrite) || !ComputeFileDigest(files[i], zFirst, g_option._digest_alg, true))
+		{
+			errs().format(_T("%s: open or read error"), files[i].c_str());
+			status = false;
+			continue;
+		}
+
+		for (int k = 0; k < PROVIDER_COUNT; k++)
+		{
+			hash_provider* provider = GetProvider((HashProvider)k);
+			if (provider == NULL || !provider->open(g_option._digest_alg))
+			{
+				outs().format(_T("%-10s %12s  %s"), provider_names[k], _T("unavailable"), files[i].c_str());
+				continue;
+			}
+
+			g_option._provider = (HashProvider)k;
+			LARGE_INTEGER start, end;
+			QueryPerformanceCounter(&start);
+			bool bReadOk = ComputeFileDigest(files[i], zDigest, g_option._digest_alg, true);
+			QueryPerformanceCounter(&end);
+			if (!bReadOk)
+			{
+				errs().format(_T("%s: open or read error"), files[i].c_str());
+				status = false;
+				break;
+			}
+			if (zDigest != zFirst)
+			{
+				errs().format(_T("%s: %s: computed a different digest"), files[i].c_str(), provider_names[k]);
+				status = false;
+			}
+
+			double dSeconds = (double)(end.QuadPart - start.QuadPart) / frequency.QuadPart;
+			outs().format(_T("%-10s %7.1f MB/s  %s"), provider_names[k],
+				dSeconds > 0 ? nSize / dSeconds / (1024 * 1024) : 0.0, files[i].c_str());
+		}
+	}
+	g_option._provider = saved;
+	return status;
+}
+
+//--bench-providers: how fast each provider hashes each algorithm here, in MB/s. A buffer in memory
+//is hashed again and again for bench_time_ms at least, so only the hashing is measured; the
+//digests of every provider must agree with the native ones.
+const size_t bench_buffer_size = 16 * 1024 * 1024;
+const double bench_time_ms = 250;
+
+bool BenchAllProviders()
+{
+	static const struct
+	{
+		AlgHash alg_id;
+		const TCHAR* name;
+	} algs[] = {
+		{ MD5, _T("MD5") },
+		{ SHA1, _T("SHA1") },
+		{ SHA256, _T("SHA256") },
+		{ SHA384, _T("SHA384") },
+		{ SHA512, _T("SHA512") },
+		{ XXH3_128, _T("XXH128") },
+		{ CRC32C, _T("CRC32C") },
+		{ BLAKE3, _T("BLAKE3") },
+		{ UNKNOWN_ALG, NULL } };
+
+	std::vector<BYTE> buffer(bench_buffer_size);
+	uint32_t seed = 0x9E3779B9U;
+	for (size_t i = 0; i < buffer.size(); i++)
+	{
+		seed = seed * 1664525U + 1013904223U;
+		buffer[i] = (BYTE)(seed >> 24);
+	}
+
+	str zLine, zCell;
+	zLine = _T("MB/s    ");
+	for (int k = 0; k < PROVIDER_COUNT; k++)
+		zLine += zCell.format(_T("%12s"), provider_names[k]);
+	outs() << zLine;
+
+	bool status = true;
+	LARGE_INTEGER frequency;
+	QueryPerformanceFrequency(&frequency);
+	for (size_t a = 0; algs[a].name != NULL && !g_cancel; a++)
+	{
+		const size_t max_hash_data_bytes = 64;
+		BYTE pbNative[max_hash_data_bytes];
+		DWORD dwNativeLen = 0;
+		zLine.format(_T("%-8s"), algs[a].name);
+		for (int k = 0; k < PROVIDER_COUNT && !g_cancel; k++)
+		{
+			hash_provider* provider = GetProvider((HashProvider)k);
+			if (provider == NULL || !provider->open(algs[a].alg_id))
+			{
+				zLine += zCell.format(_T("%12s"), _T("-"));
+				continue;
+			}
+
+			ULONGLONG nBytes = 0;
+			double dMs = 0;
+			LARGE_INTEGER start, end;
+			QueryPerformanceCounter(&start);
+			do {
+				BYTE pbHash[max_hash_data_bytes];
+				digest_hasher* hasher = provider->create(algs[a].alg_id);
+				hasher->update(&buffer[0], buffer.size());
+				DWORD dwHashLen = hasher->finish(pbHash);
+				delete hasher;
+				nBytes += buffer.size();
+
+				if (k == NATIVE_PROVIDER && dwNativeLen == 0)
+				{
+					memcpy(pbNative, pbHash, dwHashLen);
+					dwNativeLen = dwHashLen;
+				}
+				else if (nBytes == buffer.size() && (dwHashLen != dwNativeLen || memcmp(pbHash, pbNative, dwHashLen) != 0))
+				{
+					errs().format(_T("%s: %s: the %s provider computed a different digest"),
+						g_option._program_name.c_str(), algs[a].name, provider_names[k]);
+					status = false;
+				}
+
+				QueryPerformanceCounter(&end);
+				dMs = (double)(end.QuadPart - start.QuadPart) * 1000 / frequency.QuadPart;
+			} while (dMs < bench_time_ms && !g_cancel);
+
+			zLine += zCell.format(_T("%12.1f"), dMs > 0 ? nBytes / (dMs / 1000) / (1024 * 1024) : 0.0);
+		}
+		outs() << zLine;
+		outs.print();
+		outs.clear();
+	}
+	return status;
+}
+
+bool DigestFilesFrom(str& zIn_List)
+{
+	path_queue_t queue;
+	queue.f = NULL;
+	queue.delimiter = g_option._files_from_null ? '\0' : '\n';
+	queue.bounded = true;
+	queue.end = false;
+	queue.error = false;
+
+	if (zIn_List == _T("-"))
+	{
+		queue.f = stdin;
+		_setmode(_fileno(stdin), _O_BINARY);
+	}
+	else if (_tfopen_s(&queue.f, zIn_List.c_str(), _T("rb")) != 0 || queue.f == NULL)
+	{
+		errs().format(_T("%s: %s: no such file or directory"), g_option._program_name.c_str(), zIn_List.c_str());
+		return false;
+	}
+
+	InitializeCriticalSection(&queue.lock);
+	InitializeConditionVariable(&queue.changed);
+	HANDLE hReader = CreateThread(NULL, 0, ReadPathsProc, &queue, 0, NULL);
+	if (hReader == NULL)
+	{
+		queue.bounded = false;
+		ReadPathsProc(&queue); //reads the whole list first
+	}
+
+	bool status = true;
+	std::vector<str> batch;
+	while (!g_cancel)
+	{
+		EnterCriticalSection(&queue.lock);
+		while (queue.paths.empty() && !queue.end)
+			SleepConditionVariableCS(&queue.changed, &queue.lock, INFINITE);
+		batch.assign(queue.paths.begin(), queue.paths.end());
+		queue.paths.clear();
+		WakeAllConditionVariable(&queue.changed);
+		LeaveCriticalSection(&queue.lock);
+
+		if (batch.empty())
+			break;
+
+		if (!DigestFiles(batch))
+			status = false;
+		outs.print();
+		outs.clear();
+		errs.print();
+		errs.clear();
+	}
+
+	EnterCriticalSection(&queue.lock);
+	WakeAllConditionVariable(&queue.changed); //a reader waiting for room sees the cancel
+	LeaveCriticalSection(&queue.lock);
+	if (hReader != NULL)
+	{
+		WaitForSingleObject(hReader, INFINITE);
+		CloseHandle(hReader);
+	}
+	DeleteCriticalSection(&queue.lock);
+
+	if (queue.error)
+	{
+		errs().format(_T("%s: read error"), zIn_List == _T("-") ? _T("standard input") : zIn_List.c_str());
+		status = false;
+	}
+	if (queue.f != stdin)
+		fclose(queue.f);
+	return status;
+}
+
+//--per-line: a digest for every record of the FILEs, the bytes up to a newline (a NUL with
+//--zero). The input is read in large blocks, the delimiters of a block are found 16 bytes at a
+//time and its records digested on the work pool. MD5 and BLAKE3 hash 4 records at once, one per
+//SIMD lane (fasthash.h), the other algorithms one record after another.
+const size_t record_block_size = 8 * 1024 * 1024;
+const size_t records_per_part = 1024; //records a worker digests at a time
+const size_t record_digest_stride = 64; //room for the longest digest, SHA512
+
+void DigestRecords(const BYTE* const* records, const size_t* lens, size_t count, BYTE* pbOut)
+{
+#ifdef FASTHASH_X86
+	if (g_option._provider == NATIVE_PROVIDER && g_option._digest_alg == MD5)
+	{
+		hash_records<md5_x4>(records, lens, count, pbOut, record_digest_stride);
+		return;
+	}
+	if (g_option._provider == NATIVE_PROVIDER && g_option._digest_alg == BLAKE3)
+	{
+		hash_records<blake3_x4>(records, lens, count, pbOut, record_digest_stride);
+		return;
+	}
+#endif
+
+	if (!IsBuiltinAlg(g_option._digest_alg) && g_option._provider == NATIVE_PROVIDER)
+	{
+		cryptoapi_hasher hasher(g_option._digest_alg);
+		for (size_t i = 0; i < count; i++)
+		{
+			hasher.reset();
+			hasher.update(records[i], lens[i]);
+			hasher.finish(pbOut + i * record_digest_stride);
+		}
+		return;
+	}
+
+	for (size_t i = 0; i < count; i++)
+	{
+		digest_hasher* hasher = CreateDigestHasher(g_option._digest_alg);
+		hasher->update(records[i], lens[i]);
+		hasher->finish(pbOut + i * record_digest_stride);
+		delete hasher;
+	}
+}
+
+//the digests of a block as one message, a line each; with --zero a message per digest, ended
+//by a NUL, which a message cannot contain
+void PrintRecordDigests(const std::vector<BYTE>& digests, size_t count)
+{
+	const DWORD dwHashLen = (DWORD)DigestHexLength(g_option._digest_alg) / 2;
+	str zLines, zDigest;
+	if (g_option._delim.empty())
+	{
+		outs.set_delimiter(str(1, _T('\0')));
+		for (size_t i = 0; i < count; i++)
+		{
+			DigestToString(&digests[i * record_digest_stride], dwHashLen, g_option._digest_alg, zDigest);
+			outs() << zDigest;
+		}
+	}
+	else
+	{
+		zLines.reserve(count * (2 * dwHashLen + 1));
+		for (size_t i = 0; i < count; i++)
+		{
+			DigestToString(&digests[i * record_digest_stride], dwHashLen, g_option._digest_alg, zDigest);
+			if (i > 0)
+				zLines += _T("\n");
+			zLines += zDigest;
+		}
+		outs.set_delimiter(_T("\n"));
+		outs() << zLines;
+	}
+	outs.print();
+	outs.clear();
+}
+
+bool DigestFileRecords(str& zIn_File)
+{
+	bool is_binary_mode = g_option._binary;
+	FILE* f = NULL;
+	if (zIn_File == _T("-"))
+	{
+		f = stdin;
+		_setmode(_fileno(stdin), is_binary_mode ? _O_BINARY : _O_TEXT);
+	}
+	else
+		_tfopen_s(&f, zIn_File.c_str(), is_binary_mode ? _T("rb") : _T("r"));
+
+	if (f == NULL)
+	{
+		errs().format(_T("%s: %s: no such file or directory"), g_option._program_name.c_str(), zIn_File.c_str());
+		return false;
+	}
+
+	size_t nBufferSize = record_block_size;
+	BYTE* pbBuffer = (BYTE*)g_buffers.acquire(nBufferSize);
+
+	struct RECORDS_T
+	{
+		const std::vector<const BYTE*>& records;
+		const std::vector<size_t>& lens;
+		std::vector<BYTE>& digests;
+		RECORDS_T(const std::vector<const BYTE*>& r, const std::vector<size_t>& l, std::vector<BYTE>& d)
+			: records(r), lens(l), digests(d) {}
+
+		void operator()(size_t nPart)
+		{
+			size_t first = nPart * records_per_part;
+			size_t count = records.size() - first < records_per_part ? records.size() - first : records_per_part;
+			DigestRecords(&records[first], &lens[first], count, &digests[first * record_digest_stride]);
+		}
+	};
+
+	const BYTE delimiter = g_option._delim.empty() ? '\0' : '\n';
+	std::vector<size_t> ends;
+	std::vector<const BYTE*> records;
+	std::vector<size_t> lens;
+	std::vector<BYTE> digests;
+	RECORDS_T _records(records, lens, digests);
+
+	bool bReadOk = (pbBuffer != NULL);
+	bool bEnd = false;
+	size_t nCarry = 0; //the start of a record not ended in the previous block
+	while (bReadOk && !bEnd && !g_cancel)
+	{
+		//a record longer than the buffer, the buffer is released before a larger one is taken
+		//so a --max-memory of less than both doesn't wait on itself
+		if (nCarry == nBufferSize)
+		{
+			std::vector<BYTE> carry(pbBuffer, pbBuffer + nCarry);
+			g_buffers.release(pbBuffer);
+			nBufferSize *= 2;
+			pbBuffer = (BYTE*)g_buffers.acquire(nBufferSize);
+			if (pbBuffer == NULL)
+			{
+				bReadOk = false;
+				break;
+			}
+			memcpy(pbBuffer, &carry[0], nCarry);
+		}
+
+		size_t nWanted = LimitedReadSize(nBufferSize - nCarry);
+		size_t nBytesRead = fread(pbBuffer + nCarry, 1, nWanted, f);
+		g_bandwidth.consume(nBytesRead);
+		bEnd = (nBytesRead < nWanted);
+		size_t nBytes = nCarry + nBytesRead;
+
+		ends.clear();
+		find_delimiters(pbBuffer + nCarry, nBytesRead, delimiter, nCarry, ends);
+		records.clear();
+		lens.clear();
+		size_t nStart = 0;
+		for (size_t i = 0; i < ends.size(); i++)
+		{
+			records.push_back(pbBuffer + nStart);
+			lens.push_back(ends[i] - nStart);
+			nStart = ends[i] + 1;
+		}
+		if (bEnd && nStart < nBytes) //the last record may have no delimiter
+		{
+			records.push_back(pbBuffer + nStart);
+			lens.push_back(nBytes - nStart);
+			nStart = nBytes;
+		}
+
+		if (!records.empty())
+		{
+			digests.resize(records.size() * record_digest_stride);
+			g_pool.run((records.size() + records_per_part - 1) / records_per_part, _records);
+			PrintRecordDigests(digests, records.size());
+		}
+
+		nCarry = nBytes - nStart;
+		memmove(pbBuffer, pbBuffer + nStart, nCarry);
+	}
+
+	if (ferror(f))
+		bReadOk = false;
+	if (!bReadOk)
+		errs().format(_T("%s: %s: read error"), g_option._program_name.c_str(), zIn_File.c_str());
+
+	g_buffers.release(pbBuffer);
+	if (f != stdin)
+		fclose(f);
+	return bReadOk;
+}
+
+bool QueryFileSize(str& zIn_File, ULONGLONG& nOut_Size)
+{
+	WIN32_FILE_ATTRIBUTE_DATA a;
+	if (!GetFileAttributesEx(zIn_File.c_str(), GetFileExInfoStandard, &a))
+		return false;
+
+	nOut_Size = ((ULONGLONG)a.nFileSizeHigh << 32) | a.nFileSizeLow;
+	return true;
+}
+
+//--find-duplicates reads only what it has to: files are grouped by size first, files of a
+//shared size by a digest of their first and last blocks, and only files still colliding
+//after that are digested in full.
+const size_t dup_edge_block_size = 64 * 1024;
+
+struct dup_entry_t
+{
+	str file;
+	size_t order; //position on the command line, groups are printed in this order
+	ULONGLONG size;
+	str digest; //edge digest, or the full digest once complete is set
+	bool complete;
+	bool ok;
+	dup_entry_t() : order(0), size(0), complete(false), ok(true) {}
+};
+
+//xxh3 of the first and last blocks; files up to two blocks long are digested in full with
+//the program's algorithm right away since that costs the same read.
+bool ComputeEdgeDigest(dup_entry_t& entry)
+{
+	if (entry.size <= 2 * dup_edge_block_size)
+	{
+		entry.complete = true;
+		return ComputeFileDigest(entry.file, entry.digest, g_option._digest_alg, true);
+	}
+
+	FILE* f = NULL;
+	_tfopen_s(&f, entry.file.c_str(), _T("rb"));
+	if (f == NULL)
+		return false;
+
+	BYTE *pbBuffer = (BYTE*)g_buffers.acquire(dup_edge_block_size);
+	if (pbBuffer == NULL)
+	{
+		fclose(f);
+		return false;
+	}
+	BYTE pbHash[16];
+	xxh3_128_hasher hasher;
+
+	bool bReadOk = (fread(pbBuffer, 1, dup_edge_block_size, f) == dup_edge_block_size);
+	hasher.update(pbBuffer, dup_edge_block_size);
+	g_bandwidth.consume(dup_edge_block_size);
+
+	if (bReadOk && _fseeki64(f, (LONGLONG)(entry.size - dup_edge_block_size), SEEK_SET) == 0)
+	{
+		bReadOk = (fread(pbBuffer, 1, dup_edge_block_size, f) == dup_edge_block_size);
+		hasher.update(pbBuffer, dup_edge_block_size);
+		g_bandwidth.consume(dup_edge_block_size);
+	}
+	else
+		bReadOk = false;
+
+	fclose(f);
+
+	DWORD dwHashLen = hasher.finish(pbHash);
+	DigestToString(pbHash, dwHashLen, XXH3_128, entry.digest);
+
+	g_buffers.release(pbBuffer);
+
+	return bReadOk;
+}
+
+//keeps the entries sharing their size (and digest if by_digest) with at least one other entry,
+//sorted so that the members of a group are adjacent.
+void KeepCollidingEntries(std::vector<dup_entry_t*>& entries, bool by_digest)
+{
+	struct LESS_T
+	{
+		bool by_digest;
+		LESS_T(bool b) : by_digest(b) {}
+		bool operator()(const dup_entry_t* a, const dup_entry_t* b) const
+		{
+			if (a->size != b->size)
+				return a->size < b->size;
+			if (by_digest && a->digest != b->digest)
+				return a->digest < b->digest;
+			return a->order < b->order;
+		}
+	} _less(by_digest);
+
+	std::sort(entries.begin(), entries.end(), _less);
+
+	std::vector<dup_entry_t*> colliding;
+	size_t i = 0;
+	while (i < entries.size())
+	{
+		size_t j = i + 1;
+		while (j < entries.size() && entries[j]->size == entries[i]->size
+			&& (!by_digest || entries[j]->digest == entries[i]->digest))
+			j++;
+
+		if (j - i > 1)
+			colliding.insert(colliding.end(), entries.begin() + i, entries.begin() + j);
+		i = j;
+	}
+	entries.swap(colliding);
+}
+
+bool FindDuplicates(std::vector<str>& files)
+{
+	bool status = true;
+
+	std::vector<dup_entry_t> all;
+	std::set<str> seen; //a file given twice is not a duplicate of itself
+	for (size_t i = 0; i < files.size(); i++)
+	{
+		if (files[i] == _T("-"))
+		{
+			errs().format(_T("%s: standard input is ignored by --find-duplicates"),
+				g_option._program_name.c_str());
+			continue;
+		}
+
+		str zKey = files[i];
+		zKey.to_lower();
+		if (!seen.insert(zKey).second)
+			continue;
+
+		dup_entry_t entry;
+		entry.file = files[i];
+		entry.order = all.size();
+		if (!QueryFileSize(entry.file, entry.size))
+		{
+			errs().format(_T("%s: open or read error"), entry.file.c_str());
+			status = false;
+			continue;
+		}
+		all.push_back(entry);
+	}
+
+	std::vector<dup_entry_t*> entries;
+	for (size_t i = 0; i < all.size(); i++)
+		entries.push_back(&all[i]);
+
+	struct DIGEST_T
+	{
+		std::vector<dup_entry_t*>& entries;
+		bool full;
+		DIGEST_T(std::vector<dup_entry_t*>& e, bool f) : entries(e), full(f) {}
+		void operator()(size_t i)
+		{
+			dup_entry_t& entry = *entries[i];
+			if (!full)
+				entry.ok = ComputeEdgeDigest(entry);
+			else if (!entry.complete)
+			{
+				entry.complete = true;
+				entry.ok = ComputeFileDigest(entry.file, entry.digest, g_option._digest_alg, true);
+			}
+		}
+	};
+
+	for (int stage = 0; stage < 2; stage++)
+	{
+		//stage 0: size, then the first and last blocks; stage 1: full contents
+		KeepCollidingEntries(entries, stage != 0);
+
+		DIGEST_T _digest(entries, stage != 0);
+		g_pool.run(entries.size(), _digest);
+
+		std::vector<dup_entry_t*> readable;
+		for (size_t i = 0; i < entries.size(); i++)
+		{
+			if (entries[i]->ok)
+				readable.push_back(entries[i]);
+			else
+			{
+				errs().format(_T("%s: open or read error"), entries[i]->file.c_str());
+				status = false;
+			}
+		}
+		entries.swap(readable);
+	}
+	KeepCollidingEntries(entries, true);
+
+	//print the groups in the order their first files were given
+	std::vector<std::pair<size_t, size_t> > groups; //(order of the first file, index in entries)
+	for (size_t i = 0; i < entries.size(); i++)
+	{
+		if (i == 0 || entries[i]->size != entries[i - 1]->size || entries[i]->digest != entries[i - 1]->digest)
+			groups.push_back(std::make_pair(entries[i]->order, i));
+	}
+	std::sort(groups.begin(), groups.end());
+
+	for (size_t g = 0; g < groups.size(); g++)
+	{
+		if (g != 0)
+			outs() << _T(""); //empty line between groups
+
+		size_t i = groups[g].second;
+		do {
+			PrintDigestLine(entries[i]->file, entries[i]->digest);
+			i++;
+		} while (i < entries.size() && entries[i]->size == entries[i - 1]->size && entries[i]->digest == entries[i - 1]->digest);
+	}
+
+	return status;
+}
+struct check_counters_t
+{
+	DWORD nMismatchedChecksums;
+	DWORD nOpenOrReadFailures;
+	DWORD nCopyFailures; //--copy-to
+	bool bMatchedChecksums;
+	check_counters_t() : nMismatchedChecksums(0), nOpenOrReadFailures(0), nCopyFailures(0), bMatchedChecksums(false) {}
+};
+
+//listed files are digested in batches, the results are reported in the order of the checksum
+//file. --physical-order can only reorder within a batch, so its batches are larger; with --tar
+//the archive is read once for all the lines.
+const size_t check_batch_size = 64;
+const size_t physical_order_batch_size = 4096;
+
+size_t CheckBatchSize()
+{
+	if (g_option._tar)
+		return ~(size_t)0;
+	return g_option._physical_order ? physical_order_batch_size : check_batch_size;
+}
+
+//--escalate: the files whose quick digest changed are read whole, their checksum lines are what
+//the full manifest needs to be brought up to date
+void EscalateChangedFiles(std::vector<digest_job_t>& jobs)
+{
+	std::vector<digest_job_t> changed;
+	for (size_t i = 0; i < jobs.size(); i++)
+	{
+		if (!jobs[i].done || !jobs[i].ok || jobs[i].computed == jobs[i].digest)
+			continue;
+		digest_job_t job;
+		job.file = jobs[i].file;
+		changed.push_back(job);
+	}
+	RunDigestJobs(changed);
+
+	str zLine;
+	for (size_t i = 0; i < changed.size(); i++)
+	{
+		//counted already as FAILED
+		if (!changed[i].ok)
+		{
+			ReportJobError(changed[i], g_option._status_only);
+			continue;
+		}
+		FormatDigestLine(changed[i].file, changed[i].computed, true, false, zLine);
+		_ftprintf(g_escalate, _T("%s%s"), zLine.c_str(), g_option._delim.c_str());
+	}
+}
+
+void RunCheckBatch(std::vector<digest_job_t>& jobs, check_counters_t& counters)
+{
+	if (g_option._tar)
+		ReadTarArchive(g_option._tar_file, jobs, true);
+	else
+		RunDigestJobs(jobs);
+
+	for (size_t i = 0; i < jobs.size(); i++)
+	{
+		digest_job_t& job = jobs[i];
+		if (!job.done)
+			continue;
+
+		if (!job.ok || job.copy_error)
+		{
+			if (job.copy_error)
+				++counters.nCopyFailures;
+			else
+				++counters.nOpenOrReadFailures;
+			ReportJobError(job, g_option._status_only || (g_option._ignore_missing && !job.copy_error));
+			if (g_option._fail_fast && (!g_option._ignore_missing || job.copy_error))
+				break;
+		}
+		else
+		{
+			bool bMatched = (job.computed == job.digest);
+			if (!bMatched)
+				++counters.nMismatchedChecksums;
+			else
+				counters.bMatchedChecksums = true;
+
+			outs(0, g_option._status_only || (bMatched && g_option._quiet)).format(_T("%s: %s"),
+				job.file.c_str(), bMatched ? _T("OK") : _T("FAILED"));
+			if (!bMatched && !job.listed_chunks.empty())
+				ReportChangedRanges(job);
+			if (job.copy_skip != COPY_NOT_SKIPPED)
+			{
+				++counters.nCopyFailures;
+				ReportCopySkipped(job, g_option._status_only);
+			}
+			if (g_option._fail_fast && !bMatched)
+				break;
+		}
+	}
+
+	if (g_escalate != NULL)
+		EscalateChangedFiles(jobs);
+	jobs.clear();
+}
+
+bool ReportCheckResult(str& zIn_FileContainsDigestInfo, bool bProperlyFormattedLines,
+	DWORD nMisformattedLines, DWORD nImproperlyFormattedLines, check_counters_t& counters)
+{
+	if (!bProperlyFormattedLines)
+	{
+		//Warn if no tests are found.
+		errs(1).format(_T("%s: no well-formatted %s checksum lines found"),
+			zIn_FileContainsDigestInfo.c_str(), g_option._digest_alg_name.c_str());
+	}
+	else
+	{
+		if (!g_option._status_only)
+		{
+			errs(1, (nMisformattedLines == 0)).format(_T("WARNING: %lu: line(s) is ill-formatted"),
+				nMisformattedLines);
+
+			errs(1, (counters.nOpenOrReadFailures == 0)).format(_T("WARNING: %lu: listed file(s) could not be read"),
+				counters.nOpenOrReadFailures);
+
+			errs(1, (counters.nCopyFailures == 0)).format(_T("WARNING: %lu: listed file(s) could not be copied"),
+				counters.nCopyFailures);
+
+			errs(1, (counters.nMismatchedChecksums == 0)).format(_T("WARNING: %lu: computed checksum(s) did NOT match"),
+				counters.nMismatchedChecksums);
+
+			errs(1, g_option._ignore_missing || counters.bMatchedChecksums).format(_T("%s: no file was verified"),
+				zIn_FileContainsDigestInfo.c_str());
+		}
+	}
+
+	return (bProperlyFormattedLines
+		&& counters.bMatchedChecksums
+		&& counters.nMismatchedChecksums == 0
+		&& counters.nOpenOrReadFailures == 0
+		&& counters.nCopyFailures == 0
+		&& (!g_option._strict || nImproperlyFormattedLines == 0));
+}
+
+//--shard: a shard that verified nothing and found nothing wrong is not a failure by itself, the
+//checksum file as a whole is judged by --merge-results
+bool IsShardIdle(DWORD nMisformattedLines, check_counters_t& counters)
+{
+	return nMisformattedLines == 0 && !counters.bMatchedChecksums
+		&& counters.nMismatchedChecksums == 0 && counters.nOpenOrReadFailures == 0 && counters.nCopyFailures == 0;
+}
+
+//--shard: the counts of a checksum file in the shard, for --merge-results. The line is printed
+//even with --status, it is what the result file of a shard is for.
+void PrintShardRecord(str& zIn_FileContainsDigestInfo, bool bProperlyFormattedLines,
+	DWORD nMisformattedLines, DWORD nImproperlyFormattedLines, check_counters_t& counters)
+{
+	outs().format(_T("#shard %lu/%lu well-formed=%d ill-formatted=%lu improper=%lu unreadable=%lu uncopied=%lu failed=%lu matched=%d %s"),
+		g_option._shard_index, g_option._shard_count, bProperlyFormattedLines ? 1 : 0, nMisformattedLines,
+		nImproperlyFormattedLines, counters.nOpenOrReadFailures, counters.nCopyFailures, counters.nMismatchedChecksums,
+		counters.bMatchedChecksums ? 1 : 0, zIn_FileContainsDigestInfo.c_str());
+}
+
+//--only and --only-from: a path selects the entry of that name and the entries below it, the
+//names are compared as they are written in the checksum file
+struct path_selection_t
+{
+	std::map<str, bool> paths; //whether the path selected an entry
+
+	static bool is_separator(TCHAR c) { return c == '\\' || c == '/'; }
+
+	void add(str& zIn_Path)
+	{
+		str zPath = zIn_Path;
+		while (zPath.length() > 1 && is_separator(zPath[zPath.length() - 1]))
+			zPath = zPath.substr(0, zPath.length() - 1);
+		paths.insert(std::make_pair(zPath, false));
+	}
+
+	//tries the name and each directory above it
+	bool match(const TCHAR* pName, size_t nLen)
+	{
+		for (size_t k = nLen; k > 0; k--)
+		{
+			if (k < nLen && !is_separator(pName[k]))
+				continue;
+			std::map<str, bool>::iterator it = paths.find(str(pName, k));
+			if (it != paths.end())
+			{
+				it->second = true;
+				return true;
+			}
+		}
+		return false;
+	}
+} g_only;
+
+bool LoadOnlyPaths(str& zIn_List)
+{
+	FILE* f = NULL;
+	if (zIn_List == _T("-"))
+		f = stdin;
+	else if (_tfopen_s(&f, zIn_List.c_str(), _T("r")) != 0 || f == NULL)
+	{
+		errs().format(_T("%s: %s: no such file or directory"), g_option._program_name.c_str(), zIn_List.c_str());
+		return false;
+	}
+
+	const int max_line_length = 1024;
+	TCHAR cLine[max_line_length];
+	while (_fgetts(cLine, max_line_length, f) != NULL)
+	{
+		str zPath = cLine;
+		size_t len = zPath.length();
+		while (len > 0 && (zPath[len - 1] == '\n' || zPath[len - 1] == '\r'))
+			len--;
+		zPath = zPath.substr(0, len);
+		if (!zPath.empty())
+			g_only.add(zPath);
+	}
+
+	bool bReadOk = !ferror(f);
+	if (f != stdin)
+		fclose(f);
+	if (!bReadOk)
+		errs().format(_T("%s: %s: read error"), g_option._program_name.c_str(), zIn_List.c_str());
+	return bReadOk;
+}
+
+bool ReportUnmatchedPaths()
+{
+	bool bAllMatched = true;
+	for (std::map<str, bool>::iterator it = g_only.paths.begin(); it != g_only.paths.end(); ++it)
+	{
+		if (it->second)
+			continue;
+		errs(1, g_option._status_only).format(_T("%s: not listed in the checksum files"), it->first.c_str());
+		bAllMatched = false;
+	}
+	return bAllMatched;
+}
+
+//the name of a checksum line of this program's algorithm without parsing the line, false
+//if it has none; the selected lines are parsed by ParseLine as usual
+bool FindLineName(const TCHAR* cLine, const TCHAR*& pName, size_t& nLen)
+{
+	size_t len = _tcslen(cLine);
+	while (len > 0 && (cLine[len - 1] == '\n' || cLine[len - 1] == '\r'))
+		len--;
+
+	size_t nHex = DigestHexLength(g_option._digest_alg);
+	size_t nTag = g_option._digest_alg_name.length();
+	if (g_option._quick_samples == 0 && len > nHex + 2 && cLine[nHex] == ' ' && (cLine[nHex + 1] == ' ' || cLine[nHex + 1] == '*'))
+	{
+		//GNU style: 05b04f4921652d0bc7dbf0835ba89fe1 *file
+		pName = cLine + nHex + 2;
+		nLen = len - nHex - 2;
+		return true;
+	}
+
+	DWORD nSamples;
+	if (g_option._quick_samples != 0)
+		nTag = QuickLabelLength(cLine, nSamples);
+	else if (_tcsncmp(cLine, g_option._digest_alg_name.c_str(), nTag) != 0)
+		nTag = 0;
+	if (nTag != 0 && len > nTag + 2 + 4 + nHex
+		&& cLine[nTag] == ' ' && cLine[nTag + 1] == '(' && _tcsncmp(cLine + len - nHex - 4, _T(") = "), 4) == 0)
+	{
+		//BSD style: MD5 (file) = 05b04f4921652d0bc7dbf0835ba89fe1
+		//--quick: MD5-QUICK16 (file) = 05b04f4921652d0bc7dbf0835ba89fe1
+		pName = cLine + nTag + 2;
+		nLen = len - nHex - 4 - nTag - 2;
+		return true;
+	}
+	return false;
+}
+
+//--only on an index: each path is looked up and the names below it follow it in the sorted names
+bool SelectIndexEntries(manifest_index& index, std::set<size_t>& selected)
+{
+	for (std::map<str, bool>::iterator it = g_only.paths.begin(); it != g_only.paths.end(); ++it)
+	{
+		str zPath = it->first;
+		manifest_index::cursor_t c;
+		if (!index.seek(zPath, c))
+			return false;
+		while (c.index < index.size() && c.name.compare(0, zPath.length(), zPath) == 0)
+		{
+			if (c.name.length() == zPath.length() || path_selection_t::is_separator(c.name[zPath.length()]))
+			{
+				selected.insert(c.index);
+				it->second = true;
+			}
+			if (!index.next(c))
+				return false;
+		}
+	}
+	return true;
+}
+
+//the end of the check of a checksum file: the #shard line, then the summary
+bool FinishCheck(str& zIn_FileContainsDigestInfo, bool bProperlyFormattedLines,
+	DWORD nMisformattedLines, DWORD nImproperlyFormattedLines, check_counters_t& counters)
+{
+	if (g_option._shard_count != 0)
+	{
+		PrintShardRecord(zIn_FileContainsDigestInfo, bProperlyFormattedLines, nMisformattedLines,
+			nImproperlyFormattedLines, counters);
+		if (IsShardIdle(nMisformattedLines, counters))
+			return true;
+	}
+
+	//--only: a checksum file without selected lines is not a failure by itself
+	if (!g_only.paths.empty() && !bProperlyFormattedLines && nMisformattedLines == 0)
+		return true;
+
+	return ReportCheckResult(zIn_FileContainsDigestInfo, bProperlyFormattedLines,
+		nMisformattedLines, nImproperlyFormattedLines, counters);
+}
+
+//--journal: one line per checksum file with the counts of the lines done so far, rewritten
+//after a batch has been reported but at most once per journal_period_ms. A batch cut short
+//by --fail-fast is not written down, --resume checks it again. With --only, the paths that
+//selected a line so far follow, the lines --resume passes over are not matched again.
+const DWORD journal_period_ms = 1000;
+
+struct journal_entry_t
+{
+	str file; //as given on the command line
+	ULONGLONG size; //with the last write time, the checksum file the counts are of
+	FILETIME last_write;
+	bool done;
+	DWORD lines; //the lines read, or the entries of an index
+	bool bProperlyFormattedLines;
+	DWORD nMisformattedLines;
+	DWORD nImproperlyFormattedLines;
+	check_counters_t counters;
+	journal_entry_t() : size(0), done(false), lines(0), bProperlyFormattedLines(false),
+		nMisformattedLines(0), nImproperlyFormattedLines(0)
+	{
+		last_write.dwLowDateTime = last_write.dwHighDateTime = 0;
+	}
+};
+
+class check_journal
+{
+	std::vector<journal_entry_t> _entries;
+	DWORD _last_save;
+	bool _failed;
+
+	//a journal is resumed by the same algorithm and shard only
+	static str header()
+	{
+		str zHeader;
+		zHeader.format(_T("#journal %s %lu/%lu"), g_option._digest_alg_name.c_str(),
+			g_option._shard_index, g_option._shard_count);
+		return zHeader;
+	}
+
+	//and with the same --only selection, a digest of its sorted paths
+	static str selection()
+	{
+		if (g_only.paths.empty())
+			return str();
+
+		digest_hasher* hasher = CreateDigestHasher(g_option._digest_alg);
+		for (std::map<str, bool>::iterator it = g_only.paths.begin(); it != g_only.paths.end(); ++it)
+			hasher->update((const BYTE*)it->first.c_str(), (it->first.length() + 1) * sizeof(TCHAR));
+		const size_t max_hash_data_bytes = 64;
+		BYTE pbHash[max_hash_data_bytes];
+		str zSelection, zDigest;
+		DigestToString(pbHash, hasher->finish(pbHash), g_option._digest_alg, zDigest);
+		delete hasher;
+		zSelection.format(_T(" only=%s"), zDigest.c_str());
+		return zSelection;
+	}
+
+	static bool parse(const TCHAR* cLine, journal_entry_t& entry)
+	{
+		int nDone = 0, nWellFormed = 0, nMatched = 0, nNameStart = 0;
+		unsigned long nLines = 0, nMisformatted = 0, nImproper = 0, nUnreadable = 0, nUncopied = 0, nFailed = 0;
+		unsigned long nTimeHigh = 0, nTimeLow = 0;
+		ULONGLONG nSize = 0;
+		if (_stscanf_s(cLine, _T("done=%d lines=%lu well-formed=%d ill-formatted=%lu improper=%lu unreadable=%lu uncopied=%lu failed=%lu matched=%d size=%llu time=%lx:%lx %n"),
+			&nDone, &nLines, &nWellFormed, &nMisformatted, &nImproper, &nUnreadable, &nUncopied, &nFailed, &nMatched,
+			&nSize, &nTimeHigh, &nTimeLow, &nNameStart) != 12 || nNameStart == 0)
+			return false;
+
+		entry.file = cLine + nNameStart;
+		size_t len = entry.file.length();
+		while (len > 0 && (entry.file[len - 1] == '\n' || entry.file[len - 1] == '\r'))
+			len--;
+		entry.file = entry.file.substr(0, len);
+		entry.size = nSize;
+		entry.last_write.dwHighDateTime = nTimeHigh;
+		entry.last_write.dwLowDateTime = nTimeLow;
+		entry.done = (nDone != 0);
+		entry.lines = nLines;
+		entry.bProperlyFormattedLines = (nWellFormed != 0);
+		entry.nMisformattedLines = nMisformatted;
+		entry.nImproperlyFormattedLines = nImproper;
+		entry.counters.nOpenOrReadFailures = nUnreadable;
+		entry.counters.nCopyFailures = nUncopied;
+		entry.counters.nMismatchedChecksums = nFailed;
+		entry.counters.bMatchedChecksums = (nMatched != 0);
+		return !entry.file.empty();
+	}
+
+	bool save()
+	{
+		str zTemp = g_option._journal + _T(".tmp");
+		FILE* f = NULL;
+		if (_tfopen_s(&f, zTemp.c_str(), _T("w")) != 0 || f == NULL)
+			return false;
+
+		_ftprintf(f, _T("%s%s\n"), header().c_str(), selection().c_str());
+		for (size_t i = 0; i < _entries.size(); i++)
+		{
+			journal_entry_t& entry = _entries[i];
+			_ftprintf(f, _T("done=%d lines=%lu well-formed=%d ill-formatted=%lu improper=%lu unreadable=%lu uncopied=%lu failed=%lu matched=%d size=%llu time=%lx:%lx %s\n"),
+				entry.done ? 1 : 0, entry.lines, entry.bProperlyFormattedLines ? 1 : 0, entry.nMisformattedLines,
+				entry.nImproperlyFormattedLines, entry.counters.nOpenOrReadFailures, entry.counters.nCopyFailures,
+				entry.counters.nMismatchedChecksums,
+				entry.counters.bMatchedChecksums ? 1 : 0, entry.size, entry.last_write.dwHighDateTime,
+				entry.last_write.dwLowDateTime, entry.file.c_str());
+		}
+		for (std::map<str, bool>::iterator it = g_only.paths.begin(); it != g_only.paths.end(); ++it)
+		{
+			if (it->second)
+				_ftprintf(f, _T("matched %s\n"), it->first.c_str());
+		}
+
+		//the journal is replaced whole, an interruption leaves the previous one
+		bool bWriteOk = fflush(f) == 0 && !ferror(f) && _commit(_fileno(f)) == 0;
+		if (fclose(f) != 0)
+			bWriteOk = false;
+		if (!bWriteOk || !MoveFileEx(zTemp.c_str(), g_option._journal.c_str(), MOVEFILE_REPLACE_EXISTING | MOVEFILE_WRITE_THROUGH))
+		{
+			_tremove(zTemp.c_str());
+			return false;
+		}
+		return true;
+	}
+
+public:
+	check_journal() : _last_save(0), _failed(false) {}
+
+	void clear()
+	{
+		_entries.clear();
+		_failed = false;
+		_last_save = GetTickCount();
+	}
+
+	//--resume: there is nothing to resume without a journal
+	bool load()
+	{
+		clear();
+		FILE* f = NULL;
+		if (_tfopen_s(&f, g_option._journal.c_str(), _T("r")) != 0 || f == NULL)
+			return true;
+
+		const int max_line_length = 1024;
+		TCHAR cLine[max_line_length];
+		bool bValid = _fgetts(cLine, max_line_length, f) != NULL;
+		str zHeader = header();
+		bool bSameSelection = bValid && zHeader + selection() + _T("\n") == cLine;
+		if (bValid && !bSameSelection)
+		{
+			//the check it is of, with another selection
+			str zLine = cLine;
+			bValid = zLine.compare(0, zHeader.length(), zHeader) == 0
+				&& (zLine[zHeader.length()] == ' ' || zLine[zHeader.length()] == '\n');
+		}
+		while (bValid && bSameSelection && _fgetts(cLine, max_line_length, f) != NULL)
+		{
+			if (_tcsncmp(cLine, _T("matched "), 8) == 0)
+			{
+				str zPath = cLine + 8;
+				size_t len = zPath.length();
+				while (len > 0 && (zPath[len - 1] == '\n' || zPath[len - 1] == '\r'))
+					len--;
+				std::map<str, bool>::iterator it = g_only.paths.find(zPath.substr(0, len));
+				bValid = it != g_only.paths.end();
+				if (bValid)
+					it->second = true;
+				continue;
+			}
+			journal_entry_t entry;
+			bValid = parse(cLine, entry);
+			_entries.push_back(entry);
+		}
+		if (ferror(f))
+			bValid = false;
+		fclose(f);
+
+		if (!bValid)
+			errs().format(_T("%s: %s: not a journal of this check"),
+				g_option._program_name.c_str(), g_option._journal.c_str());
+		else if (!bSameSelection)
+		{
+			errs().format(_T("%s: %s: the journal is of a check with another --only or --only-from selection"),
+				g_option._program_name.c_str(), g_option._journal.c_str());
+			bValid = false;
+		}
+		return bValid;
+	}
+
+	//the entry of the checksum file, started over unless --resume finds it unchanged
+	journal_entry_t& begin(str& zIn_File)
+	{
+		journal_entry_t current;
+		current.file = zIn_File;
+		QueryFileStamp(zIn_File, current.size, current.last_write);
+
+		for (size_t i = 0; i < _entries.size(); i++)
+		{
+			journal_entry_t& entry = _entries[i];
+			if (entry.file != zIn_File)
+				continue;
+			if (entry.size == current.size && CompareFileTime(&entry.last_write, &current.last_write) == 0)
+				return entry;
+
+			errs(1, g_option._status_only).format(_T("%s: changed since the journal was written, checking it from the start"),
+				zIn_File.c_str());
+			entry = current;
+			return entry;
+		}
+		_entries.push_back(current);
+		return _entries.back();
+	}
+
+	void progress(journal_entry_t& entry, DWORD nLines, bool bProperlyFormattedLines,
+		DWORD nMisformattedLines, DWORD nImproperlyFormattedLines, check_counters_t& counters, bool bDone)
+	{
+		entry.lines = nLines;
+		entry.bProperlyFormattedLines = bProperlyFormattedLines;
+		entry.nMisformattedLines = nMisformattedLines;
+		entry.nImproperlyFormattedLines = nImproperlyFormattedLines;
+		entry.counters = counters;
+		entry.done = bDone;
+
+		DWORD dwNow = GetTickCount();
+		if (_failed || (!bDone && dwNow - _last_save < journal_period_ms))
+			return;
+		_last_save = dwNow;
+
+		//--escalate: the lines escalated for the lines done are on disk before the journal has them done
+		if (g_escalate != NULL && (fflush(g_escalate) != 0 || _commit(_fileno(g_escalate)) != 0))
+			return;
+
+		//the check goes on without a journal
+		if (!save())
+		{
+			errs().format(_T("%s: %s: write error"), g_option._program_name.c_str(), g_option._journal.c_str());
+			_failed = true;
+		}
+	}
+
+	//--resume found the progress of an interrupted check
+	bool resuming() const { return !_entries.empty(); }
+
+	//a check that is over has nothing to resume
+	void discard()
+	{
+		if (!_failed)
+			_tremove(g_option._journal.c_str());
+	}
+} g_journal;
+
+bool CheckManifestIndex(str& zIn_Index)
+{
+	manifest_index index;
+	if (!index.open(zIn_Index))
+	{
+		errs().format(_T("%s: not a valid checksum index"), zIn_Index.c_str());
+		return false;
+	}
+
+	//an index of another algorithm has no well-formatted line
+	check_counters_t counters;
+	bool bProperlyFormattedLines = index.size() > 0 && index.alg() == g_option._digest_alg;
+	DWORD nMisformattedLines = bProperlyFormattedLines ? 0 : (DWORD)index.size();
+	if (g_option._shard_count != 0 && g_option._shard_index != 1)
+		nMisformattedLines = 0; //counted by the first shard
+
+	//--only checks the selected entries in the order of their names, an index without any
+	//is not a failure by itself
+	std::set<size_t> selected;
+	if (bProperlyFormattedLines && !g_only.paths.empty())
+	{
+		if (!SelectIndexEntries(index, selected))
+		{
+			errs().format(_T("%s: not a valid checksum index"), zIn_Index.c_str());
+			return false;
+		}
+		if (selected.empty())
+		{
+			if (g_option._shard_count != 0)
+				PrintShardRecord(zIn_Index, bProperlyFormattedLines, 0, 0, counters);
+			return true;
+		}
+	}
+
+	//--resume: the entries done before are passed over
+	size_t nDoneEntries = 0;
+	journal_entry_t* pJournal = NULL;
+	if (!g_option._journal.empty())
+	{
+		pJournal = &g_journal.begin(zIn_Index);
+		nDoneEntries = pJournal->lines;
+		counters = pJournal->counters;
+	}
+
+	std::vector<digest_job_t> jobs;
+	size_t nBatchSize = CheckBatchSize();
+	size_t nEntries = g_only.paths.empty() ? index.size() : selected.size();
+	std::set<size_t>::iterator it = selected.begin();
+	for (size_t k = 0; k < nDoneEntries && it != selected.end(); k++)
+		++it;
+	for (size_t n = nDoneEntries; bProperlyFormattedLines && n < nEntries && !g_cancel; n++)
+	{
+		size_t i = g_only.paths.empty() ? index.line(n) : *it++;
+		digest_job_t job;
+		if (!index.name(i, job.file))
+		{
+			errs().format(_T("%s: not a valid checksum index"), zIn_Index.c_str());
+			return false;
+		}
+		if (!InShard(job.file.c_str(), job.file.length()))
+			continue;
+		index.digest(i, job.digest);
+		job.is_binary = index.is_binary(i);
+		if (!g_option._copy_to.empty())
+			job.copy_skip = CopyDestination(job.file, job.copy_to);
+		jobs.push_back(job);
+		if (jobs.size() == nBatchSize)
+		{
+			RunCheckBatch(jobs, counters);
+			if (pJournal != NULL && !g_cancel)
+				g_journal.progress(*pJournal, (DWORD)(n + 1), bProperlyFormattedLines, nMisformattedLines,
+					nMisformattedLines, counters, false);
+		}
+	}
+
+	if (!g_cancel)
+		RunCheckBatch(jobs, counters);
+	if (pJournal != NULL && !g_cancel)
+		g_journal.progress(*pJournal, (DWORD)nEntries, bProperlyFormattedLines, nMisformattedLines,
+			nMisformattedLines, counters, true);
+
+	return FinishCheck(zIn_Index, bProperlyFormattedLines, nMisformattedLines, nMisformattedLines, counters);
+}
+
+bool DigestCheck(str& zIn_FileContainsDigestInfo)
+{
+	//an index has no --quick lines
+	if (zIn_FileContainsDigestInfo != _T("-") && g_option._quick_samples == 0 && IsManifestIndex(zIn_FileContainsDigestInfo))
+		return CheckManifestIndex(zIn_FileContainsDigestInfo);
+
+	DWORD nMisformattedLines = 0;
+	DWORD nImproperlyFormattedLines = 0;
+	check_counters_t counters;
+	bool bProperlyFormattedLines = false;
+
+	//--resume: the counts of the lines done before are carried on, the lines are read past
+	DWORD nDoneLines = 0;
+	journal_entry_t* pJournal = NULL;
+	if (!g_option._journal.empty())
+	{
+		pJournal = &g_journal.begin(zIn_FileContainsDigestInfo);
+		nDoneLines = pJournal->lines;
+		bProperlyFormattedLines = pJournal->bProperlyFormattedLines;
+		nMisformattedLines = pJournal->nMisformattedLines;
+		nImproperlyFormattedLines = pJournal->nImproperlyFormattedLines;
+		counters = pJournal->counters;
+		if (pJournal->done)
+			return FinishCheck(zIn_FileContainsDigestInfo, bProperlyFormattedLines,
+				nMisformattedLines, nImproperlyFormattedLines, counters);
+	}
+
+	const int max_line_length = 1024;
+	TCHAR* cLine = new TCHAR[max_line_length];
+
+	bool is_binary = false;
+
+	bool is_stdin = (zIn_FileContainsDigestInfo == _T("-"));
+
+	FILE* f = NULL;
+
+	if (is_stdin)
+	{
+		zIn_FileContainsDigestInfo = _T("standard input");
+		f = stdin;
+	}
+	else
+	{
+		_tfopen_s(&f, zIn_FileContainsDigestInfo.c_str(), _T("r"));
+		if (f == NULL)
+		{
+			errs().format(_T("%s: %s: no such file or directory"),
+				g_option._program_name.c_str(), zIn_FileContainsDigestInfo.c_str());
+			delete[] cLine;
+			return false;
+		}
+	}
+
+	DWORD nLine = 0;
+	std::vector<digest_job_t> jobs;
+	size_t nBatchSize = CheckBatchSize();
+	bool bChunksOwner = false; //the last line read was a checksum line of a job
+	str zDigestInFile;
+	AlgHash alg;
+	do {
+		++nLine;
+		if (nLine == 0)
+			errs(1).format(_T("%s: too many checksum lines"),
+				zIn_FileContainsDigestInfo.c_str());
+			
+
+		if (NULL == _fgetts(cLine, max_line_length, f))
+			break;
+
+		if (nLine <= nDoneLines)
+			continue;
+
+		//Ignore comment lines, which begin with a '#' character. With --chunks the chunk lines
+		//belong to the checksum line before them.
+		if (cLine[0] == '#')
+		{
+			if (g_option._chunks && bChunksOwner && _tcsncmp(cLine, _T("#chunk "), 7) == 0
+				&& !ParseChunkLine(cLine, jobs.back()))
+			{
+				++nMisformattedLines;
+				++nImproperlyFormattedLines;
+				errs(1, !g_option._warn || g_option._status_only)
+					.format(_T("%s: %lu: ill-formatted chunk line"), zIn_FileContainsDigestInfo.c_str(), nLine);
+				jobs.back().chunk_size = 0; //the file is checked as a whole
+				jobs.back().listed_chunks.clear();
+				bChunksOwner = false;
+			}
+			continue;
+		}
+		bChunksOwner = false;
+
+		//--only: the lines of names not selected are skipped before they are parsed
+		const TCHAR* pName;
+		size_t nNameLen;
+		if (!g_only.paths.empty() && (!FindLineName(cLine, pName, nNameLen) || !g_only.match(pName, nNameLen)))
+			continue;
+
+		//--shard: the lines of names of other shards are skipped too, a line without a name
+		//belongs to the first shard
+		if (g_option._shard_count != 0 && (FindLineName(cLine, pName, nNameLen)
+			? !InShard(pName, nNameLen) : g_option._shard_index != 1))
+			continue;
+
+		str zFileToCheck;
+		DWORD nQuickSamples = 0;
+		bool bParseOk;
+		if (g_option._quick_samples != 0)
+		{
+			bParseOk = ParseQuickLine(cLine, zDigestInFile, zFileToCheck, nQuickSamples);
+			is_binary = true;
+			alg = g_option._digest_alg;
+		}
+		else
+			bParseOk = ParseLine(cLine, zDigestInFile, zFileToCheck, is_binary, alg);
+		if (!bParseOk || (bParseOk && (alg != g_option._digest_alg)))
+		{
+			++nMisformattedLines;
+			++nImproperlyFormattedLines;
+			errs(1, !g_option._warn || g_option._status_only)
+				.format(_T("%s: %lu: ill-formatted %s checksum line"),
+					zIn_FileContainsDigestInfo.c_str(), nLine, g_option._digest_alg_name.c_str());
+			
+		}
+		else
+		{
+			bProperlyFormattedLines = true;
+
+			digest_job_t job;
+			job.file = zFileToCheck;
+			job.digest = zDigestInFile;
+			job.is_binary = is_binary;
+			job.quick = nQuickSamples;
+			if (!g_option._copy_to.empty())
+				job.copy_skip = CopyDestination(job.file, job.copy_to);
+
+			//a full batch is run before the next job, the chunk lines of the last one may follow
+			if (jobs.size() == nBatchSize)
+			{
+				RunCheckBatch(jobs, counters);
+				if (pJournal != NULL && !g_cancel)
+					g_journal.progress(*pJournal, nLine - 1, bProperlyFormattedLines, nMisformattedLines,
+						nImproperlyFormattedLines, counters, false);
+			}
+			jobs.push_back(job);
+			bChunksOwner = true;
+		}
+	} while (!g_cancel && !feof(f) && !ferror(f));
+
+	if (!g_cancel)
+		RunCheckBatch(jobs, counters);
+
+	delete[] cLine;
+
+	bool bReadOk = !ferror(f);
+	if (!is_stdin)
+		fclose(f);
+	if (!bReadOk)
+	{
+		errs().format(_T("%s: read error"),
+			zIn_FileContainsDigestInfo.c_str());
+		return false;
+	}
+
+	if (pJournal != NULL && !g_cancel)
+		g_journal.progress(*pJournal, nLine, bProperlyFormattedLines, nMisformattedLines,
+			nImproperlyFormattedLines, counters, true);
+
+	return FinishCheck(zIn_FileContainsDigestInfo, bProperlyFormattedLines,
+		nMisformattedLines, nImproperlyFormattedLines, counters);
+}
+
+//--merge-results: the lines of the result files are printed one file after the other, the
+//#shard lines of each checksum file are added up and reported as a single check of it would
+//have been. Every shard of a checksum file must be there, once.
+struct shard_totals_t
+{
+	str file;
+	DWORD count; //N of the shards
+	std::set<DWORD> shards;
+	bool bProperlyFormattedLines;
+	DWORD nMisformattedLines;
+	DWORD nImproperlyFormattedLines;
+	check_counters_t counters;
+	shard_totals_t() : count(0), bProperlyFormattedLines(false), nMisformattedLines(0), nImproperlyFormattedLines(0) {}
+};
+
+bool ParseShardRecord(const TCHAR* cLine, DWORD& nOut_Index, DWORD& nOut_Count, shard_totals_t& record)
+{
+	int nWellFormed = 0, nMatched = 0, nNameStart = 0;
+	unsigned long i = 0, n = 0, nMisformatted = 0, nImproper = 0, nUnreadable = 0, nUncopied = 0, nFailed = 0;
+	if (_stscanf_s(cLine, _T("#shard %lu/%lu well-formed=%d ill-formatted=%lu improper=%lu unreadable=%lu uncopied=%lu failed=%lu matched=%d %n"),
+		&i, &n, &nWellFormed, &nMisformatted, &nImproper, &nUnreadable, &nUncopied, &nFailed, &nMatched, &nNameStart) != 9
+		|| nNameStart == 0 || i == 0 || i > n)
+		return false;
+
+	record.file = cLine + nNameStart;
+	size_t len = record.file.length();
+	while (len > 0 && (record.file[len - 1] == '\n' || record.file[len - 1] == '\r'))
+		len--;
+	record.file = record.file.substr(0, len);
+	record.bProperlyFormattedLines = (nWellFormed != 0);
+	record.nMisformattedLines = nMisformatted;
+	record.nImproperlyFormattedLines = nImproper;
+	record.counters.nOpenOrReadFailures = nUnreadable;
+	record.counters.nCopyFailures = nUncopied;
+	record.counters.nMismatchedChecksums = nFailed;
+	record.counters.bMatchedChecksums = (nMatched != 0);
+	nOut_Index = i;
+	nOut_Count = n;
+	return !record.file.empty();
+}
+
+bool MergeResults(std::vector<str>& files)
+{
+	bool status = true;
+	std::vector<shard_totals_t> totals; //in the order the checksum files are first seen
+
+	const int max_line_length = 1024;
+	TCHAR cLine[max_line_length];
+	for (size_t k = 0; k < files.size(); k++)
+	{
+		FILE* f = NULL;
+		if (files[k] == _T("-"))
+			f = stdin;
+		else if (_tfopen_s(&f, files[k].c_str(), _T("r")) != 0 || f == NULL)
+		{
+			errs().format(_T("%s: %s: no such file or directory"), g_option._program_name.c_str(), files[k].c_str());
+			status = false;
+			continue;
+		}
+
+		while (_fgetts(cLine, max_line_length, f) != NULL)
+		{
+			if (_tcsncmp(cLine, _T("#shard "), 7) != 0)
+			{
+				str zLine = cLine;
+				size_t len = zLine.length();
+				while (len > 0 && (zLine[len - 1] == '\n' || zLine[len - 1] == '\r'))
+					len--;
+				zLine = zLine.substr(0, len);
+				bool bOk = len > 4 && zLine.compare(len - 4, 4, _T(": OK")) == 0;
+				outs(0, g_option._status_only || (bOk && g_option._quiet)) << zLine;
+				continue;
+			}
+
+			DWORD i, n;
+			shard_totals_t record;
+			if (!ParseShardRecord(cLine, i, n, record))
+			{
+				errs().format(_T("%s: ill-formatted #shard line"), files[k] == _T("-") ? _T("standard input") : files[k].c_str());
+				status = false;
+				continue;
+			}
+
+			size_t t = 0;
+			while (t < totals.size() && totals[t].file != record.file)
+				t++;
+			if (t == totals.size())
+			{
+				totals.push_back(shard_totals_t());
+				totals[t].file = record.file;
+				totals[t].count = n;
+			}
+			shard_totals_t& total = totals[t];
+			if (n != total.count)
+			{
+				errs().format(_T("%s: the results are of %lu and of %lu shards"), total.file.c_str(), total.count, n);
+				status = false;
+				continue;
+			}
+			if (!total.shards.insert(i).second)
+			{
+				errs().format(_T("%s: the results of shard %lu/%lu are given more than once"), total.file.c_str(), i, n);
+				status = false;
+				continue;
+			}
+			total.bProperlyFormattedLines = total.bProperlyFormattedLines || record.bProperlyFormattedLines;
+			total.nMisformattedLines += record.nMisformattedLines;
+			total.nImproperlyFormattedLines += record.nImproperlyFormattedLines;
+			total.counters.nOpenOrReadFailures += record.counters.nOpenOrReadFailures;
+			total.counters.nCopyFailures += record.counters.nCopyFailures;
+			total.counters.nMismatchedChecksums += record.counters.nMismatchedChecksums;
+			total.counters.bMatchedChecksums = total.counters.bMatchedChecksums || record.counters.bMatchedChecksums;
+		}
+
+		if (ferror(f))
+		{
+			errs().format(_T("%s: read error"), files[k] == _T("-") ? _T("standard input") : files[k].c_str());
+			status = false;
+		}
+		if (f != stdin)
+			fclose(f);
+	}
+
+	if (totals.empty() && status)
+	{
+		errs().format(_T("%s: no #shard lines found"), g_option._program_name.c_str());
+		return false;
+	}
+
+	for (size_t t = 0; t < totals.size(); t++)
+	{
+		shard_totals_t& total = totals[t];
+		for (DWORD i = 1; i <= total.count; i++)
+		{
+			if (total.shards.find(i) == total.shards.end())
+			{
+				errs().format(_T("%s: the results of shard %lu/%lu are missing"), total.file.c_str(), i, total.count);
+				status = false;
+			}
+		}
+		if (!ReportCheckResult(total.file, total.bProperlyFormattedLines, total.nMisformattedLines,
+			total.nImproperlyFormattedLines, total.counters))
+			status = false;
+	}
+	return status;
+}
+
+//--diff keeps only the path and the binary digest of each line instead of the line text: the
+//checksum files are read in blocks, the lines of a block are parsed in parallel into one arena
+//per chunk and each chunk is sorted by path, then the chunks are merged and the two sorted
+//lists are joined.
+const size_t manifest_block_size = 16 * 1024 * 1024;
+
+struct manifest_entry_t
+{
+	const TCHAR* name; //not terminated, points into the name arena of a chunk
+	size_t name_len;
+	const BYTE* digest;
+	size_t line;
+};
+
+struct manifest_chunk_t
+{
+	TCHAR* text; //lines of the block being parsed, modified in place
+	size_t text_len;
+	size_t line_count;
+	std::vector<TCHAR> names;
+	std::vector<BYTE> digests;
+	std::vector<size_t> bad_lines;
+	std::vector<manifest_entry_t> entries;
+	manifest_chunk_t() : text(NULL), text_len(0), line_count(0) {}
+};
+
+struct manifest_t
+{
+	str name;
+	size_t line_count;
+	std::vector<size_t> bad_lines;
+	std::vector<manifest_chunk_t*> chunks;
+	std::vector<manifest_entry_t> entries; //sorted by name, one per distinct name
+	manifest_t() : line_count(0) {}
+	~manifest_t()
+	{
+		for (size_t i = 0; i < chunks.size(); i++)
+			delete chunks[i];
+	}
+};
+
+int CompareManifestNames(const manifest_entry_t& a, const manifest_entry_t& b)
+{
+	int cmp = _tcsncmp(a.name, b.name, a.name_len < b.name_len ? a.name_len : b.name_len);
+	if (cmp != 0)
+		return cmp;
+	return a.name_len < b.name_len ? -1 : (a.name_len > b.name_len ? 1 : 0);
+}
+
+struct MANIFEST_ORDER_T
+{
+	bool operator()(const manifest_entry_t& a, const manifest_entry_t& b) const
+	{
+		int cmp = CompareManifestNames(a, b);
+		return cmp != 0 ? cmp < 0 : a.line < b.line;
+	}
+};
+
+void ParseManifestChunk(manifest_chunk_t& chunk)
+{
+	const size_t digest_len = DigestHexLength(g_option._digest_alg) / 2;
+	std::vector<size_t> name_offsets;
+
+	TCHAR* p = chunk.text;
+	TCHAR* end = chunk.text + chunk.text_len;
+	while (p < end)
+	{
+		TCHAR* eol = std::find(p, end, _T('\n'));
+		*eol = '\0'; //the block keeps room for a terminator after its last line
+		chunk.line_count++;
+
+		//Ignore comment lines, which begin with a '#' character.
+		if (p[0] != '#')
+		{
+			str zDigest, zFileName;
+			bool is_binary;
+			AlgHash alg;
+			if (!ParseLine(p, zDigest, zFileName, is_binary, alg) || alg != g_option._digest_alg)
+				chunk.bad_lines.push_back(chunk.line_count);
+			else
+			{
+				manifest_entry_t entry;
+				entry.name_len = zFileName.length();
+				entry.line = chunk.line_count;
+				chunk.entries.push_back(entry);
+				name_offsets.push_back(chunk.names.size());
+				chunk.names.insert(chunk.names.end(), zFileName.begin(), zFileName.end());
+				HexToBytes(zDigest, chunk.digests);
+			}
+		}
+		p = eol + 1;
+	}
+
+	//the arenas are complete, point the entries into them
+	for (size_t i = 0; i < chunk.entries.size(); i++)
+	{
+		chunk.entries[i].name = chunk.names.empty() ? NULL : &chunk.names[0] + name_offsets[i];
+		chunk.entries[i].digest = &chunk.digests[0] + i * digest_len;
+	}
+	std::sort(chunk.entries.begin(), chunk.entries.end(), MANIFEST_ORDER_T());
+
+	chunk.text = NULL;
+	chunk.text_len = 0;
+}
+
+//parses text[0, text_len) on the work pool, text_len is at a line boundary
+void ParseManifestBlock(manifest_t& manifest, TCHAR* text, size_t text_len)
+{
+	size_t nChunks = g_pool.size();
+	size_t first = manifest.chunks.size();
+
+	TCHAR* p = text;
+	TCHAR* end = text + text_len;
+	for (size_t i = 1; i <= nChunks && p < end; i++)
+	{
+		TCHAR* chunk_end = (i == nChunks) ? end : std::find((std::max)(p, text + text_len * i / nChunks), end, _T('\n'));
+		if (chunk_end < end)
+			chunk_end++;
+
+		manifest_chunk_t* chunk = new manifest_chunk_t;
+		chunk->text = p;
+		chunk->text_len = chunk_end - p;
+		manifest.chunks.push_back(chunk);
+		p = chunk_end;
+	}
+
+	struct PARSE_T
+	{
+		manifest_chunk_t** chunks;
+		void operator()(size_t i) { ParseManifestChunk(*chunks[i]); }
+	} _parse = { manifest.chunks.empty() ? NULL : &manifest.chunks[0] + first };
+	g_pool.run(manifest.chunks.size() - first, _parse);
+
+	for (size_t i = first; i < manifest.chunks.size(); i++)
+	{
+		manifest_chunk_t& chunk = *manifest.chunks[i];
+		for (size_t k = 0; k < chunk.entries.size(); k++)
+			chunk.entries[k].line += manifest.line_count;
+		for (size_t k = 0; k < chunk.bad_lines.size(); k++)
+			manifest.bad_lines.push_back(chunk.bad_lines[k] + manifest.line_count);
+		manifest.line_count += chunk.line_count;
+	}
+}
+
+//merges the sorted chunks pairwise on the work pool until a single sorted list is left,
+//then keeps the last line of a path listed more than once.
+void SortManifest(manifest_t& manifest)
+{
+	std::vector<manifest_entry_t> src, dst;
+	std::vector<size_t> bounds(1, 0);
+	for (size_t i = 0; i < manifest.chunks.size(); i++)
+	{
+		src.insert(src.end(), manifest.chunks[i]->entries.begin(), manifest.chunks[i]->entries.end());
+		std::vector<manifest_entry_t>().swap(manifest.chunks[i]->entries);
+		bounds.push_back(src.size());
+	}
+
+	struct MERGE_T
+	{
+		manifest_entry_t* src;
+		manifest_entry_t* dst;
+		size_t* bounds;
+		size_t nRuns;
+		void operator()(size_t i)
+		{
+			size_t a = bounds[2 * i], b = bounds[2 * i + 1];
+			size_t c = (2 * i + 2 <= nRuns) ? bounds[2 * i + 2] : b;
+			std::merge(src + a, src + b, src + b, src + c, dst + a, MANIFEST_ORDER_T());
+		}
+	};
+
+	while (bounds.size() > 2 && !src.empty())
+	{
+		dst.resize(src.size());
+		size_t nRuns = bounds.size() - 1;
+		MERGE_T _merge = { &src[0], &dst[0], &bounds[0], nRuns };
+		g_pool.run((nRuns + 1) / 2, _merge);
+
+		std::vector<size_t> merged;
+		for (size_t i = 0; i < bounds.size(); i += 2)
+			merged.push_back(bounds[i]);
+		if (merged.back() != src.size())
+			merged.push_back(src.size());
+		bounds.swap(merged);
+		src.swap(dst);
+	}
+
+	manifest.entries.clear();
+	for (size_t i = 0; i < src.size(); i++)
+	{
+		if (i + 1 < src.size() && CompareManifestNames(src[i], src[i + 1]) == 0)
+			continue;
+		manifest.entries.push_back(src[i]);
+	}
+}
+
+bool LoadManifest(str& zIn_Manifest, manifest_t& manifest)
+{
+	FILE* f = NULL;
+	manifest.name = zIn_Manifest;
+	if (zIn_Manifest == _T("-"))
+	{
+		manifest.name = _T("standard input");
+		f = stdin;
+	}
+	else
+	{
+		_tfopen_s(&f, zIn_Manifest.c_str(), _T("rb"));
+		if (f == NULL)
+		{
+			errs().format(_T("%s: %s: no such file or directory"),
+				g_option._program_name.c_str(), zIn_Manifest.c_str());
+			return false;
+		}
+	}
+
+	std::vector<TCHAR> block(manifest_block_size + 1);
+	size_t nCarry = 0; //a partial last line, moved to the front of the next block
+	bool bEof = false;
+	while (!bEof)
+	{
+		size_t nWanted = block.size() - 1 - nCarry;
+		size_t nText = nCarry + fread(&block[nCarry], sizeof(TCHAR), nWanted, f);
+		bEof = (nText < nCarry + nWanted);
+
+		size_t nUse = nText;
+		if (!bEof)
+		{
+			while (nUse > 0 && block[nUse - 1] != '\n')
+				nUse--;
+			if (nUse == 0)
+			{
+				//a single line longer than the block
+				block.resize(block.size() * 2);
+				nCarry = nText;
+				continue;
+			}
+		}
+
+		ParseManifestBlock(manifest, &block[0], nUse);
+
+		nCarry = nText - nUse;
+		if (nCarry > 0)
+			memmove(&block[0], &block[nUse], nCarry * sizeof(TCHAR));
+	}
+
+	bool bReadOk = !ferror(f);
+	if (f != stdin)
+		fclose(f);
+	if (!bReadOk)
+	{
+		errs().format(_T("%s: read error"), manifest.name.c_str());
+		return false;
+	}
+
+	SortManifest(manifest);
+
+	for (size_t i = 0; i < manifest.bad_lines.size(); i++)
+	{
+		errs(1, !g_option._warn || g_option._status_only)
+			.format(_T("%s: %lu: ill-formatted %s checksum line"),
+				manifest.name.c_str(), (unsigned long)manifest.bad_lines[i], g_option._digest_alg_name.c_str());
+	}
+	errs(1, g_option._status_only || manifest.bad_lines.empty())
+		.format(_T("WARNING: %s: %lu line(s) is ill-formatted"),
+			manifest.name.c_str(), (unsigned long)manifest.bad_lines.size());
+
+	return true;
+}
+
+bool DiffManifests(str& zIn_OldManifest, str& zIn_NewManifest)
+{
+	manifest_t old_manifest, new_manifest;
+	if (!LoadManifest(zIn_OldManifest, old_manifest) || !LoadManifest(zIn_NewManifest, new_manifest))
+		return false;
+
+	const size_t digest_len = DigestHexLength(g_option._digest_alg) / 2;
+	std::vector<manifest_entry_t>& a = old_manifest.entries;
+	std::vector<manifest_entry_t>& b = new_manifest.entries;
+	unsigned long nAdded = 0, nRemoved = 0, nChanged = 0;
+
+	outs.set_delimiter(_T("\n"));
+	size_t i = 0, j = 0;
+	while (i < a.size() || j < b.size())
+	{
+		int cmp = (i == a.size()) ? 1 : (j == b.size()) ? -1 : CompareManifestNames(a[i], b[j]);
+		if (cmp < 0)
+		{
+			nRemoved++;
+			outs(0, g_option._status_only).format(_T("%s: removed"), str(a[i].name, a[i].name_len).c_str());
+			i++;
+		}
+		else if (cmp > 0)
+		{
+			nAdded++;
+			outs(0, g_option._status_only).format(_T("%s: added"), str(b[j].name, b[j].name_len).c_str());
+			j++;
+		}
+		else
+		{
+			if (memcmp(a[i].digest, b[j].digest, digest_len) != 0)
+			{
+				nChanged++;
+				outs(0, g_option._status_only).format(_T("%s: changed"), str(a[i].name, a[i].name_len).c_str());
+			}
+			i++;
+			j++;
+		}
+	}
+
+	errs(1, g_option._status_only || (nAdded + nRemoved + nChanged) == 0)
+		.format(_T("%lu added, %lu removed, %lu changed"), nAdded, nRemoved, nChanged);
+
+	return (nAdded + nRemoved + nChanged) == 0
+		&& (!g_option._strict || (old_manifest.bad_lines.empty() && new_manifest.bad_lines.empty()));
+}
+
+//--convert: an index to the text lines, or with --index the text lines to an index
+bool ConvertManifest(str& zIn_Manifest)
+{
+	if (!g_option._index)
+	{
+		manifest_index index;
+		if (!IsManifestIndex(zIn_Manifest) || !index.open(zIn_Manifest) || index.alg() != g_option._digest_alg)
+		{
+			errs().format(_T("%s: not a valid %s checksum index"), zIn_Manifest.c_str(), g_option._digest_alg_name.c_str());
+			return false;
+		}
+
+		outs.set_delimiter(_T("\n"));
+		str zName, zDigest, zLine;
+		for (size_t n = 0; n < index.size(); n++)
+		{
+			size_t i = index.line(n);
+			if (!index.name(i, zName))
+			{
+				errs().format(_T("%s: not a valid %s checksum index"), zIn_Manifest.c_str(), g_option._digest_alg_name.c_str());
+				return false;
+			}
+			index.digest(i, zDigest);
+			FormatDigestLine(zName, zDigest, index.is_binary(i), index.bsd_tag(), zLine);
+			outs() << zLine;
+		}
+		return true;
+	}
+
+	FILE* f = NULL;
+	str zName = zIn_Manifest;
+	if (zIn_Manifest == _T("-"))
+	{
+		zName = _T("standard input");
+		f = stdin;
+	}
+	else if (_tfopen_s(&f, zIn_Manifest.c_str(), _T("r")) != 0 || f == NULL)
+	{
+		errs().format(_T("%s: %s: no such file or directory"), g_option._program_name.c_str(), zIn_Manifest.c_str());
+		return false;
+	}
+
+	//the style of the first line is the style of the index
+	const int max_line_length = 1024;
+	TCHAR cLine[max_line_length];
+	std::vector<index_entry_t> entries;
+	DWORD nMisformattedLines = 0;
+	bool bsd_tag = false;
+	while (_fgetts(cLine, max_line_length, f) != NULL)
+	{
+		if (cLine[0] == '#')
+			continue;
+
+		index_entry_t entry;
+		AlgHash alg;
+		if (!ParseLine(cLine, entry.digest, entry.name, entry.is_binary, alg) || alg != g_option._digest_alg)
+		{
+			++nMisformattedLines;
+			continue;
+		}
+		if (entries.empty())
+			bsd_tag = _tcsncmp(cLine, entry.digest.c_str(), entry.digest.length()) != 0;
+		entries.push_back(entry);
+	}
+
+	bool bReadOk = !ferror(f);
+	if (f != stdin)
+		fclose(f);
+	if (!bReadOk)
+	{
+		errs().format(_T("%s: read error"), zName.c_str());
+		return false;
+	}
+	if (entries.empty())
+	{
+		errs().format(_T("%s: no well-formatted %s checksum lines found"), zName.c_str(), g_option._digest_alg_name.c_str());
+		return false;
+	}
+	errs(1, nMisformattedLines == 0).format(_T("WARNING: %lu: line(s) is ill-formatted"), nMisformattedLines);
+
+	return WriteManifestIndex(g_option._sum_file, entries, bsd_tag) && (!g_option._strict || nMisformattedLines == 0);
+}
+
+//--watch keeps the --sum-file manifest of a directory tree up to date: a changed file is
+//digested again once it has not been written for a while, so a burst of writes costs one
+//read, and the manifest is rewritten through a temporary file at most every few seconds.
+const DWORD watch_settle_ms = 2000;
+const DWORD watch_rewrite_ms = 10000;
+const DWORD watch_buffer_size = 64 * 1024;
+
+struct watch_entry_t
+{
+	str digest;
+	ULONGLONG size;
+	FILETIME last_write;
+};
+
+struct watch_state_t
+{
+	str prefix; //of the names in the manifest, the watched directory and a separator or empty
+	str manifest_path; //full paths in lower case, the manifest is not a part of itself
+	str temp_path;
+	std::map<str, watch_entry_t> entries; //sorted by name, the manifest is rewritten in this order
+	std::map<str, DWORD> pending; //changed names, by the tick of their last change
+	bool dirty;
+};
+
+str FullPathLower(str& zIn_File)
+{
+	TCHAR szFullPath[MAX_PATH];
+	DWORD dwLen = GetFullPathName(zIn_File.c_str(), MAX_PATH, szFullPath, NULL);
+	str zFullPath = (dwLen == 0 || dwLen >= MAX_PATH) ? zIn_File : str(szFullPath);
+	zFullPath.to_lower();
+	return zFullPath;
+}
+
+//the files of a directory tree, zIn_Prefix is the directory and a separator, or empty for the
+//current directory; directory junctions and links are not followed
+void ListDirectoryFiles(str& zIn_Prefix, std::vector<str>& zOut_Files)
+{
+	WIN32_FIND_DATA a;
+	str zPattern = zIn_Prefix + _T("*");
+	HANDLE hFind = FindFirstFile(zPattern.c_str(), &a);
+	if (hFind == INVALID_HANDLE_VALUE)
+		return;
+
+	do
+	{
+		str zName = a.cFileName;
+		if (zName == _T(".") || zName == _T(".."))
+			continue;
+
+		str zFile = zIn_Prefix + zName;
+		if (!(a.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY))
+			zOut_Files.push_back(zFile);
+		else if (!(a.dwFileAttributes & FILE_ATTRIBUTE_REPARSE_POINT))
+		{
+			zFile += _T("\\");
+			ListDirectoryFiles(zFile, zOut_Files);
+		}
+	} while (FindNextFile(hFind, &a));
+	FindClose(hFind);
+}
+
+bool IsWatchManifest(watch_state_t& state, str& zIn_File)
+{
+	str zFullPath = FullPathLower(zIn_File);
+	return zFullPath == state.manifest_path || zFullPath == state.temp_path;
+}
+
+//digests the files whose size or last write time differ from their entry; a file that cannot
+//be read, e.g. while it is still being written, is tried again after the next settle time
+void UpdateWatchEntries(watch_state_t& state, std::vector<str>& files)
+{
+	std::vector<digest_job_t> jobs;
+	std::vector<watch_entry_t> stamps;
+	for (size_t i = 0; i < files.size(); i++)
+	{
+		watch_entry_t stamp;
+		if (IsWatchManifest(state, files[i]) || !QueryFileStamp(files[i], stamp.size, stamp.last_write))
+			continue;
+
+		std::map<str, watch_entry_t>::iterator it = state.entries.find(files[i]);
+		if (it != state.entries.end() && it->second.size == stamp.size
+			&& CompareFileTime(&it->second.last_write, &stamp.last_write) == 0)
+			continue;
+
+		digest_job_t job;
+		job.file = files[i];
+		job.is_binary = g_option._binary;
+		jobs.push_back(job);
+		stamps.push_back(stamp);
+	}
+	RunDigestJobs(jobs);
+
+	for (size_t i = 0; i < jobs.size(); i++)
+	{
+		if (!jobs[i].ok)
+		{
+			state.pending[jobs[i].file] = GetTickCount();
+			continue;
+		}
+		watch_entry_t& entry = state.entries[jobs[i].file];
+		entry = stamps[i];
+		entry.digest = jobs[i].computed;
+		state.dirty = true;
+	}
+}
+
+//a name that is gone takes the names below it along, a directory that appeared (e.g. moved in)
+//brings the files below it
+void ProcessSettledChanges(watch_state_t& state)
+{
+	DWORD dwNow = GetTickCount();
+	std::vector<str> files;
+	std::map<str, DWORD>::iterator it = state.pending.begin();
+	while (it != state.pending.end())
+	{
+		if (dwNow - it->second < watch_settle_ms)
+		{
+			++it;
+			continue;
+		}
+
+		str zName = it->first;
+		state.pending.erase(it++);
+
+		DWORD dwAttributes = GetFileAttributes(zName.c_str());
+		if (dwAttributes == INVALID_FILE_ATTRIBUTES)
+		{
+			if (state.entries.erase(zName) > 0)
+				state.dirty = true;
+
+			str zBelow = zName + _T("\\");
+			std::map<str, watch_entry_t>::iterator below = state.entries.lower_bound(zBelow);
+			while (below != state.entries.end() && below->first.compare(0, zBelow.length(), zBelow) == 0)
+			{
+				state.entries.erase(below++);
+				state.dirty = true;
+			}
+		}
+		else if (dwAttributes & FILE_ATTRIBUTE_DIRECTORY)
+		{
+			zName += _T("\\");
+			ListDirectoryFiles(zName, files);
+		}
+		else
+			files.push_back(zName);
+	}
+	UpdateWatchEntries(state, files);
+}
+
+//the names of a change notification are UTF-16 and relative to the watched directory
+void QueueChanges(watch_state_t& state, BYTE* pbNotify)
+{
+	DWORD dwNow = GetTickCount();
+	while (true)
+	{
+		FILE_NOTIFY_INFORMATION* fni = (FILE_NOTIFY_INFORMATION*)pbNotify;
+		int nChars = (int)(fni->FileNameLength / sizeof(WCHAR));
+#ifdef UNICODE
+		str zName(fni->FileName, nChars);
+#else
+		str zName;
+		int nBytes = WideCharToMultiByte(CP_ACP, 0, fni->FileName, nChars, NULL, 0, NULL, NULL);
+		if (nBytes > 0)
+		{
+			std::vector<char> name(nBytes);
+			WideCharToMultiByte(CP_ACP, 0, fni->FileName, nChars, &name[0], nBytes, NULL, NULL);
+			zName = str(&name[0], nBytes);
+		}
+#endif
+		if (!zName.empty())
+			state.pending[state.prefix + zName] = dwNow;
+
+		if (fni->NextEntryOffset == 0)
+			break;
+		pbNotify += fni->NextEntryOffset;
+	}
+}
+
+bool WriteWatchManifest(watch_state_t& state)
+{
+	str zTemp = g_option._sum_file + _T(".tmp");
+	FILE* f = NULL;
+	if (_tfopen_s(&f, zTemp.c_str(), _T("w")) != 0 || f == NULL)
+	{
+		errs().format(_T("%s: %s: cannot create file"), g_option._program_name.c_str(), zTemp.c_str());
+		return false;
+	}
+
+	str zLine;
+	for (std::map<str, watch_entry_t>::iterator it = state.entries.begin(); it != state.entries.end(); ++it)
+	{
+		str zName = it->first;
+		FormatDigestLine(zName, it->second.digest, zLine);
+		_ftprintf(f, _T("%s%s"), zLine.c_str(), g_option._delim.c_str());
+	}
+
+	//the data is on disk before the rename makes it the manifest
+	bool bWriteOk = fflush(f) == 0 && !ferror(f) && _commit(_fileno(f)) == 0;
+	if (fclose(f) != 0)
+		bWriteOk = false;
+	if (!bWriteOk || !MoveFileEx(zTemp.c_str(), g_option._sum_file.c_str(), MOVEFILE_REPLACE_EXISTING | MOVEFILE_WRITE_THROUGH))
+	{
+		_tremove(zTemp.c_str());
+		errs().format(_T("%s: %s: write error"), g_option._program_name.c_str(), g_option._sum_file.c_str());
+		return false;
+	}
+	state.dirty = false;
+	return true;
+}
+
+//the digests of an existing manifest are kept for the files not written since it was
+void LoadWatchManifest(watch_state_t& state, std::vector<str>& files)
+{
+	ULONGLONG nManifestSize;
+	FILETIME ftManifest;
+	FILE* f = NULL;
+	if (!QueryFileStamp(g_option._sum_file, nManifestSize, ftManifest)
+		|| _tfopen_s(&f, g_option._sum_file.c_str(), _T("r")) != 0 || f == NULL)
+		return;
+
+	std::set<str> listed(files.begin(), files.end());
+	const int max_line_length = 1024;
+	TCHAR cLine[max_line_length];
+	while (_fgetts(cLine, max_line_length, f) != NULL)
+	{
+		str zDigest, zName;
+		bool is_binary;
+		AlgHash alg;
+		watch_entry_t entry;
+		if (cLine[0] == '#' || !ParseLine(cLine, zDigest, zName, is_binary, alg)
+			|| alg != g_option._digest_alg || is_binary != g_option._binary || listed.find(zName) == listed.end()
+			|| !QueryFileStamp(zName, entry.size, entry.last_write)
+			|| CompareFileTime(&entry.last_write, &ftManifest) >= 0)
+			continue;
+
+		entry.digest = zDigest;
+		state.entries[zName] = entry;
+	}
+	fclose(f);
+}
+
+int WatchDirectory(str& zIn_Dir)
+{
+	HANDLE hDir = CreateFile(zIn_Dir.c_str(), FILE_LIST_DIRECTORY, FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE,
+		NULL, OPEN_EXISTING, FILE_FLAG_BACKUP_SEMANTICS | FILE_FLAG_OVERLAPPED, NULL);
+	if (hDir == INVALID_HANDLE_VALUE)
+	{
+		errs().format(_T("%s: %s: cannot watch directory"), g_option._program_name.c_str(), zIn_Dir.c_str());
+		errs.print();
+		return EXIT_FAILURE;
+	}
+
+	//the names are those the files would have on the command line, relative to the current
+	//directory when it is the one watched
+	watch_state_t state;
+	if (zIn_Dir != _T("."))
+	{
+		state.prefix = zIn_Dir;
+		if (zIn_Dir[zIn_Dir.length() - 1] != '\\' && zIn_Dir[zIn_Dir.length() - 1] != '/')
+			state.prefix += _T("\\");
+	}
+	state.manifest_path = FullPathLower(g_option._sum_file);
+	str zTemp = g_option._sum_file + _T(".tmp");
+	state.temp_path = FullPathLower(zTemp);
+	state.dirty = true;
+
+	//changes are recorded from here on, anything written during the first scan is seen twice
+	std::vector<DWORD> notify(watch_buffer_size / sizeof(DWORD));
+	OVERLAPPED ov = {};
+	ov.hEvent = CreateEvent(NULL, TRUE, FALSE, NULL);
+	const DWORD dwFilter = FILE_NOTIFY_CHANGE_FILE_NAME | FILE_NOTIFY_CHANGE_DIR_NAME
+		| FILE_NOTIFY_CHANGE_SIZE | FILE_NOTIFY_CHANGE_LAST_WRITE;
+	bool bWatching = ReadDirectoryChangesW(hDir, &notify[0], watch_buffer_size, TRUE, dwFilter, NULL, &ov, NULL) != FALSE;
+
+	std::vector<str> files;
+	ListDirectoryFiles(state.prefix, files);
+	LoadWatchManifest(state, files);
+	UpdateWatchEntries(state, files);
+
+	DWORD dwLastWrite = GetTickCount();
+	if (!WriteWatchManifest(state))
+		bWatching = false;
+
+	while (bWatching)
+	{
+		errs.print();
+		errs.clear();
+
+		//the wait ends at the next change, or when the earliest pending change has settled
+		//or the manifest is due to be rewritten
+		DWORD dwNow = GetTickCount();
+		DWORD dwTimeout = INFINITE;
+		for (std::map<str, DWORD>::iterator it = state.pending.begin(); it != state.pending.end(); ++it)
+		{
+			DWORD dwAge = dwNow - it->second;
+			DWORD dwLeft = dwAge < watch_settle_ms ? watch_settle_ms - dwAge : 0;
+			if (dwLeft < dwTimeout)
+				dwTimeout = dwLeft;
+		}
+		if (state.dirty)
+		{
+			DWORD dwAge = dwNow - dwLastWrite;
+			DWORD dwLeft = dwAge < watch_rewrite_ms ? watch_rewrite_ms - dwAge : 0;
+			if (dwLeft < dwTimeout)
+				dwTimeout = dwLeft;
+		}
+
+		if (WaitForSingleObject(ov.hEvent, dwTimeout) == WAIT_OBJECT_0)
+		{
+			DWORD dwBytes = 0;
+			if (!GetOverlappedResult(hDir, &ov, &dwBytes, FALSE))
+				break;
+
+			if (dwBytes == 0)
+			{
+				//the notification buffer overflowed, the whole tree is compared with the entries
+				files.clear();
+				ListDirectoryFiles(state.prefix, files);
+				std::set<str> present(files.begin(), files.end());
+				for (std::map<str, watch_entry_t>::iterator it = state.entries.begin(); it != state.entries.end(); ++it)
+				{
+					if (present.find(it->first) == present.end())
+						state.pending[it->first] = 0;
+				}
+				UpdateWatchEntries(state, files);
+			}
+			else
+				QueueChanges(state, (BYTE*)&notify[0]);
+
+			ResetEvent(ov.hEvent);
+			if (!ReadDirectoryChangesW(hDir, &notify[0], watch_buffer_size, TRUE, dwFilter, NULL, &ov, NULL))
+				break;
+		}
+
+		ProcessSettledChanges(state);
+
+		if (state.dirty && GetTickCount() - dwLastWrite >= watch_rewrite_ms)
+		{
+			WriteWatchManifest(state);
+			dwLastWrite = GetTickCount();
+		}
+	}
+
+	errs().format(_T("%s: %s: cannot watch directory"), g_option._program_name.c_str(), zIn_Dir.c_str());
+	errs.print();
+	CloseHandle(ov.hEvent);
+	CloseHandle(hDir);
+	return EXIT_FAILURE;
+}
+
+//parses the command line into g_option and files, exits on an invalid command line
+//--connect: the options a --daemon does not serve. They set up the process (priority, NUMA
+//placement, buffers, bandwidth, provider), read standard input, keep state beyond the request
+//or never end; a command line with one of them runs where it is given.
+const int daemon_local_options[] = {
+	-312 /*--tee*/, -316 /*--daemon*/, -318 /*--watch*/, -323 /*--tar*/, -324 /*--chunks*/,
+	-325 /*--no-numa*/, -326 /*--numa-node*/, -327 /*--max-memory*/, -328 /*--large-pages*/,
+	-331 /*--per-line*/, -332 /*--shard*/, -333 /*--merge-results*/, -334 /*--auto-tune*/,
+	-335 /*--read-size*/, -336 /*--bwlimit*/, -337 /*--idle*/, -338 /*--journal*/, -340 /*--quick*/,
+	-342 /*--provider*/, -343 /*--benchmark*/, -344 /*--bench-providers*/ };
+
+bool IsDaemonLocalOption(int value)
+{
+	const int* pEnd = daemon_local_options + sizeof(daemon_local_options) / sizeof(daemon_local_options[0]);
+	return std::find(daemon_local_options, pEnd, value) != pEnd;
+}
+
+void ParseCommandLine(int argc, const TCHAR* argv[], std::vector<str>& files)
+{
+	option::definition optdefs[] = {
+		{_T("--binary"), 'b', option::no_argument},
+		{_T("--check"), 'c', option::no_argument},
+		{_T("--ignore-missing"), -300, option::no_argument},
+		{_T("--quiet"), -301, option::no_argument},
+		{_T("--status"), -302, option::no_argument},
+		{_T("--text"), 't', option::no_argument},
+		{_T("--warn"), 'w', option::no_argument},
+		{_T("--strict"), -303, option::no_argument},
+		{_T("--tag"), -304, option::no_argument},
+		{_T("--zero"), '0', option::no_argument},
+		{_T("--help"), -305, option::no_argument},
+		{_T("--version"), -306, option::no_argument},
+		{_T("--find-duplicates"), -307, option::no_argument},
+		{_T("--diff"), -308, option::no_argument},
+		{_T("--fail-fast"), -309, option::no_argument},
+		{_T("--physical-order"), -310, option::no_argument},
+		{_T("--device-jobs"), -311, option::required_argument},
+		{_T("--tee"), -312, option::optional_argument},
+		{_T("--sum-file"), -313, option::required_argument},
+		{_T("--copy-to"), -314, option::required_argument},
+		{_T("--verify-copy"), -315, option::no_argument},
+		{_T("--daemon"), -316, option::optional_argument},
+		{_T("--connect"), -317, option::optional_argument},
+		{_T("--watch"), -318, option::required_argument},
+		{_T("--index"), -319, option::no_argument},
+		{_T("--convert"), -320, option::no_argument},
+		{_T("--only"), -321, option::required_argument},
+		{_T("--only-from"), -322, option::required_argument},
+		{_T("--tar"), -323, option::optional_argument},
+		{_T("--chunks"), -324, option::optional_argument},
+		{_T("--no-numa"), -325, option::no_argument},
+		{_T("--numa-node"), -326, option::required_argument},
+		{_T("--max-memory"), -327, option::required_argument},
+		{_T("--large-pages"), -328, option::no_argument},
+		{_T("--files-from"), -329, option::required_argument},
+		{_T("--null"), -330, option::no_argument},
+		{_T("--per-line"), -331, option::no_argument},
+		{_T("--shard"), -332, option::required_argument},
+		{_T("--merge-results"), -333, option::no_argument},
+		{_T("--auto-tune"), -334, option::no_argument},
+		{_T("--read-size"), -335, option::required_argument},
+		{_T("--bwlimit"), -336, option::required_argument},
+		{_T("--idle"), -337, option::no_argument},
+		{_T("--journal"), -338, option::required_argument},
+		{_T("--resume"), -339, option::no_argument},
+		{_T("--quick"), -340, option::optional_argument},
+		{_T("--escalate"), -341, option::required_argument},
+		{_T("--provider"), -342, option::required_argument},
+		{_T("--benchmark"), -343, option::no_argument},
+		{_T("--bench-providers"), -344, option::no_argument},
+		option::definition::nullopt() };
+
+	option opt(argc, argv, optdefs);
+
+	while (!opt.is_end())
+	{
+		if (g_option._local_option.empty() && opt.kind() != option::operand && IsDaemonLocalOption(opt.value()))
+			g_option._local_option = opt.optname();
+
+		switch (opt.value())
+		{
+		case 'b':
+			g_option._binary = true;
+			g_option.SetBinaryFlag();
+			break;
+		case 'c':
+			g_option._do_check = true;
+			break;
+		case 't':
+			g_option._binary = false;
+			break;
+		case 'w':
+			g_option._status_only = false;
+			g_option._warn = true;
+			g_option._quiet = false;
+			break;
+		case '0':
+			g_option._delim = _T("");
+			break;
+		case -300:
+			g_option._ignore_missing = true;
+			break;
+		case -301:
+			g_option._status_only = false;
+			g_option._warn = false;
+			g_option._quiet = true;
+			break;
+		case -302:
+			g_option._status_only = true;
+			g_option._warn = false;
+			g_option._quiet = false;
+			break;
+		case -303:
+			g_option._strict = true;
+			break;
+		case -304:
+			g_option._bsd_tag = true;
+			g_option._binary = true;
+			break;
+		case -305:
+			Usage(EXIT_SUCCESS);
+			break;
+		case -306:
+			Version();
+			break;
+		case -307:
+			g_option._find_duplicates = true;
+			break;
+		case -308:
+			g_option._diff = true;
+			break;
+		case -309:
+			g_option._fail_fast = true;
+			break;
+		case -310:
+			g_option._physical_order = true;
+			break;
+		case -311:
+			if (!ParseCount(opt.argstr(), g_option._device_jobs) || g_option._device_jobs == 0)
+			{
+				errs().format(_T("%s: invalid number of device jobs: '%s'"),
+					g_option._program_name.c_str(), opt.argstr().c_str());
+				g_option.DisposeInvalidOption(true);
+			}
+			break;
+		case -312:
+			g_option._tee = true;
+			g_option._tee_file = opt.argstr();
+			break;
+		case -313:
+			g_option._sum_file = opt.argstr();
+			break;
+		case -314:
+			g_option._copy_to = opt.argstr();
+			break;
+		case -315:
+			g_option._verify_copy = true;
+			break;
+		case -316:
+			g_option._daemon = true;
+			g_option._pipe_name = opt.argstr();
+			break;
+		case -317:
+			g_option._connect = true;
+			g_option._pipe_name = opt.argstr();
+			break;
+		case -318:
+			g_option._watch_dir = opt.argstr();
+			break;
+		case -319:
+			g_option._index = true;
+			break;
+		case -320:
+			g_option._convert = true;
+			break;
+		case -321:
+			g_option._only.push_back(opt.argstr());
+			break;
+		case -322:
+			g_option._only_from = opt.argstr();
+			break;
+		case -323:
+			g_option._tar = true;
+			g_option._tar_file = opt.argstr();
+			break;
+		case -324:
+			g_option._chunks = true;
+			if (!opt.argstr().empty() && (!ParseSize(opt.argstr(), g_option._chunk_size)
+				|| g_option._chunk_size == 0 || g_option._chunk_size > max_chunk_size))
+			{
+				errs().format(_T("%s: invalid chunk size: '%s'"),
+					g_option._program_name.c_str(), opt.argstr().c_str());
+				g_option.DisposeInvalidOption(true);
+			}
+			break;
+		case -325:
+			g_option._no_numa = true;
+			break;
+		case -326:
+			if (!ParseCount(opt.argstr(), g_option._numa_node))
+			{
+				errs().format(_T("%s: invalid NUMA node: '%s'"),
+					g_option._program_name.c_str(), opt.argstr().c_str());
+				g_option.DisposeInvalidOption(true);
+			}
+			break;
+		case -327:
+			if (!ParseSize(opt.argstr(), g_option._max_memory) || g_option._max_memory == 0
+				|| g_option._max_memory != (size_t)g_option._max_memory)
+			{
+				errs().format(_T("%s: invalid memory size: '%s'"),
+					g_option._program_name.c_str(), opt.argstr().c_str());
+				g_option.DisposeInvalidOption(true);
+			}
+			break;
+		case -328:
+			g_option._large_pages = true;
+			break;
+		case -329:
+			g_option._files_from = opt.argstr();
+			break;
+		case -330:
+			g_option._files_from_null = true;
+			break;
+		case -331:
+			g_option._per_line = true;
+			break;
+		case -332:
+			if (!ParseShard(opt.argstr(), g_option._shard_index, g_option._shard_count))
+			{
+				errs().format(_T("%s: invalid shard: '%s'"),
+					g_option._program_name.c_str(), opt.argstr().c_str());
+				g_option.DisposeInvalidOption(true);
+			}
+			break;
+		case -333:
+			g_option._merge_results = true;
+			break;
+		case -334:
+			g_option._auto_tune = true;
+			break;
+		case -335:
+			if (!ParseSize(opt.argstr(), g_option._read_size)
+				|| g_option._read_size < min_read_size || g_option._read_size > max_read_size)
+			{
+				errs().format(_T("%s: invalid read size: '%s'"),
+					g_option._program_name.c_str(), opt.argstr().c_str());
+				g_option.DisposeInvalidOption(true);
+			}
+			break;
+		case -336:
+			if (!ParseSize(opt.argstr(), g_option._bwlimit) || g_option._bwlimit == 0)
+			{
+				errs().format(_T("%s: invalid rate: '%s'"),
+					g_option._program_name.c_str(), opt.argstr().c_str());
+				g_option.DisposeInvalidOption(true);
+			}
+			break;
+		case -337:
+			g_option._idle = true;
+			break;
+		case -338:
+			g_option._journal = opt.argstr();
+			break;
+		case -339:
+			g_option._resume = true;
+			break;
+		case -340:
+			g_option._quick_samples = default_quick_samples;
+			if (!opt.argstr().empty() && (!ParseCount(opt.argstr(), g_option._quick_samples)
+				|| g_option._quick_samples == 0 || g_option._quick_samples > max_quick_samples))
+			{
+				errs().format(_T("%s: invalid number of quick samples: '%s'"),
+					g_option._program_name.c_str(), opt.argstr().c_str());
+				g_option.DisposeInvalidOption(true);
+			}
+			break;
+		case -341:
+			g_option._escalate_file = opt.argstr();
+			break;
+		case -342:
+			if (!ParseProvider(opt.argstr(), g_option._provider))
+			{
+				errs().format(_T("%s: invalid provider: '%s'"),
+					g_option._program_name.c_str(), opt.argstr().c_str());
+				g_option.DisposeInvalidOption(true);
+			}
+			break;
+		case -343:
+			g_option._benchmark = true;
+			break;
+		case -344:
+			g_option._bench_providers = true;
+			break;
+		default:
+			if (opt.kind() == option::operand)
+			{
+				ParseFileName(files, opt.optname());
+				break;
+			}
+			else
+				g_option.DisposeInvalidOption(opt.has_error());
+		}
+		opt.to_next();
+	}
+
+	g_option.DisposeOptionConflict();
+
+	if (g_option._daemon && argc != 2)
+	{
+		errs().format(_T("%s: --daemon takes no other option or FILE"), g_option._program_name.c_str());
+		errs.print();
+		Usage(EXIT_FAILURE);
+	}
+
+	if (!g_option._watch_dir.empty() && !files.empty())
+	{
+		errs().format(_T("%s: --watch takes no FILE"), g_option._program_name.c_str());
+		errs.print();
+		Usage(EXIT_FAILURE);
+	}
+
+	if (g_option._tee)
+	{
+		if (files.empty())
+			files.push_back(_T("-"));
+		if (files.size() != 1 || files[0] != _T("-"))
+		{
+			errs().format(_T("%s: --tee reads standard input only"), g_option._program_name.c_str());
+			errs.print();
+			Usage(EXIT_FAILURE);
+		}
+	}
+
+	if (g_option._bench_providers && !files.empty())
+	{
+		errs().format(_T("%s: --bench-providers takes no FILE"), g_option._program_name.c_str());
+		errs.print();
+		Usage(EXIT_FAILURE);
+	}
+
+	if (!g_option._files_from.empty() && !files.empty())
+	{
+		errs().format(_T("%s: --files-from takes no FILE"), g_option._program_name.c_str());
+		errs.print();
+		Usage(EXIT_FAILURE);
+	}
+
+	if (g_option._tar && !g_option._do_check && files.empty() && g_option._files_from.empty())
+		files.push_back(_T("-"));
+
+	if (g_option._per_line && files.empty())
+		files.push_back(_T("-"));
+
+	if (g_option._tar && g_option._do_check && g_option._tar_file.empty()
+		&& (files.size() != 1 || files[0] == _T("-")))
+	{
+		errs().format(_T("%s: --tar without an ARCHIVE reads it from standard input, give one checksum file"),
+			g_option._program_name.c_str());
+		errs.print();
+		Usage(EXIT_FAILURE);
+	}
+
+	if (!g_option._journal.empty()
+		&& (files.empty() || std::find(files.begin(), files.end(), str(_T("-"))) != files.end()))
+	{
+		errs().format(_T("%s: --journal cannot resume standard input, give checksum files"),
+			g_option._program_name.c_str());
+		errs.print();
+		Usage(EXIT_FAILURE);
+	}
+
+	if (g_option._benchmark
+		&& (files.empty() || std::find(files.begin(), files.end(), str(_T("-"))) != files.end()))
+	{
+		errs().format(_T("%s: --benchmark reads each FILE more than once, it cannot read standard input"),
+			g_option._program_name.c_str());
+		errs.print();
+		Usage(EXIT_FAILURE);
+	}
+
+	if (g_option._quick_samples != 0 && !g_option._do_check
+		&& (files.empty() || std::find(files.begin(), files.end(), str(_T("-"))) != files.end()))
+	{
+		errs().format(_T("%s: --quick samples files, it cannot read standard input"), g_option._program_name.c_str());
+		errs.print();
+		Usage(EXIT_FAILURE);
+	}
+
+	if (g_option._diff && files.size() != 2)
+	{
+		errs().format(_T("%s: --diff requires exactly two checksum files, OLD and NEW"),
+			g_option._program_name.c_str());
+		errs.print();
+		Usage(EXIT_FAILURE);
+	}
+
+	if (g_option._convert && files.size() != 1)
+	{
+		errs().format(_T("%s: --convert requires exactly one checksum file"), g_option._program_name.c_str());
+		errs.print();
+		Usage(EXIT_FAILURE);
+	}
+}
+
+//runs what the command line asks for, prints the results and returns the exit status
+int RunCommandLine(std::vector<str>& files)
+{
+	g_only.paths.clear();
+	for (size_t i = 0; i < g_option._only.size(); i++)
+		g_only.add(g_option._only[i]);
+	if (!g_option._only_from.empty() && !LoadOnlyPaths(g_option._only_from))
+	{
+		errs.print();
+		return EXIT_FAILURE;
+	}
+
+	if (g_option._tar && g_option._tar_file.empty())
+		g_option._tar_file = _T("-");
+
+	//--provider: the native provider computes what the provider has no algorithm for here
+	hash_provider* provider = GetProvider(g_option._provider);
+	if (provider == NULL || !provider->open(g_option._digest_alg))
+	{
+		errs(1).format(_T("%s: the %s provider has no %s here, using the native one"), g_option._program_name.c_str(),
+			provider_names[g_option._provider], g_option._digest_alg_name.c_str());
+		g_option._provider = NATIVE_PROVIDER;
+	}
+
+	//--journal: a new check starts a new journal
+	g_journal.clear();
+	if (g_option._resume && !g_journal.load())
+	{
+		errs.print();
+		return EXIT_FAILURE;
+	}
+
+	if (g_option._chunks && !g_option._do_check && g_option._chunk_size == 0)
+		g_option._chunk_size = default_chunk_size;
+
+	if (g_option._tee)
+	{
+		if (g_option._tee_file.is_null() || g_option._tee_file == _T("-"))
+		{
+			g_tee = stdout;
+			_setmode(_fileno(stdout), _O_BINARY);
+			outs.set_outstream(stderr); //standard output carries the data
+		}
+		else if (_tfopen_s(&g_tee, g_option._tee_file.c_str(), _T("wb")) != 0 || g_tee == NULL)
+		{
+			errs().format(_T("%s: %s: cannot create file"),
+				g_option._program_name.c_str(), g_option._tee_file.c_str());
+			errs.print();
+			return EXIT_FAILURE;
+		}
+	}
+
+	if (!g_option._copy_to.empty())
+	{
+		DWORD dwAttributes = GetFileAttributes(g_option._copy_to.c_str());
+		if (dwAttributes == INVALID_FILE_ATTRIBUTES)
+		{
+			if (!CreateDirectory(g_option._copy_to.c_str(), NULL))
+			{
+				errs().format(_T("%s: %s: cannot create directory"),
+					g_option._program_name.c_str(), g_option._copy_to.c_str());
+				errs.print();
+				return EXIT_FAILURE;
+			}
+		}
+		else if (!(dwAttributes & FILE_ATTRIBUTE_DIRECTORY))
+		{
+			errs().format(_T("%s: %s: not a directory"),
+				g_option._program_name.c_str(), g_option._copy_to.c_str());
+			errs.print();
+			return EXIT_FAILURE;
+		}
+	}
+
+	//a resumed check adds to the lines escalated before it was interrupted; those of the batches
+	//after the last save of the journal are escalated again
+	if (!g_option._escalate_file.empty() && (_tfopen_s(&g_escalate, g_option._escalate_file.c_str(),
+		g_journal.resuming() ? _T("a") : _T("w")) != 0 || g_escalate == NULL))
+	{
+		errs().format(_T("%s: %s: cannot create file"),
+			g_option._program_name.c_str(), g_option._escalate_file.c_str());
+		errs.print();
+		return EXIT_FAILURE;
+	}
+
+	//the manifest of --watch is kept, not truncated
+	if (!g_option._watch_dir.empty())
+		return WatchDirectory(g_option._watch_dir);
+
+	//an index is written by WriteManifestIndex
+	FILE* fSum = NULL;
+	if (!g_option._sum_file.is_null() && !g_option._index)
+	{
+		if (_tfopen_s(&fSum, g_option._sum_file.c_str(), _T("w")) != 0 || fSum == NULL)
+		{
+			errs().format(_T("%s: %s: cannot create file"),
+				g_option._program_name.c_str(), g_option._sum_file.c_str());
+			errs.print();
+			return EXIT_FAILURE;
+		}
+		outs.set_outstream(fSum);
+	}
 
 	struct RUN_T
 	{
@@ -888,20 +6462,384 @@ int main(int argc, const TCHAR* argv[])
 
 		void operator()(str& zFile)
 		{
-			if (g_option._do_check)
-			{
-				if (!DigestCheck(zFile))
-					status = EXIT_FAILURE;
-			}
-			else
-			{
-				if (!DigestFile(zFile))
-					status = EXIT_FAILURE;
-			}
+			if (g_cancel) //--fail-fast: a previous checksum file failed
+				return;
+
+			if (!DigestCheck(zFile))
+				status = EXIT_FAILURE;
 		}
 	} _run;
-	std::for_each(files.begin(), files.end(), _run);
+
+	if (g_option._find_duplicates)
+	{
+		if (!FindDuplicates(files))
+			_run.status = EXIT_FAILURE;
+	}
+	else if (g_option._convert)
+	{
+		if (!ConvertManifest(files[0]))
+			_run.status = EXIT_FAILURE;
+	}
+	else if (g_option._diff)
+	{
+		if (!DiffManifests(files[0], files[1]))
+			_run.status = EXIT_FAILURE;
+	}
+	else if (g_option._do_check)
+	{
+		_run = std::for_each(files.begin(), files.end(), _run);
+		if (!g_cancel && !ReportUnmatchedPaths())
+			_run.status = EXIT_FAILURE;
+		if (!g_option._journal.empty() && !g_cancel)
+			g_journal.discard();
+	}
+	else if (!g_option._files_from.empty())
+	{
+		if (!DigestFilesFrom(g_option._files_from))
+			_run.status = EXIT_FAILURE;
+	}
+	else if (g_option._merge_results)
+	{
+		if (!MergeResults(files))
+			_run.status = EXIT_FAILURE;
+	}
+	else if (g_option._benchmark)
+	{
+		if (!BenchmarkProviders(files))
+			_run.status = EXIT_FAILURE;
+	}
+	else if (g_option._bench_providers)
+	{
+		if (!BenchAllProviders())
+			_run.status = EXIT_FAILURE;
+	}
+	else if (g_option._per_line)
+	{
+		for (size_t i = 0; i < files.size() && !g_cancel; i++)
+		{
+			if (!DigestFileRecords(files[i]))
+				_run.status = EXIT_FAILURE;
+		}
+	}
+	else
+	{
+		if (!DigestFiles(files))
+			_run.status = EXIT_FAILURE;
+	}
+	if (g_tee != NULL)
+	{
+		if (fflush(g_tee) != 0 || ferror(g_tee) || (g_tee != stdout && fclose(g_tee) != 0))
+		{
+			errs().format(_T("%s: %s: write error"), g_option._program_name.c_str(),
+				g_tee == stdout ? _T("standard output") : g_option._tee_file.c_str());
+			_run.status = EXIT_FAILURE;
+		}
+	}
+	if (g_escalate != NULL && (ferror(g_escalate) || fclose(g_escalate) != 0))
+	{
+		errs().format(_T("%s: %s: write error"), g_option._program_name.c_str(), g_option._escalate_file.c_str());
+		_run.status = EXIT_FAILURE;
+	}
+
+	if (g_option._auto_tune)
+		g_tuner.report();
+
 	outs.print();
+	if (fSum != NULL && fclose(fSum) != 0)
+	{
+		errs().format(_T("%s: %s: write error"), g_option._program_name.c_str(), g_option._sum_file.c_str());
+		_run.status = EXIT_FAILURE;
+	}
 	errs.print();
 	return _run.status;
 }
+
+//--daemon and --connect: a request is a magic number, the number of strings and the strings,
+//each a length in TCHARs and the characters: the client's current directory and its command
+//line. The reply is the exit status, the standard output and the standard error.
+const DWORD pipe_request_magic = 0x54474944;
+const DWORD max_pipe_string = 64 * 1024 * 1024;
+
+str PipePath(str& zIn_PipeName)
+{
+	str zPath = _T("\\\\.\\pipe\\");
+	if (zIn_PipeName.empty())
+		zPath += _T("digest-checksum-tools");
+	else
+		zPath += zIn_PipeName;
+	return zPath;
+}
+
+bool ReadPipe(HANDLE hPipe, void* pBuffer, DWORD dwBytes)
+{
+	BYTE* pbBuffer = (BYTE*)pBuffer;
+	DWORD dwBytesRead = 0;
+	while (dwBytes > 0)
+	{
+		if (!ReadFile(hPipe, pbBuffer, dwBytes, &dwBytesRead, NULL) || dwBytesRead == 0)
+			return false;
+		pbBuffer += dwBytesRead;
+		dwBytes -= dwBytesRead;
+	}
+	return true;
+}
+
+bool WritePipe(HANDLE hPipe, const void* pBuffer, DWORD dwBytes)
+{
+	const BYTE* pbBuffer = (const BYTE*)pBuffer;
+	DWORD dwBytesWritten = 0;
+	while (dwBytes > 0)
+	{
+		if (!WriteFile(hPipe, pbBuffer, dwBytes, &dwBytesWritten, NULL) || dwBytesWritten == 0)
+			return false;
+		pbBuffer += dwBytesWritten;
+		dwBytes -= dwBytesWritten;
+	}
+	return true;
+}
+
+bool ReadPipeString(HANDLE hPipe, str& zOut_String)
+{
+	DWORD dwLen = 0;
+	if (!ReadPipe(hPipe, &dwLen, sizeof(dwLen)) || dwLen > max_pipe_string)
+		return false;
+
+	std::vector<TCHAR> text(dwLen + 1);
+	if (!ReadPipe(hPipe, &text[0], dwLen * sizeof(TCHAR)))
+		return false;
+	zOut_String = str(&text[0], dwLen);
+	return true;
+}
+
+bool WritePipeString(HANDLE hPipe, str& zIn_String)
+{
+	DWORD dwLen = (DWORD)zIn_String.length();
+	return dwLen <= max_pipe_string
+		&& WritePipe(hPipe, &dwLen, sizeof(dwLen))
+		&& WritePipe(hPipe, zIn_String.c_str(), dwLen * sizeof(TCHAR));
+}
+
+//a command line the daemon can run, with FILEs and neither standard input nor a local option
+bool IsDaemonRequest(std::vector<str>& files)
+{
+	return !files.empty() && g_option._local_option.empty() && g_option._only_from != _T("-")
+		&& std::find(files.begin(), files.end(), str(_T("-"))) == files.end();
+}
+
+//runs one request of a client as a fresh process would, only the work pool, the volume limits
+//and the digest cache are kept. The client has parsed the same command line without error, but
+//the request is parsed again in case it hasn't: an invalid one is answered with its exit status.
+void ServeRequest(HANDLE hPipe)
+{
+	DWORD dwMagic = 0, nStrings = 0;
+	if (!ReadPipe(hPipe, &dwMagic, sizeof(dwMagic)) || dwMagic != pipe_request_magic
+		|| !ReadPipe(hPipe, &nStrings, sizeof(nStrings)) || nStrings < 3 || nStrings > 65536)
+		return;
+
+	strs args(nStrings);
+	for (size_t i = 0; i < args.size(); i++)
+	{
+		if (!ReadPipeString(hPipe, args[i]))
+			return;
+	}
+
+	std::vector<const TCHAR*> argv;
+	for (size_t i = 1; i < args.size(); i++)
+		argv.push_back(args[i].c_str());
+	int argc = (int)argv.size();
+	argv.push_back(NULL);
+
+	g_option = global_options_struct();
+	g_cancel = 0;
+	g_tee = NULL;
+	g_escalate = NULL;
+	g_copy_destinations.clear();
+	outs.set_outstream(stdout);
+	outs.set_delimiter(_T("\n"));
+
+	str zOut, zErr;
+	outs.set_capture(&zOut);
+	errs.set_capture(&zErr);
+	helpmsgs.set_capture(&zOut);
+
+	int status = EXIT_FAILURE;
+	g_option.InitMain(argc, &argv[0]);
+	if (!SetCurrentDirectory(args[0].c_str()))
+	{
+		errs().format(_T("%s: %s: cannot change directory"), g_option._program_name.c_str(), args[0].c_str());
+		errs.print();
+	}
+	else
+	{
+		std::vector<str> files;
+		bool bParsed = false;
+		g_serving_request = true;
+		try
+		{
+			ParseCommandLine(argc, &argv[0], files);
+			bParsed = true;
+		}
+		catch (request_exit_t& request_exit)
+		{
+			status = request_exit.status;
+		}
+		g_serving_request = false;
+		if (bParsed && !IsDaemonRequest(files))
+		{
+			errs().format(_T("%s: %s: not served by the daemon, run the command without --connect"),
+				g_option._program_name.c_str(), g_option._local_option.empty() ? _T("standard input") : g_option._local_option.c_str());
+			errs.print();
+		}
+		else if (bParsed)
+			status = RunCommandLine(files);
+	}
+
+	outs.clear();
+	errs.clear();
+	helpmsgs.clear();
+	outs.set_capture(NULL);
+	errs.set_capture(NULL);
+	helpmsgs.set_capture(NULL);
+
+	DWORD dwStatus = (DWORD)status;
+	WritePipe(hPipe, &dwStatus, sizeof(dwStatus)) && WritePipeString(hPipe, zOut) && WritePipeString(hPipe, zErr);
+}
+
+//--daemon: serves the requests one at a time until killed, a client arriving meanwhile waits
+//for the pipe in WaitNamedPipe.
+int RunDaemon()
+{
+	str zPipe = PipePath(g_option._pipe_name);
+	HANDLE hPipe = CreateNamedPipe(zPipe.c_str(), PIPE_ACCESS_DUPLEX | FILE_FLAG_FIRST_PIPE_INSTANCE,
+		PIPE_TYPE_BYTE | PIPE_READMODE_BYTE | PIPE_WAIT | PIPE_REJECT_REMOTE_CLIENTS, 1, 64 * 1024, 64 * 1024, 0, NULL);
+	if (hPipe == INVALID_HANDLE_VALUE)
+	{
+		errs().format(_T("%s: %s: cannot create pipe, or a daemon is already serving on it"),
+			g_option._program_name.c_str(), zPipe.c_str());
+		errs.print();
+		return EXIT_FAILURE;
+	}
+
+	digest_cache cache;
+	g_cache = &cache;
+
+	while (true)
+	{
+		if (ConnectNamedPipe(hPipe, NULL) || GetLastError() == ERROR_PIPE_CONNECTED)
+			ServeRequest(hPipe);
+		FlushFileBuffers(hPipe);
+		DisconnectNamedPipe(hPipe);
+	}
+}
+
+//--connect: false when there is no daemon to do the work, which is then done here. Standard
+//input and the options of daemon_local_options stay here as well, the daemon cannot read the
+//client's standard input.
+bool RunOnDaemon(int argc, const TCHAR* argv[], std::vector<str>& files, int& nOut_Status)
+{
+	if (!IsDaemonRequest(files))
+		return false;
+
+	TCHAR szCurrentDir[MAX_PATH];
+	DWORD dwLen = GetCurrentDirectory(MAX_PATH, szCurrentDir);
+	if (dwLen == 0 || dwLen >= MAX_PATH)
+		return false;
+
+	str zPipe = PipePath(g_option._pipe_name);
+	HANDLE hPipe;
+	while ((hPipe = CreateFile(zPipe.c_str(), GENERIC_READ | GENERIC_WRITE, 0, NULL, OPEN_EXISTING, 0, NULL)) == INVALID_HANDLE_VALUE)
+	{
+		if (GetLastError() != ERROR_PIPE_BUSY || !WaitNamedPipe(zPipe.c_str(), NMPWAIT_WAIT_FOREVER))
+			return false;
+	}
+
+	//the daemon gets the command line without --connect, the operands after "--" are kept as they are
+	strs args;
+	args.push_back(szCurrentDir);
+	bool bOperands = false;
+	for (int i = 0; i < argc; i++)
+	{
+		str zArg = argv[i];
+		if (i > 0 && !bOperands && zArg == _T("--"))
+			bOperands = true;
+		else if (i > 0 && !bOperands && (zArg == _T("--connect") || zArg.find(_T("--connect=")) == 0))
+			continue;
+		args.push_back(zArg);
+	}
+
+	DWORD dwMagic = pipe_request_magic, nStrings = (DWORD)args.size();
+	bool bSent = WritePipe(hPipe, &dwMagic, sizeof(dwMagic)) && WritePipe(hPipe, &nStrings, sizeof(nStrings));
+	for (size_t i = 0; bSent && i < args.size(); i++)
+		bSent = WritePipeString(hPipe, args[i]);
+
+	DWORD dwStatus = 0;
+	str zOut, zErr;
+	if (bSent && ReadPipe(hPipe, &dwStatus, sizeof(dwStatus))
+		&& ReadPipeString(hPipe, zOut) && ReadPipeString(hPipe, zErr))
+	{
+		_fputts(zOut.c_str(), stdout);
+		_fputts(zErr.c_str(), stderr);
+		nOut_Status = (int)dwStatus;
+	}
+	else
+	{
+		errs().format(_T("%s: %s: connection to the daemon lost"), g_option._program_name.c_str(), zPipe.c_str());
+		errs.print();
+		nOut_Status = EXIT_FAILURE;
+	}
+
+	CloseHandle(hPipe);
+	return true;
+}
+
+int main(int argc, const TCHAR* argv[])
+{
+	g_option.InitMain(argc, argv);
+
+	if (argc == 1)
+	{
+		errs().format(_T("%s: requires argument(s)."), g_option._program_name.c_str());
+		g_option.DisposeInvalidOption(true);
+	}
+
+	std::vector<str> files;
+	ParseCommandLine(argc, argv, files);
+
+	//the workers are placed once, a daemon keeps the placement of its own command line
+	if (!g_pool.set_placement(!g_option._no_numa, g_option._numa_node == ~0UL ? -1 : (LONG)g_option._numa_node))
+	{
+		errs().format(_T("%s: no processors on NUMA node %lu"), g_option._program_name.c_str(), g_option._numa_node);
+		errs.print();
+		return EXIT_FAILURE;
+	}
+
+	g_buffers.set_limit(g_option._max_memory != 0 ? (size_t)g_option._max_memory : default_max_memory);
+	if (g_option._large_pages && !g_buffers.enable_large_pages())
+	{
+		errs(1).format(_T("%s: WARNING: large pages need the 'Lock pages in memory' privilege, using normal pages"),
+			g_option._program_name.c_str());
+		errs.print();
+		errs.clear();
+	}
+
+	g_bandwidth.set_rate(g_option._bwlimit);
+
+	//--idle: the CPU priority is lowered first, background mode then lowers the I/O and memory
+	//priorities of the process as well
+	if (g_option._idle && (!SetPriorityClass(GetCurrentProcess(), IDLE_PRIORITY_CLASS)
+		|| !SetPriorityClass(GetCurrentProcess(), PROCESS_MODE_BACKGROUND_BEGIN)))
+	{
+		errs(1).format(_T("%s: WARNING: cannot lower the priority of the process"), g_option._program_name.c_str());
+		errs.print();
+		errs.clear();
+	}
+
+	if (g_option._daemon)
+		return RunDaemon();
+
+	int status;
+	if (g_option._connect && RunOnDaemon(argc, argv, files, status))
+		return status;
+
+	return RunCommandLine(files);
+}
@@ -198,7 +198,9 @@ private:
 
 		while (*def != nullopt)
 		{
-			if (optstr.find(def->optname, 0) == 0)
+			//the whole name must match, "--only-from" is not "--only" with "-from" after it
+			str::size_type len = def->optname.length();
+			if (optstr.compare(0, len, def->optname) == 0 && (optstr[len] == '\0' || optstr[len] == '='))
 			{
 				opt = *def;
 				return true;
@@ -354,12 +356,12 @@ private:
 	{
 		struct
 		{
-			bool operator()(definition& a, definition& b) const
+			bool operator()(const definition& a, const definition& b) const
 			{
 				return a.kind < b.kind;
 			}
 		} ascend_order_by_kind;
-		std::sort(_optlist.begin(), _optlist.end(), ascend_order_by_kind);
+		std::stable_sort(_optlist.begin(), _optlist.end(), ascend_order_by_kind); //operands keep their command line order
 	}
 
 public:
@@ -0,0 +1,458 @@
+/*
+ Reference hash engines - Portable scalar MD5 and SHA digests for the digest
+ checksum tools, written in C++ for Windows platform:
+ MD5     - RFC 1321.
+ SHA1    - FIPS 180-4.
+ SHA256  - FIPS 180-4.
+ SHA384  - FIPS 180-4.
+ SHA512  - FIPS 180-4.
+ Straight from the specifications, one block at a time and no intrinsics: the
+ baseline the other providers are measured and checked against.
+ https://github.com/fshb/digest-checksum-tools/
+ Copyright (c) 2019 Sun Hongbo (Felix)
+
+ Permission is hereby granted, free of charge, to any person obtaining a copy
+ of this Software and associated documentation files (the "Software"), to deal
+ in the Software without restriction, including without limitation the rights
+ to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ copies of the Software, and to permit persons to whom the Software is
+ furnished to do so, subject to the following conditions:
+
+ The above copyright notice and this permission notice shall be included in
+ all copies or substantial portions of the Software.
+
+ THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ THE SOFTWARE.
+*/
+#pragma once
+
+#include "fasthash.h"
+
+namespace refhash
+{
+	inline uint32_t read32_be(const BYTE* p)
+	{
+		return (uint32_t)p[0] << 24 | (uint32_t)p[1] << 16 | (uint32_t)p[2] << 8 | p[3];
+	}
+
+	inline uint64_t read64_be(const BYTE* p)
+	{
+		return (uint64_t)read32_be(p) << 32 | read32_be(p + 4);
+	}
+
+	inline void write32_be(BYTE* p, uint32_t v)
+	{
+		p[0] = (BYTE)(v >> 24);
+		p[1] = (BYTE)(v >> 16);
+		p[2] = (BYTE)(v >> 8);
+		p[3] = (BYTE)v;
+	}
+
+	inline uint32_t read32_le(const BYTE* p)
+	{
+		return (uint32_t)p[3] << 24 | (uint32_t)p[2] << 16 | (uint32_t)p[1] << 8 | p[0];
+	}
+
+	inline void write32_le(BYTE* p, uint32_t v)
+	{
+		p[0] = (BYTE)v;
+		p[1] = (BYTE)(v >> 8);
+		p[2] = (BYTE)(v >> 16);
+		p[3] = (BYTE)(v >> 24);
+	}
+
+	inline uint64_t rotr64(uint64_t v, int n) { return (v >> n) | (v << (64 - n)); }
+}
+
+//the buffering and the padding of a Merkle-Damgard hash with BlockLen bytes blocks, the
+//message length in bits ends the last block: little endian for MD5, big endian for SHA
+template<size_t BlockLen, bool BigEndianLength>
+class md_block_hasher : public digest_hasher
+{
+private:
+	BYTE _block[BlockLen];
+	size_t _buffered;
+	uint64_t _total_len;
+
+protected:
+	md_block_hasher() : _buffered(0), _total_len(0) {}
+
+	virtual void compress(const BYTE* block) = 0;
+
+	//the 0x80 byte, zeros and the length, then the last block(s)
+	void pad()
+	{
+		const size_t length_len = BlockLen / 8; //8 bytes, 16 for the 128 bytes blocks
+		uint64_t bits = _total_len * 8;
+		_block[_buffered++] = 0x80;
+		if (_buffered > BlockLen - length_len)
+		{
+			memset(_block + _buffered, 0, BlockLen - _buffered);
+			compress(_block);
+			_buffered = 0;
+		}
+		memset(_block + _buffered, 0, BlockLen - _buffered);
+		for (size_t i = 0; i < 8; i++)
+		{
+			if (BigEndianLength)
+				_block[BlockLen - 1 - i] = (BYTE)(bits >> (8 * i));
+			else
+				_block[BlockLen - length_len + i] = (BYTE)(bits >> (8 * i));
+		}
+		compress(_block);
+	}
+
+public:
+	void update(const BYTE* data, size_t len)
+	{
+		_total_len += len;
+		if (_buffered > 0)
+		{
+			size_t take = BlockLen - _buffered;
+			if (take > len)
+				take = len;
+			memcpy(_block + _buffered, data, take);
+			_buffered += take;
+			data += take;
+			len -= take;
+			if (_buffered < BlockLen)
+				return;
+			compress(_block);
+			_buffered = 0;
+		}
+		while (len >= BlockLen)
+		{
+			compress(data);
+			data += BlockLen;
+			len -= BlockLen;
+		}
+		memcpy(_block, data, len);
+		_buffered = len;
+	}
+};
+
+//MD5 (RFC 1321), 128 bits output
+class md5_reference : public md_block_hasher<64, false>
+{
+private:
+	uint32_t _h[4];
+
+protected:
+	void compress(const BYTE* block)
+	{
+		static const uint32_t K[64] = {
+			0xd76aa478, 0xe8c7b756, 0x242070db, 0xc1bdceee, 0xf57c0faf, 0x4787c62a, 0xa8304613, 0xfd469501,
+			0x698098d8, 0x8b44f7af, 0xffff5bb1, 0x895cd7be, 0x6b901122, 0xfd987193, 0xa679438e, 0x49b40821,
+			0xf61e2562, 0xc040b340, 0x265e5a51, 0xe9b6c7aa, 0xd62f105d, 0x02441453, 0xd8a1e681, 0xe7d3fbc8,
+			0x21e1cde6, 0xc33707d6, 0xf4d50d87, 0x455a14ed, 0xa9e3e905, 0xfcefa3f8, 0x676f02d9, 0x8d2a4c8a,
+			0xfffa3942, 0x8771f681, 0x6d9d6122, 0xfde5380c, 0xa4beea44, 0x4bdecfa9, 0xf6bb4b60, 0xbebfbc70,
+			0x289b7ec6, 0xeaa127fa, 0xd4ef3085, 0x04881d05, 0xd9d4d039, 0xe6db99e5, 0x1fa27cf8, 0xc4ac5665,
+			0xf4292244, 0x432aff97, 0xab9423a7, 0xfc93a039, 0x655b59c3, 0x8f0ccc92, 0xffeff47d, 0x85845dd1,
+			0x6fa87e4f, 0xfe2ce6e0, 0xa3014314, 0x4e0811a1, 0xf7537e82, 0xbd3af235, 0x2ad7d2bb, 0xeb86d391 };
+		static const int S[64] = {
+			7, 12, 17, 22, 7, 12, 17, 22, 7, 12, 17, 22, 7, 12, 17, 22,
+			5, 9, 14, 20, 5, 9, 14, 20, 5, 9, 14, 20, 5, 9, 14, 20,
+			4, 11, 16, 23, 4, 11, 16, 23, 4, 11, 16, 23, 4, 11, 16, 23,
+			6, 10, 15, 21, 6, 10, 15, 21, 6, 10, 15, 21, 6, 10, 15, 21 };
+
+		uint32_t m[16];
+		for (size_t i = 0; i < 16; i++)
+			m[i] = refhash::read32_le(block + 4 * i);
+
+		uint32_t a = _h[0], b = _h[1], c = _h[2], d = _h[3];
+		for (size_t i = 0; i < 64; i++)
+		{
+			uint32_t f;
+			size_t g;
+			if (i < 16)
+			{
+				f = (b & c) | (~b & d);
+				g = i;
+			}
+			else if (i < 32)
+			{
+				f = (d & b) | (~d & c);
+				g = (5 * i + 1) % 16;
+			}
+			else if (i < 48)
+			{
+				f = b ^ c ^ d;
+				g = (3 * i + 5) % 16;
+			}
+			else
+			{
+				f = c ^ (b | ~d);
+				g = (7 * i) % 16;
+			}
+			uint32_t t = d;
+			d = c;
+			c = b;
+			b = b + fasthash::rotl32(a + f + K[i] + m[g], S[i]);
+			a = t;
+		}
+		_h[0] += a;
+		_h[1] += b;
+		_h[2] += c;
+		_h[3] += d;
+	}
+
+public:
+	md5_reference()
+	{
+		_h[0] = 0x67452301;
+		_h[1] = 0xefcdab89;
+		_h[2] = 0x98badcfe;
+		_h[3] = 0x10325476;
+	}
+
+	DWORD finish(BYTE* digest)
+	{
+		pad();
+		for (size_t i = 0; i < 4; i++)
+			refhash::write32_le(digest + 4 * i, _h[i]);
+		return 16;
+	}
+};
+
+//SHA-1 (FIPS 180-4), 160 bits output
+class sha1_reference : public md_block_hasher<64, true>
+{
+private:
+	uint32_t _h[5];
+
+protected:
+	void compress(const BYTE* block)
+	{
+		uint32_t w[80];
+		for (size_t i = 0; i < 16; i++)
+			w[i] = refhash::read32_be(block + 4 * i);
+		for (size_t i = 16; i < 80; i++)
+			w[i] = fasthash::rotl32(w[i - 3] ^ w[i - 8] ^ w[i - 14] ^ w[i - 16], 1);
+
+		uint32_t a = _h[0], b = _h[1], c = _h[2], d = _h[3], e = _h[4];
+		for (size_t i = 0; i < 80; i++)
+		{
+			uint32_t f, k;
+			if (i < 20)
+			{
+				f = (b & c) | (~b & d);
+				k = 0x5a827999;
+			}
+			else if (i < 40)
+			{
+				f = b ^ c ^ d;
+				k = 0x6ed9eba1;
+			}
+			else if (i < 60)
+			{
+				f = (b & c) | (b & d) | (c & d);
+				k = 0x8f1bbcdc;
+			}
+			else
+			{
+				f = b ^ c ^ d;
+				k = 0xca62c1d6;
+			}
+			uint32_t t = fasthash::rotl32(a, 5) + f + e + k + w[i];
+			e = d;
+			d = c;
+			c = fasthash::rotl32(b, 30);
+			b = a;
+			a = t;
+		}
+		_h[0] += a;
+		_h[1] += b;
+		_h[2] += c;
+		_h[3] += d;
+		_h[4] += e;
+	}
+
+public:
+	sha1_reference()
+	{
+		_h[0] = 0x67452301;
+		_h[1] = 0xefcdab89;
+		_h[2] = 0x98badcfe;
+		_h[3] = 0x10325476;
+		_h[4] = 0xc3d2e1f0;
+	}
+
+	DWORD finish(BYTE* digest)
+	{
+		pad();
+		for (size_t i = 0; i < 5; i++)
+			refhash::write32_be(digest + 4 * i, _h[i]);
+		return 20;
+	}
+};
+
+//SHA-256 (FIPS 180-4), 256 bits output
+class sha256_reference : public md_block_hasher<64, true>
+{
+private:
+	uint32_t _h[8];
+
+protected:
+	void compress(const BYTE* block)
+	{
+		static const uint32_t K[64] = {
+			0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+			0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+			0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+			0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+			0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+			0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+			0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+			0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2 };
+
+		uint32_t w[64];
+		for (size_t i = 0; i < 16; i++)
+			w[i] = refhash::read32_be(block + 4 * i);
+		for (size_t i = 16; i < 64; i++)
+		{
+			uint32_t s0 = fasthash::rotr32(w[i - 15], 7) ^ fasthash::rotr32(w[i - 15], 18) ^ (w[i - 15] >> 3);
+			uint32_t s1 = fasthash::rotr32(w[i - 2], 17) ^ fasthash::rotr32(w[i - 2], 19) ^ (w[i - 2] >> 10);
+			w[i] = w[i - 16] + s0 + w[i - 7] + s1;
+		}
+
+		uint32_t a = _h[0], b = _h[1], c = _h[2], d = _h[3], e = _h[4], f = _h[5], g = _h[6], h = _h[7];
+		for (size_t i = 0; i < 64; i++)
+		{
+			uint32_t s1 = fasthash::rotr32(e, 6) ^ fasthash::rotr32(e, 11) ^ fasthash::rotr32(e, 25);
+			uint32_t ch = (e & f) ^ (~e & g);
+			uint32_t t1 = h + s1 + ch + K[i] + w[i];
+			uint32_t s0 = fasthash::rotr32(a, 2) ^ fasthash::rotr32(a, 13) ^ fasthash::rotr32(a, 22);
+			uint32_t maj = (a & b) ^ (a & c) ^ (b & c);
+			uint32_t t2 = s0 + maj;
+			h = g;
+			g = f;
+			f = e;
+			e = d + t1;
+			d = c;
+			c = b;
+			b = a;
+			a = t1 + t2;
+		}
+		_h[0] += a;
+		_h[1] += b;
+		_h[2] += c;
+		_h[3] += d;
+		_h[4] += e;
+		_h[5] += f;
+		_h[6] += g;
+		_h[7] += h;
+	}
+
+public:
+	sha256_reference()
+	{
+		static const uint32_t IV[8] = {
+			0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a, 0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19 };
+		memcpy(_h, IV, sizeof(_h));
+	}
+
+	DWORD finish(BYTE* digest)
+	{
+		pad();
+		for (size_t i = 0; i < 8; i++)
+			refhash::write32_be(digest + 4 * i, _h[i]);
+		return 32;
+	}
+};
+
+//SHA-512 (FIPS 180-4), 512 bits output; SHA-384 is the same with other initial values and
+//the first 384 bits of the output
+class sha512_reference : public md_block_hasher<128, true>
+{
+private:
+	uint64_t _h[8];
+	DWORD _digest_len;
+
+protected:
+	void compress(const BYTE* block)
+	{
+		static const uint64_t K[80] = {
+			0x428a2f98d728ae22ULL, 0x7137449123ef65cdULL, 0xb5c0fbcfec4d3b2fULL, 0xe9b5dba58189dbbcULL,
+			0x3956c25bf348b538ULL, 0x59f111f1b605d019ULL, 0x923f82a4af194f9bULL, 0xab1c5ed5da6d8118ULL,
+			0xd807aa98a3030242ULL, 0x12835b0145706fbeULL, 0x243185be4ee4b28cULL, 0x550c7dc3d5ffb4e2ULL,
+			0x72be5d74f27b896fULL, 0x80deb1fe3b1696b1ULL, 0x9bdc06a725c71235ULL, 0xc19bf174cf692694ULL,
+			0xe49b69c19ef14ad2ULL, 0xefbe4786384f25e3ULL, 0x0fc19dc68b8cd5b5ULL, 0x240ca1cc77ac9c65ULL,
+			0x2de92c6f592b0275ULL, 0x4a7484aa6ea6e483ULL, 0x5cb0a9dcbd41fbd4ULL, 0x76f988da831153b5ULL,
+			0x983e5152ee66dfabULL, 0xa831c66d2db43210ULL, 0xb00327c898fb213fULL, 0xbf597fc7beef0ee4ULL,
+			0xc6e00bf33da88fc2ULL, 0xd5a79147930aa725ULL, 0x06ca6351e003826fULL, 0x142929670a0e6e70ULL,
+			0x27b70a8546d22ffcULL, 0x2e1b21385c26c926ULL, 0x4d2c6dfc5ac42aedULL, 0x53380d139d95b3dfULL,
+			0x650a73548baf63deULL, 0x766a0abb3c77b2a8ULL, 0x81c2c92e47edaee6ULL, 0x92722c851482353bULL,
+			0xa2bfe8a14cf10364ULL, 0xa81a664bbc423001ULL, 0xc24b8b70d0f89791ULL, 0xc76c51a30654be30ULL,
+			0xd192e819d6ef5218ULL, 0xd69906245565a910ULL, 0xf40e35855771202aULL, 0x106aa07032bbd1b8ULL,
+			0x19a4c116b8d2d0c8ULL, 0x1e376c085141ab53ULL, 0x2748774cdf8eeb99ULL, 0x34b0bcb5e19b48a8ULL,
+			0x391c0cb3c5c95a63ULL, 0x4ed8aa4ae3418acbULL, 0x5b9cca4f7763e373ULL, 0x682e6ff3d6b2b8a3ULL,
+			0x748f82ee5defb2fcULL, 0x78a5636f43172f60ULL, 0x84c87814a1f0ab72ULL, 0x8cc702081a6439ecULL,
+			0x90befffa23631e28ULL, 0xa4506cebde82bde9ULL, 0xbef9a3f7b2c67915ULL, 0xc67178f2e372532bULL,
+			0xca273eceea26619cULL, 0xd186b8c721c0c207ULL, 0xeada7dd6cde0eb1eULL, 0xf57d4f7fee6ed178ULL,
+			0x06f067aa72176fbaULL, 0x0a637dc5a2c898a6ULL, 0x113f9804bef90daeULL, 0x1b710b35131c471bULL,
+			0x28db77f523047d84ULL, 0x32caab7b40c72493ULL, 0x3c9ebe0a15c9bebcULL, 0x431d67c49c100d4cULL,
+			0x4cc5d4becb3e42b6ULL, 0x597f299cfc657e2aULL, 0x5fcb6fab3ad6faecULL, 0x6c44198c4a475817ULL };
+
+		uint64_t w[80];
+		for (size_t i = 0; i < 16; i++)
+			w[i] = refhash::read64_be(block + 8 * i);
+		for (size_t i = 16; i < 80; i++)
+		{
+			uint64_t s0 = refhash::rotr64(w[i - 15], 1) ^ refhash::rotr64(w[i - 15], 8) ^ (w[i - 15] >> 7);
+			uint64_t s1 = refhash::rotr64(w[i - 2], 19) ^ refhash::rotr64(w[i - 2], 61) ^ (w[i - 2] >> 6);
+			w[i] = w[i - 16] + s0 + w[i - 7] + s1;
+		}
+
+		uint64_t a = _h[0], b = _h[1], c = _h[2], d = _h[3], e = _h[4], f = _h[5], g = _h[6], h = _h[7];
+		for (size_t i = 0; i < 80; i++)
+		{
+			uint64_t s1 = refhash::rotr64(e, 14) ^ refhash::rotr64(e, 18) ^ refhash::rotr64(e, 41);
+			uint64_t ch = (e & f) ^ (~e & g);
+			uint64_t t1 = h + s1 + ch + K[i] + w[i];
+			uint64_t s0 = refhash::rotr64(a, 28) ^ refhash::rotr64(a, 34) ^ refhash::rotr64(a, 39);
+			uint64_t maj = (a & b) ^ (a & c) ^ (b & c);
+			uint64_t t2 = s0 + maj;
+			h = g;
+			g = f;
+			f = e;
+			e = d + t1;
+			d = c;
+			c = b;
+			b = a;
+			a = t1 + t2;
+		}
+		_h[0] += a;
+		_h[1] += b;
+		_h[2] += c;
+		_h[3] += d;
+		_h[4] += e;
+		_h[5] += f;
+		_h[6] += g;
+		_h[7] += h;
+	}
+
+public:
+	sha512_reference(bool sha384 = false) : _digest_len(sha384 ? 48 : 64)
+	{
+		static const uint64_t IV512[8] = {
+			0x6a09e667f3bcc908ULL, 0xbb67ae8584caa73bULL, 0x3c6ef372fe94f82bULL, 0xa54ff53a5f1d36f1ULL,
+			0x510e527fade682d1ULL, 0x9b05688c2b3e6c1fULL, 0x1f83d9abfb41bd6bULL, 0x5be0cd19137e2179ULL };
+		static const uint64_t IV384[8] = {
+			0xcbbb9d5dc1059ed8ULL, 0x629a292a367cd507ULL, 0x9159015a3070dd17ULL, 0x152fecd8f70e5939ULL,
+			0x67332667ffc00b31ULL, 0x8eb44a8768581511ULL, 0xdb0c2e0d64f98fa7ULL, 0x47b5481dbefa4fa4ULL };
+		memcpy(_h, sha384 ? IV384 : IV512, sizeof(_h));
+	}
+
+	DWORD finish(BYTE* digest)
+	{
+		pad();
+		for (size_t i = 0; i < _digest_len / 8; i++)
+			fasthash::write64_be(digest + 8 * i, _h[i]);
+		return _digest_len;
+	}
+};
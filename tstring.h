@@ -227,9 +227,11 @@ private:
 
 	str _delimiter;
 
+	str* _capture; //receives what would be printed to stdout or stderr
+
 public:
-	TMessageHandler() : _out_stream(stdout), _delimiter(_T("\n")) {}
-	TMessageHandler(FILE* f) : _out_stream(f), _delimiter(_T("\n")) {}
+	TMessageHandler() : _out_stream(stdout), _delimiter(_T("\n")), _capture(NULL) {}
+	TMessageHandler(FILE* f) : _out_stream(f), _delimiter(_T("\n")), _capture(NULL) {}
 
 	~TMessageHandler()
 	{
@@ -240,6 +242,22 @@ public:
 	{
 		_out_stream = outstream;
 	}
+
+	FILE* outstream()
+	{
+		return _out_stream;
+	}
+
+	//messages for stdout or stderr are appended to *capture instead of being printed, NULL to print
+	void set_capture(str* capture)
+	{
+		_capture = capture;
+	}
+
+	void clear()
+	{
+		_msgs.clear();
+	}
 	TMessageHandler& operator()(int priority = 0, bool suppress = false)
 	{
 		message_t message;
@@ -292,27 +310,37 @@ public:
 	{
 		struct
 		{
-			bool operator()(message_t& msg1, message_t& msg2)
+			bool operator()(const message_t& msg1, const message_t& msg2) const
 			{
 				return (msg1.priority < msg2.priority);
 			}
 		} _ascending_order;
 
-		std::sort(_msgs.begin(), _msgs.end(), _ascending_order);
+		std::stable_sort(_msgs.begin(), _msgs.end(), _ascending_order); //keep the output order within a priority
 
 		struct PRINT_T
 		{
 		private:
 			FILE* _out_stream;
 			str _delimiter;
+			str* _capture;
 		public:
-			PRINT_T(FILE* f, str delim) : _out_stream(f), _delimiter(delim) {}
+			PRINT_T(FILE* f, str delim, str* capture) : _out_stream(f), _delimiter(delim),
+				_capture((f == stdout || f == stderr) ? capture : NULL) {}
 			void operator()(message_t& message)
 			{
-				if (!message.suppress)
-					_ftprintf(_out_stream, _T("%s%s"), message.message.c_str(), _delimiter.c_str());
+				if (message.suppress)
+					return;
+				if (_capture != NULL)
+					*_capture << message.message << _delimiter;
+				else
+				{
+					_ftprintf(_out_stream, _T("%s"), message.message.c_str());
+					for (size_t i = 0; i < _delimiter.length(); i++) //the delimiter may be a NUL
+						_fputtc(_delimiter[i], _out_stream);
+				}
 			}
-		} _print_msg(_out_stream, _delimiter);
+		} _print_msg(_out_stream, _delimiter, _capture);
 
 		std::for_each(_msgs.begin(), _msgs.end(), _print_msg);
 	}
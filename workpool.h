@@ -0,0 +1,501 @@
+/*
+ Work pool - A small persistent worker thread pool written in C++ for Windows platform.
+ https://github.com/fshb/digest-checksum-tools/
+ Copyright (c) 2019 Sun Hongbo (Felix)
+
+ Permission is hereby granted, free of charge, to any person obtaining a copy
+ of this Software and associated documentation files (the "Software"), to deal
+ in the Software without restriction, including without limitation the rights
+ to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ copies of the Software, and to permit persons to whom the Software is
+ furnished to do so, subject to the following conditions:
+
+ The above copyright notice and this permission notice shall be included in
+ all copies or substantial portions of the Software.
+
+ THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ THE SOFTWARE.
+*/
+
+#ifdef USAGE //usage
+
+#include "workpool.h"
+struct SQUARE_T
+{
+	long* values;
+	void operator()(size_t i) { values[i] *= values[i]; }
+};
+
+int main()
+{
+	long values[100];
+	for (int i = 0; i < 100; i++)
+		values[i] = i;
+
+	work_pool pool; //one worker per logical processor
+	pool.set_placement(true); //on a NUMA system, one worker per processor of every node, pinned
+	SQUARE_T square = { values };
+	pool.run(100, square); //calls square(0) ... square(99) and waits for all of them
+
+	buffer_pool buffers(64 * 1024 * 1024); //at most 64MB of buffers, shared by the workers
+	BYTE* buffer = (BYTE*)buffers.acquire(1024 * 1024); //waits while the limit is reached
+	buffers.release(buffer);
+
+	return 0;
+}
+
+#endif
+#pragma once
+
+#include <windows.h>
+#include <map>
+#include <vector>
+
+class work_pool
+{
+private:
+	struct task_t
+	{
+		virtual ~task_t() {}
+		virtual void operator()(size_t i) = 0;
+	};
+
+	template<class FnT> struct task_impl : public task_t
+	{
+		FnT& fn;
+		task_impl(FnT& f) : fn(f) {}
+		void operator()(size_t i) { fn(i); }
+	};
+
+	std::vector<HANDLE> _threads;
+	DWORD _nThreads;
+	bool _bDefaultCount; //one worker per processor
+
+	//NUMA placement: the processor of each worker, the calling thread's first. Empty when
+	//placement is off or there is a single node, then the workers are not pinned.
+	std::vector<GROUP_AFFINITY> _affinity;
+	volatile LONG _nStarted;
+
+	HANDLE _hWake; //semaphore, one count per worker to wake up
+	HANDLE _hDone; //event, set by the last participant of a run
+
+	task_t* volatile _task;
+	volatile LONG _nNext;
+	volatile LONG _nCount;
+	volatile LONG _nActive;
+	volatile LONG _bBusy;
+	volatile LONG _bQuit;
+
+private:
+	static DWORD WINAPI worker_proc(LPVOID param)
+	{
+		work_pool* pool = (work_pool*)param;
+		LONG i = InterlockedIncrement(&pool->_nStarted);
+		if ((size_t)i < pool->_affinity.size())
+			SetThreadGroupAffinity(GetCurrentThread(), &pool->_affinity[i], NULL);
+
+		while (true)
+		{
+			WaitForSingleObject(pool->_hWake, INFINITE);
+			if (pool->_bQuit)
+				break;
+			pool->drain();
+		}
+		return 0;
+	}
+
+	void drain()
+	{
+		LONG i;
+		while ((i = InterlockedIncrement(&_nNext) - 1) < _nCount)
+			(*_task)((size_t)i);
+
+		if (InterlockedDecrement(&_nActive) == 0)
+			SetEvent(_hDone);
+	}
+
+	void start_threads()
+	{
+		if (!_threads.empty() || _nThreads < 2)
+			return;
+
+		for (DWORD i = 0; i + 1 < _nThreads; i++) //the calling thread is a worker too
+		{
+			HANDLE h = CreateThread(NULL, 0, worker_proc, this, 0, NULL);
+			if (h == NULL)
+				break;
+			_threads.push_back(h);
+		}
+	}
+
+public:
+	static DWORD processor_count()
+	{
+		SYSTEM_INFO si;
+		GetSystemInfo(&si);
+		return si.dwNumberOfProcessors == 0 ? 1 : si.dwNumberOfProcessors;
+	}
+
+	//the node of the processor the calling thread runs on
+	static USHORT current_node()
+	{
+		PROCESSOR_NUMBER processor;
+		USHORT node = 0;
+		GetCurrentProcessorNumberEx(&processor);
+		if (!GetNumaProcessorNodeEx(&processor, &node))
+			node = 0;
+		return node;
+	}
+
+	//set once the workers of a pool are placed on the NUMA nodes
+	static volatile LONG& numa_placed()
+	{
+		static volatile LONG bPlaced = 0;
+		return bPlaced;
+	}
+
+	//a private heap for each node once the workers are placed: its pages are first touched, and
+	//so placed, by the threads of the node that allocate from it. For small objects such as hash
+	//states; the process heap otherwise.
+	static HANDLE local_heap()
+	{
+		if (!numa_placed())
+			return GetProcessHeap();
+
+		const USHORT max_nodes = 64;
+		static HANDLE volatile heaps[max_nodes] = { NULL };
+		USHORT node = current_node();
+		if (node >= max_nodes)
+			return GetProcessHeap();
+		if (heaps[node] == NULL)
+		{
+			HANDLE hHeap = HeapCreate(0, 0, 0);
+			if (hHeap == NULL)
+				return GetProcessHeap();
+			if (InterlockedCompareExchangePointer((PVOID volatile*)&heaps[node], hHeap, NULL) != NULL)
+				HeapDestroy(hHeap);
+		}
+		return heaps[node];
+	}
+
+	work_pool(DWORD nThreads = 0) : _nThreads(nThreads == 0 ? processor_count() : nThreads),
+		_bDefaultCount(nThreads == 0), _nStarted(0),
+		_task(NULL), _nNext(0), _nCount(0), _nActive(0), _bBusy(0), _bQuit(0)
+	{
+		_hWake = CreateSemaphore(NULL, 0, MAXLONG, NULL);
+		_hDone = CreateEvent(NULL, FALSE, FALSE, NULL);
+	}
+
+	~work_pool()
+	{
+		InterlockedExchange(&_bQuit, 1);
+		if (!_threads.empty())
+		{
+			ReleaseSemaphore(_hWake, (LONG)_threads.size(), NULL);
+			WaitForMultipleObjects((DWORD)_threads.size(), &_threads[0], TRUE, INFINITE);
+		}
+		for (size_t i = 0; i < _threads.size(); i++)
+			CloseHandle(_threads[i]);
+		_threads.clear();
+		CloseHandle(_hWake);
+		CloseHandle(_hDone);
+	}
+
+	DWORD size() const { return _nThreads; }
+
+	//pins the workers to processors spread over the NUMA nodes, in turn, and the calling thread
+	//to the first one; with a default count there is a worker for each processor of every node,
+	//of every processor group. nNode >= 0 keeps the workers on that node only, e.g. the node
+	//nearest the storage controller. Called before the first run(), false if nNode has no
+	//processors.
+	bool set_placement(bool bEnabled, LONG nNode = -1)
+	{
+		ULONG nHighestNode = 0;
+		if (!_threads.empty() || !bEnabled || !GetNumaHighestNodeNumber(&nHighestNode))
+			return nNode < 0;
+		if (nHighestNode == 0 && nNode < 0)
+			return true; //a single node, nothing to place
+
+		std::vector<std::vector<GROUP_AFFINITY> > nodes;
+		for (ULONG n = 0; n <= nHighestNode; n++)
+		{
+			GROUP_AFFINITY node_mask;
+			if ((nNode >= 0 && n != (ULONG)nNode) || !GetNumaNodeProcessorMaskEx((USHORT)n, &node_mask))
+				continue;
+
+			nodes.push_back(std::vector<GROUP_AFFINITY>());
+			for (DWORD bit = 0; bit < sizeof(KAFFINITY) * 8; bit++)
+			{
+				if (((node_mask.Mask >> bit) & 1) == 0)
+					continue;
+				GROUP_AFFINITY processor = node_mask;
+				processor.Mask = (KAFFINITY)1 << bit;
+				nodes.back().push_back(processor);
+			}
+		}
+
+		std::vector<GROUP_AFFINITY> affinity;
+		for (size_t k = 0; ; k++)
+		{
+			size_t nPlaced = affinity.size();
+			for (size_t n = 0; n < nodes.size(); n++)
+			{
+				if (k < nodes[n].size())
+					affinity.push_back(nodes[n][k]);
+			}
+			if (affinity.size() == nPlaced)
+				break;
+		}
+		if (affinity.empty())
+			return false;
+
+		if (_bDefaultCount)
+			_nThreads = (DWORD)affinity.size();
+		else if (affinity.size() > _nThreads)
+			affinity.resize(_nThreads);
+		_affinity = affinity;
+		SetThreadGroupAffinity(GetCurrentThread(), &_affinity[0], NULL);
+		InterlockedExchange(&numa_placed(), 1);
+		return true;
+	}
+
+	//calls fn(0) ... fn(n - 1) on the pool threads and the calling thread, returns when all are done.
+	//a run() issued while another run() is in progress (e.g. from inside a task) executes inline.
+	template<class FnT> void run(size_t n, FnT& fn)
+	{
+		if (n == 0)
+			return;
+
+		if (n == 1 || _nThreads < 2 || InterlockedCompareExchange(&_bBusy, 1, 0) != 0)
+		{
+			for (size_t i = 0; i < n; i++)
+				fn(i);
+			return;
+		}
+
+		start_threads();
+
+		task_impl<FnT> task(fn);
+		LONG nWake = (LONG)(n - 1 < _threads.size() ? n - 1 : _threads.size());
+
+		_task = &task;
+		_nCount = (LONG)n;
+		_nNext = 0;
+		_nActive = nWake + 1;
+
+		if (nWake > 0)
+			ReleaseSemaphore(_hWake, nWake, NULL);
+		drain();
+		WaitForSingleObject(_hDone, INFINITE);
+
+		_task = NULL;
+		InterlockedExchange(&_bBusy, 0);
+	}
+};
+
+//buffers for the readers of the workers, taken from one budget: acquire() waits while the
+//buffers in use and the free ones kept for reuse would exceed the limit, so that a reader
+//waits for another to finish instead of growing the memory. The buffers are page aligned,
+//committed on the NUMA node of the acquiring thread once the workers are placed, and backed
+//by large pages if enabled. A request is always granted when no buffer is in use, even one
+//larger than the limit.
+class buffer_pool
+{
+private:
+	struct buffer_t
+	{
+		void* p;
+		size_t size;
+		USHORT node;
+	};
+
+	CRITICAL_SECTION _lock;
+	CONDITION_VARIABLE _released;
+	std::vector<buffer_t> _free; //kept for reuse
+	std::map<void*, buffer_t> _used;
+	size_t _nAllocated; //bytes of the buffers in use and the free ones
+	size_t _nInUse;
+	size_t _nLimit; //0: no limit
+	size_t _nLargePage; //0: large pages are not used
+
+	void* allocate(size_t nBytes, USHORT node)
+	{
+		DWORD dwType = MEM_COMMIT | MEM_RESERVE | (_nLargePage != 0 ? MEM_LARGE_PAGES : 0);
+		void* p = NULL;
+		if (work_pool::numa_placed())
+			p = VirtualAllocExNuma(GetCurrentProcess(), NULL, nBytes, dwType, PAGE_READWRITE, node);
+		if (p == NULL)
+			p = VirtualAlloc(NULL, nBytes, dwType, PAGE_READWRITE);
+		if (p == NULL && _nLargePage != 0) //no large pages left
+			p = VirtualAlloc(NULL, nBytes, MEM_COMMIT | MEM_RESERVE, PAGE_READWRITE);
+		return p;
+	}
+
+	//frees a buffer kept for reuse, the one least likely to be asked for again first
+	void drop_free(size_t i)
+	{
+		VirtualFree(_free[i].p, 0, MEM_RELEASE);
+		_nAllocated -= _free[i].size;
+		_free.erase(_free.begin() + i);
+	}
+
+public:
+	buffer_pool(size_t nLimit = 0) : _nAllocated(0), _nInUse(0), _nLimit(nLimit), _nLargePage(0)
+	{
+		InitializeCriticalSection(&_lock);
+		InitializeConditionVariable(&_released);
+	}
+
+	~buffer_pool()
+	{
+		while (!_free.empty())
+			drop_free(_free.size() - 1);
+		DeleteCriticalSection(&_lock);
+	}
+
+	void set_limit(size_t nLimit) { _nLimit = nLimit; }
+
+	//needs SeLockMemoryPrivilege, which is enabled here if the account holds it; false if not
+	bool enable_large_pages()
+	{
+		HANDLE hToken = NULL;
+		if (!OpenProcessToken(GetCurrentProcess(), TOKEN_ADJUST_PRIVILEGES | TOKEN_QUERY, &hToken))
+			return false;
+
+		TOKEN_PRIVILEGES privileges;
+		privileges.PrivilegeCount = 1;
+		privileges.Privileges[0].Attributes = SE_PRIVILEGE_ENABLED;
+		bool bEnabled = LookupPrivilegeValue(NULL, SE_LOCK_MEMORY_NAME, &privileges.Privileges[0].Luid)
+			&& AdjustTokenPrivileges(hToken, FALSE, &privileges, 0, NULL, NULL)
+			&& GetLastError() != ERROR_NOT_ALL_ASSIGNED;
+		CloseHandle(hToken);
+
+		if (bEnabled)
+			_nLargePage = GetLargePageMinimum();
+		return bEnabled && _nLargePage != 0;
+	}
+
+	void* acquire(size_t nBytes)
+	{
+		const size_t granularity = 64 * 1024;
+		size_t nUnit = _nLargePage != 0 ? _nLargePage : granularity;
+		nBytes = (nBytes + nUnit - 1) / nUnit * nUnit;
+		USHORT node = work_pool::numa_placed() ? work_pool::current_node() : 0;
+
+		EnterCriticalSection(&_lock);
+		while (true)
+		{
+			//a free buffer of the size, of the node if there is one
+			size_t nFound = _free.size();
+			for (size_t i = 0; i < _free.size(); i++)
+			{
+				if (_free[i].size == nBytes && (nFound == _free.size() || _free[i].node == node))
+					nFound = i;
+			}
+			if (nFound < _free.size())
+			{
+				buffer_t buffer = _free[nFound];
+				_free.erase(_free.begin() + nFound);
+				_used[buffer.p] = buffer;
+				_nInUse += buffer.size;
+				LeaveCriticalSection(&_lock);
+				return buffer.p;
+			}
+
+			//room is made by freeing the buffers of other sizes
+			while (_nLimit != 0 && _nAllocated + nBytes > _nLimit && !_free.empty())
+				drop_free(0);
+
+			if (_nLimit == 0 || _nAllocated + nBytes <= _nLimit || _nInUse == 0)
+				break;
+			SleepConditionVariableCS(&_released, &_lock, INFINITE);
+		}
+
+		//the bytes are counted before the allocation, which is made outside the lock
+		_nAllocated += nBytes;
+		_nInUse += nBytes;
+		LeaveCriticalSection(&_lock);
+
+		buffer_t buffer = { allocate(nBytes, node), nBytes, node };
+
+		EnterCriticalSection(&_lock);
+		if (buffer.p != NULL)
+			_used[buffer.p] = buffer;
+		else
+		{
+			_nAllocated -= nBytes;
+			_nInUse -= nBytes;
+			WakeAllConditionVariable(&_released);
+		}
+		LeaveCriticalSection(&_lock);
+		return buffer.p;
+	}
+
+	void release(void* p)
+	{
+		if (p == NULL)
+			return;
+
+		EnterCriticalSection(&_lock);
+		std::map<void*, buffer_t>::iterator it = _used.find(p);
+		if (it != _used.end())
+		{
+			_nInUse -= it->second.size;
+			_free.push_back(it->second);
+			_used.erase(it);
+			WakeAllConditionVariable(&_released);
+		}
+		LeaveCriticalSection(&_lock);
+	}
+};
+
+//token bucket shared by the readers: a read takes its bytes from the bucket, which fills at the
+//rate up to a tenth of a second's worth. A read larger than what is left puts the bucket in
+//debt and the reader sleeps until it is paid, so the readers together keep to the rate.
+class rate_limiter
+{
+private:
+	CRITICAL_SECTION _lock;
+	ULONGLONG _rate; //bytes per second, 0: unlimited
+	double _tokens;
+	ULONGLONG _last; //tick of the last fill
+
+public:
+	rate_limiter() : _rate(0), _tokens(0), _last(0) { InitializeCriticalSection(&_lock); }
+	~rate_limiter() { DeleteCriticalSection(&_lock); }
+
+	void set_rate(ULONGLONG rate)
+	{
+		EnterCriticalSection(&_lock);
+		_rate = rate;
+		_tokens = 0;
+		_last = GetTickCount64();
+		LeaveCriticalSection(&_lock);
+	}
+
+	ULONGLONG rate() const { return _rate; }
+
+	void consume(size_t nBytes)
+	{
+		if (_rate == 0 || nBytes == 0)
+			return;
+
+		EnterCriticalSection(&_lock);
+		ULONGLONG now = GetTickCount64();
+		_tokens += (double)(now - _last) * _rate / 1000;
+		if (_tokens > (double)_rate / 10)
+			_tokens = (double)_rate / 10;
+		_last = now;
+		_tokens -= (double)nBytes;
+		DWORD dwWait = _tokens < 0 ? (DWORD)(-_tokens * 1000 / _rate) : 0;
+		LeaveCriticalSection(&_lock);
+
+		if (dwWait > 0)
+			Sleep(dwWait);
+	}
+};